@@ -45,9 +45,178 @@ std::string opcodeToString(uint8_t opcode) {
     return "LOAD_CELL";
   case OpCode::MAKE_FUNCTION:
     return "MAKE_FUNCTION";
+  case OpCode::JLT:
+    return "JLT";
+  case OpCode::JGT:
+    return "JGT";
+  case OpCode::JEQ:
+    return "JEQ";
+  case OpCode::JGE:
+    return "JGE";
+  case OpCode::JLE:
+    return "JLE";
+  case OpCode::JNE:
+    return "JNE";
+  case OpCode::ADD_LOCAL_CONST:
+    return "ADD_LOCAL_CONST";
+  case OpCode::SUB_LOCAL_CONST:
+    return "SUB_LOCAL_CONST";
+  case OpCode::ADD_NUM:
+    return "ADD_NUM";
+  case OpCode::ADD_STR:
+    return "ADD_STR";
+  case OpCode::COMPARE_NUM_LT:
+    return "COMPARE_NUM_LT";
+  case OpCode::COMPARE_NUM_GT:
+    return "COMPARE_NUM_GT";
+  case OpCode::COMPARE_NUM_EQ:
+    return "COMPARE_NUM_EQ";
+  case OpCode::COMPARE_NUM_GE:
+    return "COMPARE_NUM_GE";
+  case OpCode::COMPARE_NUM_LE:
+    return "COMPARE_NUM_LE";
+  case OpCode::COMPARE_NUM_NE:
+    return "COMPARE_NUM_NE";
+  case OpCode::JLT_NUM:
+    return "JLT_NUM";
+  case OpCode::JGT_NUM:
+    return "JGT_NUM";
+  case OpCode::JEQ_NUM:
+    return "JEQ_NUM";
+  case OpCode::JGE_NUM:
+    return "JGE_NUM";
+  case OpCode::JLE_NUM:
+    return "JLE_NUM";
+  case OpCode::JNE_NUM:
+    return "JNE_NUM";
+  case OpCode::TAIL_CALL:
+    return "TAIL_CALL";
+  case OpCode::WIDE:
+    return "WIDE";
+  case OpCode::MAKE_ARRAY:
+    return "MAKE_ARRAY";
+  case OpCode::GET_INDEX:
+    return "GET_INDEX";
+  case OpCode::SET_INDEX:
+    return "SET_INDEX";
+  case OpCode::LENGTH:
+    return "LENGTH";
+  case OpCode::MAKE_OBJECT:
+    return "MAKE_OBJECT";
+  case OpCode::GET_PROP:
+    return "GET_PROP";
+  case OpCode::SET_PROP:
+    return "SET_PROP";
+  case OpCode::FOR_PREP:
+    return "FOR_PREP";
+  case OpCode::FOR_LOOP:
+    return "FOR_LOOP";
+  case OpCode::FOR_EACH_PREP:
+    return "FOR_EACH_PREP";
+  case OpCode::FOR_EACH_LOOP:
+    return "FOR_EACH_LOOP";
+  case OpCode::RESUME:
+    return "RESUME";
+  case OpCode::YIELD:
+    return "YIELD";
 
   default:
     DIE << "opcodeToString: unknown opcode: " << (int)opcode;
   }
   return "Unknown";
 }
+
+bool isJumpOpcode(uint8_t opcode) {
+  switch (static_cast<OpCode>(opcode)) {
+  case OpCode::JMP_IF_FALSE:
+  case OpCode::JMP:
+  case OpCode::JLT:
+  case OpCode::JGT:
+  case OpCode::JEQ:
+  case OpCode::JGE:
+  case OpCode::JLE:
+  case OpCode::JNE:
+  case OpCode::JLT_NUM:
+  case OpCode::JGT_NUM:
+  case OpCode::JEQ_NUM:
+  case OpCode::JGE_NUM:
+  case OpCode::JLE_NUM:
+  case OpCode::JNE_NUM:
+    return true;
+  default:
+    return isForLoopOpcode(opcode);
+  }
+}
+
+bool isForLoopOpcode(uint8_t opcode) {
+  switch (static_cast<OpCode>(opcode)) {
+  case OpCode::FOR_PREP:
+  case OpCode::FOR_LOOP:
+  case OpCode::FOR_EACH_PREP:
+  case OpCode::FOR_EACH_LOOP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+size_t instructionSize(const uint8_t *instruction) {
+  auto opcode = static_cast<OpCode>(instruction[0]);
+
+  if (opcode == OpCode::WIDE) {
+    auto wideOpcode = static_cast<OpCode>(instruction[1]);
+    if (isForLoopOpcode(instruction[1])) {
+      return 8;
+    }
+    if (isJumpOpcode(instruction[1]) ||
+        wideOpcode == OpCode::ADD_LOCAL_CONST ||
+        wideOpcode == OpCode::SUB_LOCAL_CONST) {
+      return 6;
+    }
+    return 4;
+  }
+
+  switch (opcode) {
+  case OpCode::HALT:
+  case OpCode::ADD:
+  case OpCode::ADD_NUM:
+  case OpCode::ADD_STR:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::DIV:
+  case OpCode::POP:
+  case OpCode::RETURN:
+  case OpCode::GET_INDEX:
+  case OpCode::SET_INDEX:
+  case OpCode::LENGTH:
+  case OpCode::RESUME:
+  case OpCode::YIELD:
+    return 1;
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::SUB_LOCAL_CONST:
+    return 3;
+  default:
+    if (isForLoopOpcode(instruction[0])) {
+      return 4;
+    }
+    return isJumpOpcode(instruction[0]) ? 3 : 2;
+  }
+}
+
+size_t readIndexOperand(const uint8_t *operands, bool wide) {
+  return wide ? ((size_t)operands[0] << 8) | operands[1] : operands[0];
+}
+
+size_t jumpTarget(const uint8_t *code, size_t offset) {
+  auto end = offset + instructionSize(&code[offset]);
+  if (code[offset] != static_cast<uint8_t>(OpCode::WIDE)) {
+    return ((size_t)code[end - 2] << 8) | code[end - 1];
+  }
+  auto operands = &code[end - 4];
+  auto relative =
+      (int32_t)(((uint32_t)operands[0] << 24) | ((uint32_t)operands[1] << 16) |
+                ((uint32_t)operands[2] << 8) | operands[3]);
+  return end + relative;
+}
@@ -25,9 +25,110 @@ enum class OpCode {
   GET_CELL = 0x11,
   SET_CELL = 0x12,
   LOAD_CELL = 0x13,
-  MAKE_FUNCTION = 0x14
+  MAKE_FUNCTION = 0x14,
+  JLT = 0x15,
+  JGT = 0x16,
+  JEQ = 0x17,
+  JGE = 0x18,
+  JLE = 0x19,
+  JNE = 0x1A,
+  ADD_LOCAL_CONST = 0x1B,
+  SUB_LOCAL_CONST = 0x1C,
+
+  // Quickened forms, written over ADD / COMPARE / J* by the VM at runtime.
+  // The COMPARE_NUM_* and J*_NUM groups follow the compareOps_ order.
+  ADD_NUM = 0x1D,
+  ADD_STR = 0x1E,
+  COMPARE_NUM_LT = 0x1F,
+  COMPARE_NUM_GT = 0x20,
+  COMPARE_NUM_EQ = 0x21,
+  COMPARE_NUM_GE = 0x22,
+  COMPARE_NUM_LE = 0x23,
+  COMPARE_NUM_NE = 0x24,
+  JLT_NUM = 0x25,
+  JGT_NUM = 0x26,
+  JEQ_NUM = 0x27,
+  JGE_NUM = 0x28,
+  JLE_NUM = 0x29,
+  JNE_NUM = 0x2A,
+
+  // CALL in tail position: replaces the current frame instead of pushing
+  TAIL_CALL = 0x2B,
+
+  // Prefix widening the operands of the next instruction: indices become
+  // 16-bit, and jump targets 32-bit offsets relative to the end of the
+  // instruction. Emitted only when the narrow form doesn't fit.
+  WIDE = 0x2C,
+
+  // Arrays: MAKE_ARRAY collects its operand count of values, GET_INDEX /
+  // SET_INDEX take the array and the index (and the value) from the stack
+  MAKE_ARRAY = 0x2D,
+  GET_INDEX = 0x2E,
+  SET_INDEX = 0x2F,
+  LENGTH = 0x30,
+
+  // Records: MAKE_OBJECT takes the values of the properties of its shape
+  // (CodeObject::shapes), GET_PROP / SET_PROP the record (and the value)
+  // and access the property through the inline cache of their operand
+  // (CodeObject::propertyCaches)
+  MAKE_OBJECT = 0x31,
+  GET_PROP = 0x32,
+  SET_PROP = 0x33,
+
+  // Loops over the three frame slots from their slot operand on: the
+  // counter, limit and step of a counted loop, or the element, array and
+  // position of an array loop. FOR_PREP starts the loop or jumps past it,
+  // FOR_LOOP steps it and jumps back to the body while it runs
+  FOR_PREP = 0x34,
+  FOR_LOOP = 0x35,
+  FOR_EACH_PREP = 0x36,
+  FOR_EACH_LOOP = 0x37,
+
+  // Coroutines: RESUME takes the coroutine and the value to pass in and
+  // leaves what it yields or returns, YIELD replaces the yielded value on
+  // top of the stack with the value of the next resume
+  RESUME = 0x38,
+  YIELD = 0x39
 };
 
+/**
+ * Largest index / absolute jump target of the narrow forms.
+ */
+constexpr size_t NARROW_INDEX_LIMIT = 0xFF;
+constexpr size_t NARROW_JUMP_LIMIT = 0xFFFF;
+
+constexpr size_t WIDE_INDEX_LIMIT = 0xFFFF;
+
 std::string opcodeToString(uint8_t opcode);
 
+/**
+ * JMP, JMP_IF_FALSE, the fused compare jumps, quickened or not, and the
+ * loop opcodes.
+ */
+bool isJumpOpcode(uint8_t opcode);
+
+/**
+ * The loop opcodes: jumps whose target follows a slot index operand.
+ */
+bool isForLoopOpcode(uint8_t opcode);
+
+/**
+ * Size of the stack tier instruction at `instruction`, its WIDE prefix and
+ * operands included.
+ */
+size_t instructionSize(const uint8_t *instruction);
+
+/**
+ * Index operand at `operands`: one byte, or two big-endian ones in the
+ * WIDE form.
+ */
+size_t readIndexOperand(const uint8_t *operands, bool wide);
+
+/**
+ * Bytecode offset the jump at `offset` goes to: narrow jumps end in an
+ * absolute 16-bit address, WIDE ones in a 32-bit offset relative to their
+ * end.
+ */
+size_t jumpTarget(const uint8_t *code, size_t offset);
+
 #endif // __OpCode_h
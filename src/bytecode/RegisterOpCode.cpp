@@ -0,0 +1,87 @@
+#include "RegisterOpCode.h"
+#include "../Logger.h"
+
+std::string registerOpcodeToString(uint8_t opcode) {
+  switch (static_cast<RegisterOpCode>(opcode)) {
+  case RegisterOpCode::HALT:
+    return "HALT";
+  case RegisterOpCode::LOADK:
+    return "LOADK";
+  case RegisterOpCode::MOVE:
+    return "MOVE";
+  case RegisterOpCode::ADD:
+    return "ADD";
+  case RegisterOpCode::SUB:
+    return "SUB";
+  case RegisterOpCode::MUL:
+    return "MUL";
+  case RegisterOpCode::DIV:
+    return "DIV";
+  case RegisterOpCode::COMPARE:
+    return "COMPARE";
+  case RegisterOpCode::JMP_IF_FALSE:
+    return "JMP_IF_FALSE";
+  case RegisterOpCode::JMP:
+    return "JMP";
+  case RegisterOpCode::GET_GLOBAL:
+    return "GET_GLOBAL";
+  case RegisterOpCode::SET_GLOBAL:
+    return "SET_GLOBAL";
+  case RegisterOpCode::CALL:
+    return "CALL";
+  case RegisterOpCode::RETURN:
+    return "RETURN";
+  case RegisterOpCode::GET_CELL:
+    return "GET_CELL";
+  case RegisterOpCode::SET_CELL:
+    return "SET_CELL";
+  case RegisterOpCode::LOAD_CELL:
+    return "LOAD_CELL";
+  case RegisterOpCode::MAKE_FUNCTION:
+    return "MAKE_FUNCTION";
+  case RegisterOpCode::JLT:
+    return "JLT";
+  case RegisterOpCode::JGT:
+    return "JGT";
+  case RegisterOpCode::JEQ:
+    return "JEQ";
+  case RegisterOpCode::JGE:
+    return "JGE";
+  case RegisterOpCode::JLE:
+    return "JLE";
+  case RegisterOpCode::JNE:
+    return "JNE";
+  case RegisterOpCode::TAIL_CALL:
+    return "TAIL_CALL";
+  case RegisterOpCode::MAKE_ARRAY:
+    return "MAKE_ARRAY";
+  case RegisterOpCode::GET_INDEX:
+    return "GET_INDEX";
+  case RegisterOpCode::SET_INDEX:
+    return "SET_INDEX";
+  case RegisterOpCode::LENGTH:
+    return "LENGTH";
+  case RegisterOpCode::MAKE_OBJECT:
+    return "MAKE_OBJECT";
+  case RegisterOpCode::GET_PROP:
+    return "GET_PROP";
+  case RegisterOpCode::SET_PROP:
+    return "SET_PROP";
+  case RegisterOpCode::FOR_PREP:
+    return "FOR_PREP";
+  case RegisterOpCode::FOR_LOOP:
+    return "FOR_LOOP";
+  case RegisterOpCode::FOR_EACH_PREP:
+    return "FOR_EACH_PREP";
+  case RegisterOpCode::FOR_EACH_LOOP:
+    return "FOR_EACH_LOOP";
+  case RegisterOpCode::RESUME:
+    return "RESUME";
+  case RegisterOpCode::YIELD:
+    return "YIELD";
+
+  default:
+    DIE << "registerOpcodeToString: unknown opcode: " << (int)opcode;
+  }
+  return "Unknown";
+}
@@ -0,0 +1,63 @@
+#ifndef __RegisterOpCode_h
+#define __RegisterOpCode_h
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Register-based instruction set. Operands address frame slots relative
+ * to bp: R(x) is bp[x], slot 0 holds the function itself, followed by the
+ * arguments, locals and temporaries. RK(x) operands name a constant when
+ * the REGISTER_CONST_BIT is set, and a register otherwise. S(x) and P(x)
+ * are the shapes and property caches of the code object. The loop opcodes
+ * work on three registers from R(A) on, see OpCode::FOR_PREP; "<" stands
+ * for ">" under a negative step.
+ */
+enum class RegisterOpCode {
+  HALT = 0x00,          // A         return R(A)
+  LOADK = 0x01,         // A K       R(A) = K(K)
+  MOVE = 0x02,          // A B       R(A) = R(B)
+  ADD = 0x03,           // A B C     R(A) = RK(B) + RK(C)
+  SUB = 0x04,           // A B C     R(A) = RK(B) - RK(C)
+  MUL = 0x05,           // A B C     R(A) = RK(B) * RK(C)
+  DIV = 0x06,           // A B C     R(A) = RK(B) / RK(C)
+  COMPARE = 0x07,       // A B C op  R(A) = RK(B) <op> RK(C)
+  JMP_IF_FALSE = 0x08,  // A addr    jump unless RK(A)
+  JMP = 0x09,           // addr      jump
+  GET_GLOBAL = 0x0A,    // A G       R(A) = G(G)
+  SET_GLOBAL = 0x0B,    // A G       G(G) = R(A)
+  CALL = 0x0C,          // A N       R(A) = R(A)(R(A + 1), ..., R(A + N))
+  RETURN = 0x0D,        // A         return R(A) into the callee slot
+  GET_CELL = 0x0E,      // A C       R(A) = cells[C].value
+  SET_CELL = 0x0F,      // A C       cells[C].value = R(A)
+  LOAD_CELL = 0x10,     // A C       R(A) = cells[C]
+  MAKE_FUNCTION = 0x11, // A K B N   R(A) = closure(K(K), R(B)..R(B + N - 1))
+  JLT = 0x12,           // B C addr  jump unless RK(B) >= RK(C)
+  JGT = 0x13,           // B C addr  jump unless RK(B) <= RK(C)
+  JEQ = 0x14,           // B C addr  jump unless RK(B) != RK(C)
+  JGE = 0x15,           // B C addr  jump unless RK(B) < RK(C)
+  JLE = 0x16,           // B C addr  jump unless RK(B) > RK(C)
+  JNE = 0x17,           // B C addr  jump unless RK(B) == RK(C)
+  TAIL_CALL = 0x18,     // A N       return R(A)(R(A + 1), ..., R(A + N))
+  MAKE_ARRAY = 0x19,    // A B N     R(A) = [R(B), ..., R(B + N - 1)]
+  GET_INDEX = 0x1A,     // A B C     R(A) = RK(B)[RK(C)]
+  SET_INDEX = 0x1B,     // A B C     RK(A)[RK(B)] = R(C)
+  LENGTH = 0x1C,        // A B       R(A) = len(RK(B))
+  MAKE_OBJECT = 0x1D,   // A S B     R(A) = record(S(S), R(B), ...)
+  GET_PROP = 0x1E,      // A B P     R(A) = RK(B).P(P)
+  SET_PROP = 0x1F,      // A P C     RK(A).P(P) = R(C)
+  FOR_PREP = 0x20,      // A addr    jump unless R(A) < R(A + 1) by R(A + 2)
+  FOR_LOOP = 0x21,      // A addr    R(A) += R(A + 2), jump if R(A) < R(A + 1)
+  FOR_EACH_PREP = 0x22, // A addr    R(A) = R(A + 1)[0], jump if empty
+  FOR_EACH_LOOP = 0x23, // A addr    R(A) = R(A + 1)[++R(A + 2)], jump if any
+  RESUME = 0x24,        // A B C     R(A) = resume RK(B) with RK(C)
+  YIELD = 0x25          // A B       R(A) = yield RK(B)
+};
+
+constexpr uint8_t REGISTER_CONST_BIT = 0x80;
+
+constexpr size_t REGISTER_LIMIT = REGISTER_CONST_BIT;
+
+std::string registerOpcodeToString(uint8_t opcode);
+
+#endif // __RegisterOpCode_h
@@ -5,18 +5,73 @@
 #include "../vm/EvaValue.h"
 #include "../vm/Global.h"
 #include "Scope.h"
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <set>
 #include <vector>
 
-void EvaCompiler::functionCall(const Exp &exp) {
+void EvaCompiler::functionCall(const Exp &exp, bool isTailCall) {
   gen(exp.list[0]);
   for (auto i = 1; i < exp.list.size(); i++) {
     gen(exp.list[i]);
   }
-  emit(static_cast<uint8_t>(OpCode::CALL));
+  if (exp.list.size() - 1 > NARROW_INDEX_LIMIT) {
+    DIE << "[EvaCompiler]: Too many arguments in a call.";
+  }
+  emit(static_cast<uint8_t>(isTailCall ? OpCode::TAIL_CALL : OpCode::CALL));
   emit(exp.list.size() - 1);
+  emit(callSiteCacheIdx(exp.list[0]));
+}
+
+size_t EvaCompiler::callSiteCacheIdx(const Exp &callee) {
+  if (callee.type != ExpType::SYMBOL || isLiteral(callee) ||
+      scopeStack_.top()->getNameGetter(callee.string) !=
+          static_cast<int>(OpCode::GET_GLOBAL) ||
+      co->callSiteCaches.size() >= NO_CALL_SITE_CACHE) {
+    return NO_CALL_SITE_CACHE;
+  }
+
+  CallSiteCache site;
+  site.globalIndex = global->getGlobalIndex(callee.string);
+  co->callSiteCaches.push_back(site);
+  return co->callSiteCaches.size() - 1;
+}
+
+size_t EvaCompiler::shapeIdx(const Exp &exp) {
+  auto shape = &Shape::root;
+  for (auto i = 1; i < exp.list.size(); i++) {
+    auto name = propertyName(exp.list[i].list[0]);
+    if (shape->slotOf(name) != -1) {
+      DIE << "[EvaCompiler]: Duplicate property " << name->view()
+          << " in an object literal.";
+    }
+    shape = shape->withProperty(name);
+  }
+
+  auto &shapes = co->shapes;
+  auto it = std::find(shapes.begin(), shapes.end(), shape);
+  if (it != shapes.end()) {
+    return it - shapes.begin();
+  }
+  shapes.push_back(shape);
+  return shapes.size() - 1;
+}
+
+size_t EvaCompiler::propertyCacheIdx(const Exp &name) {
+  // Every site gets its own cache, even for the same property
+  PropertyCache cache;
+  cache.name = propertyName(name);
+  co->propertyCaches.push_back(cache);
+  return co->propertyCaches.size() - 1;
+}
+
+StringObject *EvaCompiler::propertyName(const Exp &name) {
+  if (name.type != ExpType::SYMBOL) {
+    DIE << "[EvaCompiler]: Property names are symbols.";
+  }
+  // The constant keeps the name alive for the shapes it is in
+  return asString(co->constants[stringConstIdx(name.string)]);
 }
 
 void EvaCompiler::genBinaryOp(const Exp &exp, uint8_t op) {
@@ -25,6 +80,125 @@ void EvaCompiler::genBinaryOp(const Exp &exp, uint8_t op) {
   emit(op);
 }
 
+void EvaCompiler::genBinaryOp(const Exp &exp, uint8_t op,
+                              uint8_t localConstOp) {
+  // (op local <number>) is fused into a single instruction which reads
+  // the local slot directly instead of pushing both operands
+  if (isLocalVar(exp.list[1]) && exp.list[2].type == ExpType::NUMBER) {
+    size_t localIndex = co->getLocalIndex(exp.list[1].string);
+    auto constIndex = numericConstIdx(exp.list[2].number);
+
+    if (localIndex > NARROW_INDEX_LIMIT || constIndex > NARROW_INDEX_LIMIT) {
+      // Both operands widen together, whichever of them needs it
+      emit(static_cast<uint8_t>(OpCode::WIDE));
+      emit(localConstOp);
+      emit((localIndex >> 8) & 0xff);
+      emit(localIndex & 0xff);
+      emit((constIndex >> 8) & 0xff);
+      emit(constIndex & 0xff);
+    } else {
+      emit(localConstOp);
+      emit(localIndex);
+      emit(constIndex);
+    }
+    return;
+  }
+  genBinaryOp(exp, op);
+}
+
+size_t EvaCompiler::genJumpIfFalse(const Exp &test) {
+  // Comparison testers are fused with the branch: the emitted opcode
+  // jumps when the comparison does not hold, so no boolean is pushed
+  if (test.type == ExpType::LIST && test.list.size() == 3 &&
+      test.list[0].type == ExpType::SYMBOL &&
+      compareJumpOps_.count(test.list[0].string) != 0) {
+    gen(test.list[1]);
+    gen(test.list[2]);
+    emit(static_cast<uint8_t>(compareJumpOps_[test.list[0].string]));
+  } else {
+    gen(test);
+    emit(static_cast<uint8_t>(OpCode::JMP_IF_FALSE));
+  }
+  emit(0); // The placeholder consists of two consecutive 8-bit cells
+  emit(0); // representing a 16-bit address
+  return getOffset() - 2;
+}
+
+void EvaCompiler::genForLoop(const Exp &exp) {
+  auto &header = exp.list[1];
+  auto isCounted = isCountedLoop(exp);
+
+  if (isCounted) {
+    gen(header.list[1]);
+    gen(header.list[2]);
+    if (header.list.size() == 4) {
+      gen(header.list[3]);
+    } else {
+      emitIndexed(OpCode::CONST, numericConstIdx(1));
+    }
+  } else {
+    // FOR_EACH_PREP sets the element and position
+    emitIndexed(OpCode::CONST, booleanConstIdx(false));
+    gen(header.list[1]);
+    emitIndexed(OpCode::CONST, numericConstIdx(0));
+  }
+
+  scopeStack_.push(scopeInfo_.at(&exp));
+  blockEnter();
+
+  auto varName = header.list[0].string;
+  auto isCell = scopeStack_.top()->getNameSetter(varName) ==
+                static_cast<uint8_t>(OpCode::SET_CELL);
+
+  size_t slot = co->locals.size();
+  if (slot > NARROW_INDEX_LIMIT) {
+    DIE << "[EvaCompiler]: Too many locals before a for loop.";
+  }
+  for (const auto &name : forSlotNames(exp, isCell)) {
+    co->addLocal(name);
+  }
+
+  emit(static_cast<uint8_t>(isCounted ? OpCode::FOR_PREP
+                                      : OpCode::FOR_EACH_PREP));
+  emit(slot);
+  emit(0); // Placeholder for the address of the loop end
+  emit(0);
+  auto loopEndJmpPlaceholderAddr = getOffset() - 2;
+
+  auto loopBodyAddr = getOffset();
+  if (isCell) {
+    co->cellNames.push_back(varName);
+    emitIndexed(OpCode::GET_LOCAL, slot);
+    emitIndexed(OpCode::SET_CELL, co->cellNames.size() - 1);
+    emit(static_cast<uint8_t>(OpCode::POP));
+  }
+  gen(exp.list[2]);
+  emit(static_cast<uint8_t>(OpCode::POP));
+
+  emit(static_cast<uint8_t>(isCounted ? OpCode::FOR_LOOP
+                                      : OpCode::FOR_EACH_LOOP));
+  emit(slot);
+  emit(0); // Placeholder for the address of the loop body
+  emit(0);
+  patchJumpAddress(getOffset() - 2, loopBodyAddr);
+  patchJumpAddress(loopEndJmpPlaceholderAddr, getOffset());
+
+  // The loop slots always go, even from a function body, which leaves
+  // its own slots to the RETURN path: hence no blockExit
+  emitIndexed(OpCode::CONST, booleanConstIdx(false));
+  emitIndexed(OpCode::SCOPE_EXIT, getVarsCountOnScopeExit());
+  co->scopeLevel--;
+  scopeStack_.pop();
+}
+
+void EvaCompiler::genPassedValue(const Exp &exp, size_t index) {
+  if (index < exp.list.size()) {
+    gen(exp.list[index]);
+  } else {
+    emitIndexed(OpCode::CONST, booleanConstIdx(false));
+  }
+}
+
 EvaCompiler::EvaCompiler(std::shared_ptr<Global> global)
     : global(global), disassembler(std::make_unique<EvaDisassembler>(global)) {}
 
@@ -38,6 +212,7 @@ void EvaCompiler::compile(const Exp &exp) {
 
   gen(exp);
   emit(static_cast<uint8_t>(OpCode::HALT));
+  relaxJumps();
 }
 
 void EvaCompiler::analyze(const Exp &exp, std::shared_ptr<Scope> scope) {
@@ -58,6 +233,13 @@ void EvaCompiler::analyze(const Exp &exp, std::shared_ptr<Scope> scope) {
 
         scopeInfo_[&exp] = newScope;
 
+        // Natives and constants defined by the VM are globals too
+        if (scope == nullptr) {
+          for (const auto &globalVar : global->globals) {
+            newScope->addLocal(globalVar.name);
+          }
+        }
+
         for (auto i = 1; i < exp.list.size(); ++i) {
           analyze(exp.list[i], newScope);
         }
@@ -89,6 +271,58 @@ void EvaCompiler::analyze(const Exp &exp, std::shared_ptr<Scope> scope) {
           newScope->addLocal(exp.list[1].list[i].string);
         }
         analyze(exp.list[2], newScope);
+      } else if (op == "for") {
+        auto &header = exp.list[1];
+        if (exp.list.size() != 3 || header.type != ExpType::LIST ||
+            header.list.size() < 2 || header.list.size() > 4 ||
+            header.list[0].type != ExpType::SYMBOL) {
+          DIE << "[EvaCompiler]: Malformed for loop, expected "
+              << "(for (name start end [step]) body) or "
+              << "(for (name array) body).";
+        }
+
+        // The bounds are evaluated outside of the loop block
+        for (auto i = 1; i < header.list.size(); ++i) {
+          analyze(header.list[i], scope);
+        }
+
+        auto newScope = std::make_shared<Scope>(ScopeType::BLOCK, scope);
+        scopeInfo_[&exp] = newScope;
+        newScope->addLocal(header.list[0].string);
+        analyze(exp.list[2], newScope);
+      } else if (op == "resume" || op == "yield") {
+        // The value passed along is optional, false by default
+        auto operands = exp.list.size() - 1;
+        if (op == "resume" ? operands < 1 || operands > 2 : operands > 1) {
+          DIE << "[EvaCompiler]: Malformed " << op << ", expected "
+              << (op == "resume" ? "(resume coroutine [value])."
+                                 : "(yield [value]).");
+        }
+        for (auto i = 1; i < exp.list.size(); ++i) {
+          analyze(exp.list[i], scope);
+        }
+      } else if (op == "object") {
+        // Property names are no variable references
+        for (auto i = 1; i < exp.list.size(); ++i) {
+          auto &entry = exp.list[i];
+          if (entry.type != ExpType::LIST || entry.list.size() != 2 ||
+              entry.list[0].type != ExpType::SYMBOL) {
+            DIE << "[EvaCompiler]: Malformed object, expected "
+                << "(object (name value) ...).";
+          }
+          analyze(entry.list[1], scope);
+        }
+      } else if (op == "prop" || op == "set-prop") {
+        if (exp.list.size() != (op == "prop" ? 3 : 4) ||
+            exp.list[2].type != ExpType::SYMBOL) {
+          DIE << "[EvaCompiler]: Malformed " << op << ", expected "
+              << (op == "prop" ? "(prop object name)."
+                               : "(set-prop object name value).");
+        }
+        analyze(exp.list[1], scope);
+        if (op == "set-prop") {
+          analyze(exp.list[3], scope);
+        }
       } else if (keywords.count(op) != 0) {
         for (auto i = 1; i < exp.list.size(); ++i) {
           analyze(exp.list[i], scope);
@@ -107,36 +341,37 @@ void EvaCompiler::analyze(const Exp &exp, std::shared_ptr<Scope> scope) {
 };
 
 void EvaCompiler::gen(const Exp &exp) {
+  auto isTail = tailPosition_;
+  tailPosition_ = false;
+
   switch (exp.type) {
   case ExpType::NUMBER:
-    emit(static_cast<uint8_t>(OpCode::CONST));
-    emit(numericConstIdx(exp.number));
+    emitIndexed(OpCode::CONST, numericConstIdx(exp.number));
     break;
 
   case ExpType::STRING:
-    emit(static_cast<uint8_t>(OpCode::CONST));
-    emit(stringConstIdx(exp.string));
+    emitIndexed(OpCode::CONST, stringConstIdx(exp.string));
     break;
 
   case ExpType::SYMBOL:
     if (exp.string == "true" || exp.string == "false") {
-      emit(static_cast<uint8_t>(OpCode::CONST));
-      emit(booleanConstIdx(exp.string == "true" ? true : false));
+      emitIndexed(OpCode::CONST,
+                  booleanConstIdx(exp.string == "true" ? true : false));
     } else {
       auto varName = exp.string;
 
       auto opCodeGetter = scopeStack_.top()->getNameGetter(varName);
-      emit(opCodeGetter);
+      auto getter = static_cast<OpCode>(opCodeGetter);
 
-      if (opCodeGetter == static_cast<uint8_t>(OpCode::GET_LOCAL)) {
-        emit(co->getLocalIndex(varName));
-      } else if (opCodeGetter == static_cast<uint8_t>(OpCode::GET_CELL)) {
-        emit(co->getCellIndex(varName));
+      if (getter == OpCode::GET_LOCAL) {
+        emitIndexed(getter, co->getLocalIndex(varName));
+      } else if (getter == OpCode::GET_CELL) {
+        emitIndexed(getter, co->getCellIndex(varName));
       } else {
         if (!global->exists(varName)) {
           DIE << "[EvaCompiler]: Reference error:" << varName;
         }
-        emit(global->getGlobalIndex(varName));
+        emitIndexed(getter, global->getGlobalIndex(varName));
       }
     }
     break;
@@ -148,9 +383,11 @@ void EvaCompiler::gen(const Exp &exp) {
       auto op = tag.string;
 
       if (op == "+") {
-        genBinaryOp(exp, static_cast<uint8_t>(OpCode::ADD));
+        genBinaryOp(exp, static_cast<uint8_t>(OpCode::ADD),
+                     static_cast<uint8_t>(OpCode::ADD_LOCAL_CONST));
       } else if (op == "-") {
-        genBinaryOp(exp, static_cast<uint8_t>(OpCode::SUB));
+        genBinaryOp(exp, static_cast<uint8_t>(OpCode::SUB),
+                     static_cast<uint8_t>(OpCode::SUB_LOCAL_CONST));
       } else if (op == "*") {
         genBinaryOp(exp, static_cast<uint8_t>(OpCode::MUL));
       } else if (op == "/") {
@@ -161,14 +398,10 @@ void EvaCompiler::gen(const Exp &exp) {
         emit(static_cast<uint8_t>(OpCode::COMPARE));
         emit(compareOps_[op]);
       } else if (op == "if") {
-        gen(exp.list[1]); // Generate tester expr
-        emit(static_cast<uint8_t>(OpCode::JMP_IF_FALSE));
-        emit(0); // Set a placeholder for the address that will later point
-                 // to the beginning of the ELSE branch
-        emit(0); // The placeholder consists of two consecutive 8-bit cells
-                 // representing a 16-bit address
-        auto elseJmpPlaceholderAddr =
-            getOffset() - 2; // Store the address of the placeholder
+        // Generate tester expr followed by a jump to the ELSE branch, the
+        // address is patched once the consequent branch is generated
+        auto elseJmpPlaceholderAddr = genJumpIfFalse(exp.list[1]);
+        tailPosition_ = isTail;
         gen(exp.list[2]);    // Generate the consequent branch
         emit(static_cast<uint8_t>(OpCode::JMP));
         emit(0); // Set a placeholder for the address that will later point
@@ -181,6 +414,7 @@ void EvaCompiler::gen(const Exp &exp) {
         patchJumpAddress(elseJmpPlaceholderAddr, elseBranchBeginAddr);
 
         if (exp.list.size() == 4) {
+          tailPosition_ = isTail;
           gen(exp.list[3]);
         }
 
@@ -190,27 +424,39 @@ void EvaCompiler::gen(const Exp &exp) {
         auto varName = exp.list[1].string;
 
         auto opCodeSetter = scopeStack_.top()->getNameSetter(varName);
+        auto isCell = opCodeSetter == static_cast<uint8_t>(OpCode::SET_CELL);
 
         if (isLambda(exp.list[2])) {
+          // A recursive lambda captures the cell it is stored into
+          if (isCell) {
+            co->cellNames.push_back(varName);
+          }
           compileFunction(exp.list[2], varName, exp.list[2].list[1],
                           exp.list[2].list[2]);
         } else {
           gen(exp.list[2]);
+          if (isCell) {
+            co->cellNames.push_back(varName);
+          }
         }
 
         if (opCodeSetter == static_cast<uint8_t>(OpCode::SET_GLOBAL)) {
           global->define(varName);
-          emit(static_cast<uint8_t>(OpCode::SET_GLOBAL));
-          emit(global->getGlobalIndex(varName));
-        } else if (opCodeSetter == static_cast<uint8_t>(OpCode::SET_CELL)) {
-          co->cellNames.push_back(varName);
-          emit(static_cast<uint8_t>(OpCode::SET_CELL));
-          emit(co->cellNames.size() - 1);
+          emitIndexed(OpCode::SET_GLOBAL, global->getGlobalIndex(varName));
+          emit(static_cast<uint8_t>(OpCode::POP));
+        } else if (isCell) {
+          emitIndexed(OpCode::SET_CELL, co->cellNames.size() - 1);
           emit(static_cast<uint8_t>(OpCode::POP));
         } else {
           co->addLocal(varName);
         }
 
+      } else if (op == "set" && isTaggedList(exp.list[1], "index")) {
+        // (set (index array i) value)
+        gen(exp.list[1].list[1]);
+        gen(exp.list[1].list[2]);
+        gen(exp.list[2]);
+        emit(static_cast<uint8_t>(OpCode::SET_INDEX));
       } else if (op == "set") {
         auto varName = exp.list[1].string;
 
@@ -219,18 +465,15 @@ void EvaCompiler::gen(const Exp &exp) {
         gen(exp.list[2]);
 
         if (opCodeSetter == static_cast<uint8_t>(OpCode::SET_LOCAL)) {
-          emit(static_cast<uint8_t>(OpCode::SET_LOCAL));
-          emit(co->getLocalIndex(varName));
+          emitIndexed(OpCode::SET_LOCAL, co->getLocalIndex(varName));
         } else if (opCodeSetter == static_cast<uint8_t>(OpCode::SET_CELL)) {
-          emit(static_cast<uint8_t>(OpCode::SET_CELL));
-          emit(co->getCellIndex(varName));
+          emitIndexed(OpCode::SET_CELL, co->getCellIndex(varName));
         } else {
           auto globalIndex = global->getGlobalIndex(exp.list[1].string);
           if (globalIndex == -1) {
             DIE << "Reference error: " << varName << " is not defined.";
           }
-          emit(static_cast<uint8_t>(OpCode::SET_GLOBAL));
-          emit(globalIndex);
+          emitIndexed(OpCode::SET_GLOBAL, globalIndex);
         }
 
       } else if (op == "begin") {
@@ -240,12 +483,18 @@ void EvaCompiler::gen(const Exp &exp) {
         for (auto i = 1; i < exp.list.size(); i++) {
           bool isLast = i == exp.list.size() - 1;
 
+          // A literal whose value is discarded would only emit CONST; POP
+          if (!isLast && isLiteral(exp.list[i])) {
+            continue;
+          }
+
+          tailPosition_ = isLast && isTail;
           gen(exp.list[i]);
 
           auto isDecl = isVarDeclaration(exp.list[i]) ||
                         isFunctionDeclaration(exp.list[i]);
 
-          if (!isLast && !isWhileLoop(exp.list[i]) && !isDecl) {
+          if (!isLast && !isDecl) {
             emit(static_cast<uint8_t>(OpCode::POP));
           }
 
@@ -260,47 +509,86 @@ void EvaCompiler::gen(const Exp &exp) {
 
       else if (op == "while") {
         auto loopStartAddr = getOffset();
-        gen(exp.list[1]); // Tester expr
-        emit(static_cast<uint8_t>(OpCode::JMP_IF_FALSE));
-        emit(0); // Placeholder for the address of the loop end
-        emit(0);
-        auto loopEndJmpPlaceholderAddr = getOffset() - 2;
-        auto loopBody = exp.list[2];
-        if (!isTaggedList(
-                exp.list[2],
-                "begin")) { // if loop body is not wrapped in begin block
-          std::vector<Exp> beginList;
-          std::string beginStr = "begin";
-          beginList.push_back(Exp(beginStr));
-          beginList.push_back(exp.list[2]);
-          loopBody = Exp(beginList);
-        }
+        // Tester expr with a placeholder for the address of the loop end
+        auto loopEndJmpPlaceholderAddr = genJumpIfFalse(exp.list[1]);
         gen(exp.list[2]); // Loop body
+        emit(static_cast<uint8_t>(OpCode::POP));
         emit(static_cast<uint8_t>(OpCode::JMP));
         emit(0); // Placeholder for the address of the loop start
         emit(0);
         patchJumpAddress(loopEndJmpPlaceholderAddr, getOffset());
         patchJumpAddress(getOffset() - 2, loopStartAddr);
+
+        // A loop is an expression of value false, like a for loop
+        emitIndexed(OpCode::CONST, booleanConstIdx(false));
+      } else if (op == "for") {
+        genForLoop(exp);
       } else if (op == "def") {
         auto fnName = exp.list[1].string;
 
-        compileFunction(exp, fnName, exp.list[2], exp.list[3]);
+        auto isCell = !isGlobalScope() &&
+                      scopeStack_.top()->getNameSetter(fnName) ==
+                          static_cast<uint8_t>(OpCode::SET_CELL);
 
         if (isGlobalScope()) {
           global->define(fnName);
-          emit(static_cast<uint8_t>(OpCode::SET_GLOBAL));
-          emit(global->getGlobalIndex(fnName));
+        } else if (isCell) {
+          co->cellNames.push_back(fnName);
+        }
+
+        compileFunction(exp, fnName, exp.list[2], exp.list[3]);
+
+        if (isGlobalScope()) {
+          emitIndexed(OpCode::SET_GLOBAL, global->getGlobalIndex(fnName));
+          emit(static_cast<uint8_t>(OpCode::POP));
+        } else if (isCell) {
+          emitIndexed(OpCode::SET_CELL, co->cellNames.size() - 1);
+          emit(static_cast<uint8_t>(OpCode::POP));
         } else {
           co->addLocal(fnName);
         }
       } else if (op == "lambda") {
         compileFunction(exp, "lambda", exp.list[1], exp.list[2]);
 
+      } else if (op == "array") {
+        for (auto i = 1; i < exp.list.size(); i++) {
+          gen(exp.list[i]);
+        }
+        emitIndexed(OpCode::MAKE_ARRAY, exp.list.size() - 1);
+      } else if (op == "index") {
+        gen(exp.list[1]);
+        gen(exp.list[2]);
+        emit(static_cast<uint8_t>(OpCode::GET_INDEX));
+      } else if (op == "len") {
+        gen(exp.list[1]);
+        emit(static_cast<uint8_t>(OpCode::LENGTH));
+
+      } else if (op == "object") {
+        for (auto i = 1; i < exp.list.size(); i++) {
+          gen(exp.list[i].list[1]);
+        }
+        emitIndexed(OpCode::MAKE_OBJECT, shapeIdx(exp));
+      } else if (op == "prop") {
+        gen(exp.list[1]);
+        emitIndexed(OpCode::GET_PROP, propertyCacheIdx(exp.list[2]));
+      } else if (op == "set-prop") {
+        gen(exp.list[1]);
+        gen(exp.list[3]);
+        emitIndexed(OpCode::SET_PROP, propertyCacheIdx(exp.list[2]));
+
+      } else if (op == "resume") {
+        gen(exp.list[1]);
+        genPassedValue(exp, 2);
+        emit(static_cast<uint8_t>(OpCode::RESUME));
+      } else if (op == "yield") {
+        genPassedValue(exp, 1);
+        emit(static_cast<uint8_t>(OpCode::YIELD));
+
       } else {
-        functionCall(exp);
+        functionCall(exp, isTail);
       }
     } else {
-      functionCall(exp);
+      functionCall(exp, isTail);
     }
   }
 }
@@ -334,6 +622,8 @@ void EvaCompiler::compileFunction(const Exp &exp, const std::string fnName,
 
   auto arity = params.list.size();
   auto prevCo = co;
+  auto prevLongJumpTargets = std::move(longJumpTargets_);
+  longJumpTargets_.clear();
   auto coValue = createCodeObjectValue(fnName, arity);
   co = asCode(coValue);
 
@@ -356,22 +646,22 @@ void EvaCompiler::compileFunction(const Exp &exp, const std::string fnName,
 
     auto cellIndex = co->getCellIndex(argName);
     if (cellIndex != -1) {
-      emit(static_cast<uint8_t>(OpCode::SET_CELL));
-      emit(cellIndex);
+      emitIndexed(OpCode::GET_LOCAL, co->getLocalIndex(argName));
+      emitIndexed(OpCode::SET_CELL, cellIndex);
       emit(static_cast<uint8_t>(OpCode::POP));
-    } else {
-      co->nonCellFnParams++;
     }
   }
 
+  tailPosition_ = true;
   gen(body);
 
   if (!isBlock(body)) {
-    emit(static_cast<uint8_t>(OpCode::SCOPE_EXIT));
-    emit(1 /*function itself*/ + co->nonCellFnParams);
+    emitIndexed(OpCode::SCOPE_EXIT, 1 /*function itself*/ + co->arity);
   }
 
   emit(static_cast<uint8_t>(OpCode::RETURN));
+  relaxJumps();
+  longJumpTargets_ = std::move(prevLongJumpTargets);
 
   if (scopeInfo->free.size() == 0) {
     auto fn = allocFunction(co);
@@ -381,21 +671,16 @@ void EvaCompiler::compileFunction(const Exp &exp, const std::string fnName,
 
     co->addConst(fn);
 
-    emit(static_cast<uint8_t>(OpCode::CONST));
-    emit(co->constants.size() - 1);
+    emitIndexed(OpCode::CONST, co->constants.size() - 1);
   } else {
     co = prevCo;
 
     for (const auto &freeVar : scopeInfo->free) {
-      emit(static_cast<uint8_t>(OpCode::LOAD_CELL));
-      emit(prevCo->getCellIndex(freeVar));
+      emitIndexed(OpCode::LOAD_CELL, prevCo->getCellIndex(freeVar));
     }
 
-    emit(static_cast<uint8_t>(OpCode::CONST));
-    emit(co->constants.size() - 1);
-
-    emit(static_cast<uint8_t>(OpCode::MAKE_FUNCTION));
-    emit(scopeInfo->free.size());
+    emitIndexed(OpCode::CONST, co->constants.size() - 1);
+    emitIndexed(OpCode::MAKE_FUNCTION, scopeInfo->free.size());
   }
 
   scopeStack_.pop();
@@ -404,14 +689,12 @@ void EvaCompiler::compileFunction(const Exp &exp, const std::string fnName,
 void EvaCompiler::blockEnter() { co->scopeLevel++; }
 void EvaCompiler::blockExit() {
   auto varsCount = getVarsCountOnScopeExit();
-  if (varsCount > 0 || co->arity > 0) {
-    emit(static_cast<uint8_t>(OpCode::SCOPE_EXIT));
-
+  if (varsCount > 0 || isFunctionBody()) {
     if (isFunctionBody()) {
-      varsCount += 1 /*Function itself*/ + co->nonCellFnParams;
+      varsCount += 1 /*Function itself*/ + co->arity;
     }
 
-    emit(varsCount);
+    emitIndexed(OpCode::SCOPE_EXIT, varsCount);
   }
   co->scopeLevel--;
 }
@@ -424,8 +707,18 @@ bool EvaCompiler::isFunctionBody() {
   return co->name != "main" && co->scopeLevel == 1;
 }
 
-bool EvaCompiler::isWhileLoop(const Exp &exp) {
-  return isTaggedList(exp, "while");
+bool EvaCompiler::isCountedLoop(const Exp &exp) {
+  return exp.list[1].list.size() > 2;
+}
+
+std::array<std::string, 3> EvaCompiler::forSlotNames(const Exp &exp,
+                                                     bool isCell) {
+  // Parenthesized names can't clash with any symbol
+  auto varName = isCell ? "(for variable)" : exp.list[1].list[0].string;
+  if (isCountedLoop(exp)) {
+    return {varName, "(for limit)", "(for step)"};
+  }
+  return {varName, "(for array)", "(for position)"};
 }
 
 bool EvaCompiler::isBlock(const Exp &exp) { return isTaggedList(exp, "begin"); }
@@ -442,6 +735,18 @@ bool EvaCompiler::isFunctionDeclaration(const Exp &exp) {
   return isTaggedList(exp, "def");
 }
 
+bool EvaCompiler::isLiteral(const Exp &exp) {
+  return exp.type == ExpType::NUMBER || exp.type == ExpType::STRING ||
+         (exp.type == ExpType::SYMBOL &&
+          (exp.string == "true" || exp.string == "false"));
+}
+
+bool EvaCompiler::isLocalVar(const Exp &exp) {
+  return exp.type == ExpType::SYMBOL && !isLiteral(exp) &&
+         scopeStack_.top()->getNameGetter(exp.string) ==
+             static_cast<int>(OpCode::GET_LOCAL);
+}
+
 bool EvaCompiler::isTaggedList(const Exp &exp, const std::string &tag) {
   return exp.type == ExpType::LIST && exp.list[0].type == ExpType::SYMBOL &&
          exp.list[0].string == tag;
@@ -450,11 +755,10 @@ bool EvaCompiler::isTaggedList(const Exp &exp, const std::string &tag) {
 size_t EvaCompiler::getVarsCountOnScopeExit() {
   auto varsCount = 0;
 
-  if (co->locals.size() > 0) {
-    while (co->locals.back().scopeLevel == co->scopeLevel) {
-      co->locals.pop_back();
-      varsCount++;
-    }
+  while (!co->locals.empty() &&
+         co->locals.back().scopeLevel == co->scopeLevel) {
+    co->locals.pop_back();
+    varsCount++;
   }
 
   return varsCount;
@@ -462,35 +766,160 @@ size_t EvaCompiler::getVarsCountOnScopeExit() {
 
 size_t EvaCompiler::getOffset() { return co->code.size(); }
 
-size_t EvaCompiler::numericConstIdx(double value) {
-  return allocConst(isNumber, asNumber, makeNumber, value);
+size_t EvaCompiler::numericConstIdx(int32_t value) {
+  return allocConst(co->integerConstants, makeInteger, value);
 }
 
 size_t EvaCompiler::stringConstIdx(const std::string &value) {
-  auto res = allocConst(isString, asCppString, allocString, value);
-  constantObjects_.insert((Traceable *)co->constants.back().object);
-  return res;
+  // Interned, so all code objects share one object per string, which
+  // keys the pool
+  auto string = allocString(value);
+  auto [it, inserted] =
+      co->stringConstants.emplace(asObject(string), co->constants.size());
+  if (inserted) {
+    co->addConst(string);
+  }
+  constantObjects_.insert((Traceable *)asObject(string));
+  return it->second;
 }
 
 size_t EvaCompiler::booleanConstIdx(bool value) {
-  return allocConst(isBoolean, asBoolean, makeBoolean, value);
+  return allocConst(co->booleanConstants, makeBoolean, value);
 }
 
 void EvaCompiler::emit(uint8_t code) { co->code.push_back(code); }
 
+void EvaCompiler::emitIndexed(OpCode opcode, size_t index) {
+  if (index > WIDE_INDEX_LIMIT) {
+    DIE << "[EvaCompiler]: Index " << index << " of "
+        << opcodeToString(static_cast<uint8_t>(opcode))
+        << " exceeds the WIDE form.";
+  }
+
+  if (index > NARROW_INDEX_LIMIT) {
+    emit(static_cast<uint8_t>(OpCode::WIDE));
+    emit(static_cast<uint8_t>(opcode));
+    emit((index >> 8) & 0xff);
+    emit(index & 0xff);
+  } else {
+    emit(static_cast<uint8_t>(opcode));
+    emit(index);
+  }
+}
+
 void EvaCompiler::writeByteAtOffset(size_t offset, uint8_t value) {
   co->code[offset] = value;
 }
 
-void EvaCompiler::patchJumpAddress(size_t offset, uint16_t value) {
+void EvaCompiler::patchJumpAddress(size_t offset, size_t value) {
+  if (value > NARROW_JUMP_LIMIT) {
+    longJumpTargets_[offset] = value;
+  } else {
+    longJumpTargets_.erase(offset);
+  }
   writeByteAtOffset(offset, (value >> 8) & 0xff);
   writeByteAtOffset(offset + 1, value & 0xff);
 }
 
+void EvaCompiler::relaxJumps() {
+  if (longJumpTargets_.empty()) {
+    return;
+  }
+
+  auto &code = co->code;
+
+  // Instruction boundaries, and for each narrow jump its target
+  std::vector<size_t> offsets;
+  std::vector<size_t> sizes;
+  std::map<size_t, size_t> targets;
+
+  for (size_t offset = 0; offset < code.size();) {
+    auto size = instructionSize(&code[offset]);
+    if (isJumpOpcode(code[offset])) {
+      auto it = longJumpTargets_.find(offset + size - 2);
+      targets[offsets.size()] = it != longJumpTargets_.end()
+                                    ? it->second
+                                    : jumpTarget(&code[0], offset);
+    }
+    offsets.push_back(offset);
+    sizes.push_back(size);
+    offset += size;
+  }
+  offsets.push_back(code.size());
+
+  std::map<size_t, size_t> indexAt;
+  for (size_t i = 0; i < offsets.size(); i++) {
+    indexAt[offsets[i]] = i;
+  }
+
+  // Widening a jump doubles its size and moves every target after it,
+  // which may push more targets past 64K: iterate to a fixed point
+  std::vector<bool> wide(sizes.size());
+  std::vector<size_t> newOffsets(offsets.size());
+  for (auto changed = true; changed;) {
+    changed = false;
+
+    for (size_t i = 0, offset = 0; i < offsets.size(); i++) {
+      newOffsets[i] = offset;
+      offset += i < sizes.size() ? sizes[i] : 0;
+    }
+
+    for (auto &[i, target] : targets) {
+      auto newTarget = newOffsets[indexAt.at(target)];
+      if (!wide[i] && newTarget > NARROW_JUMP_LIMIT) {
+        wide[i] = true;
+        sizes[i] *= 2;
+        changed = true;
+      }
+    }
+  }
+
+  std::vector<uint8_t> relaxed;
+  relaxed.reserve(newOffsets.back());
+
+  for (size_t i = 0; i + 1 < offsets.size(); i++) {
+    auto instruction = &code[offsets[i]];
+    auto it = targets.find(i);
+
+    if (it == targets.end()) {
+      relaxed.insert(relaxed.end(), instruction, instruction + sizes[i]);
+      continue;
+    }
+
+    auto target = newOffsets[indexAt.at(it->second)];
+    if (!wide[i]) {
+      relaxed.insert(relaxed.end(), instruction, instruction + sizes[i] - 2);
+      relaxed.insert(relaxed.end(), {(uint8_t)(target >> 8), (uint8_t)target});
+    } else {
+      // Loop opcodes widen their slot operand along with the target
+      relaxed.insert(relaxed.end(),
+                     {static_cast<uint8_t>(OpCode::WIDE), instruction[0]});
+      if (isForLoopOpcode(instruction[0])) {
+        relaxed.insert(relaxed.end(), {0, instruction[1]});
+      }
+      auto end = newOffsets[i] + sizes[i];
+      auto relative = (uint32_t)((int64_t)target - (int64_t)end);
+      relaxed.insert(relaxed.end(),
+                     {(uint8_t)(relative >> 24), (uint8_t)(relative >> 16),
+                      (uint8_t)(relative >> 8), (uint8_t)relative});
+    }
+  }
+
+  code = std::move(relaxed);
+  longJumpTargets_.clear();
+}
+
 std::map<std::string, uint8_t> EvaCompiler::compareOps_ = {
     {"<", 0}, {">", 1}, {"==", 2}, {">=", 3}, {"<=", 4}, {"!=", 5},
 };
 
+std::map<std::string, OpCode> EvaCompiler::compareJumpOps_ = {
+    {"<", OpCode::JGE},  {">", OpCode::JLE},  {"==", OpCode::JNE},
+    {">=", OpCode::JLT}, {"<=", OpCode::JGT}, {"!=", OpCode::JEQ},
+};
+
 std::set<std::string> EvaCompiler::keywords = {
     "var", "set", "def", "begin", "while", "if", "lambda", "print", "+",
-    "-",   "*",   "/",   "<",     ">",     "==", ">=",     "<=",    "!="};
+    "-",   "*",   "/",   "<",     ">",     "==", ">=",     "<=",    "!=",
+    "array", "index", "len", "object", "prop", "set-prop", "for",
+    "resume", "yield"};
@@ -1,34 +1,39 @@
 #ifndef __EvaCompiler_h
 #define __EvaCompiler_h
 
+#include "../bytecode/OpCode.h"
 #include "../disassembler/EvaDisassembler.h"
 #include "../parser/Expression.h"
 #include "../vm/EvaValue.h"
 #include "../vm/Global.h"
 #include "Scope.h"
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <set>
 #include <stack>
+#include <unordered_map>
 #include <vector>
 
 class EvaCompiler {
 public:
   EvaCompiler(std::shared_ptr<Global> global);
 
-  void compile(const Exp &exp);
+  virtual ~EvaCompiler() = default;
+
+  virtual void compile(const Exp &exp);
 
   void analyze(const Exp &exp, std::shared_ptr<Scope> scope);
 
   void gen(const Exp &exp);
 
-  void disassembleBytecode();
+  virtual void disassembleBytecode();
 
   FunctionObject *getMainFunction();
 
   std::set<Traceable *> &getConstantObjects();
 
-private:
+protected:
   std::shared_ptr<Global> global;
   std::unique_ptr<EvaDisassembler> disassembler;
 
@@ -44,7 +49,17 @@ private:
 
   bool isFunctionBody();
 
-  bool isWhileLoop(const Exp &exp);
+  /**
+   * (for (name start end [step]) body) rather than (for (name array) body).
+   */
+  bool isCountedLoop(const Exp &exp);
+
+  /**
+   * Locals of the three loop slots of `exp`: the counter, limit and step,
+   * or the element, array and position. Only the first one is named after
+   * the loop variable, and not even that one when the variable is a cell.
+   */
+  std::array<std::string, 3> forSlotNames(const Exp &exp, bool isCell);
 
   bool isBlock(const Exp &exp);
 
@@ -54,23 +69,55 @@ private:
 
   bool isFunctionDeclaration(const Exp &exp);
 
+  bool isLiteral(const Exp &exp);
+
+  bool isLocalVar(const Exp &exp);
+
   bool isTaggedList(const Exp &exp, const std::string &tag);
 
   size_t getVarsCountOnScopeExit();
 
   size_t getOffset();
 
-  size_t numericConstIdx(double value);
+  size_t numericConstIdx(int32_t value);
 
   size_t stringConstIdx(const std::string &value);
 
   size_t booleanConstIdx(bool value);
 
+  size_t callSiteCacheIdx(const Exp &callee);
+
+  /**
+   * Shape of the object literal `exp`, (object (name value) ...).
+   */
+  size_t shapeIdx(const Exp &exp);
+
+  size_t propertyCacheIdx(const Exp &name);
+
+  StringObject *propertyName(const Exp &name);
+
   void emit(uint8_t code);
 
+  /**
+   * Emits `opcode` with its index operand, behind a WIDE prefix when the
+   * index doesn't fit in a byte.
+   */
+  void emitIndexed(OpCode opcode, size_t index);
+
   void writeByteAtOffset(size_t offset, uint8_t value);
 
-  void patchJumpAddress(size_t offset, uint16_t value);
+  void patchJumpAddress(size_t offset, size_t value);
+
+  /**
+   * Branch relaxation: once a code object is complete, rewrites the jumps
+   * whose target lies past 64K as WIDE relative jumps, shifting the code
+   * after them. Nothing to do for the common, small code object.
+   */
+  void relaxJumps();
+
+  // Targets of the current code object's jumps that don't fit in 16 bits,
+  // by placeholder offset
+  std::map<size_t, size_t> longJumpTargets_;
 
   std::map<const Exp *, std::shared_ptr<Scope>> scopeInfo_;
 
@@ -86,25 +133,37 @@ private:
 
   static std::map<std::string, uint8_t> compareOps_;
 
+  static std::map<std::string, OpCode> compareJumpOps_;
+
   static std::set<std::string> keywords;
 
   void genBinaryOp(const Exp &exp, uint8_t op);
-  void functionCall(const Exp &exp);
+  void genBinaryOp(const Exp &exp, uint8_t op, uint8_t localConstOp);
+  size_t genJumpIfFalse(const Exp &test);
+  void genForLoop(const Exp &exp);
+
+  /**
+   * Pushes the value passed by resume / yield, false when omitted.
+   */
+  void genPassedValue(const Exp &exp, size_t index);
+  void functionCall(const Exp &exp, bool isTailCall = false);
+
+  /**
+   * Whether the expression being generated is the value of the function
+   * body, i.e. only SCOPE_EXIT and RETURN follow it. Cleared on entry to
+   * gen, so it applies to the expression itself but not its operands.
+   */
+  bool tailPosition_ = false;
 
   template <typename T>
-  size_t allocConst(bool (*tester)(const EvaValue &),
-                    T (*converter)(const EvaValue &), EvaValue (*allocator)(T),
-                    const T &value) {
-    for (auto i = 0; i < co->constants.size(); i++) {
-      if (!tester(co->constants[i])) {
-        continue;
-      }
-      if (converter(co->constants[i]) == value) {
-        return i;
-      }
+  size_t allocConst(std::unordered_map<T, size_t> &pool,
+                    EvaValue (*allocator)(T), const T &value) {
+    auto it = pool.find(value);
+    if (it != pool.end()) {
+      return it->second;
     }
     co->addConst(allocator(value));
-    return co->constants.size() - 1;
+    return pool[value] = co->constants.size() - 1;
   }
 };
 
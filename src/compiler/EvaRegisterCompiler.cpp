@@ -0,0 +1,759 @@
+#include "EvaRegisterCompiler.h"
+#include "../Logger.h"
+#include "../bytecode/OpCode.h"
+#include "../bytecode/RegisterOpCode.h"
+#include "../disassembler/EvaRegisterDisassembler.h"
+#include "../vm/EvaValue.h"
+#include "../vm/Global.h"
+#include "Scope.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+EvaRegisterCompiler::EvaRegisterCompiler(std::shared_ptr<Global> global)
+    : EvaCompiler(global),
+      registerDisassembler(std::make_unique<EvaRegisterDisassembler>(global)) {
+}
+
+void EvaRegisterCompiler::compile(const Exp &exp) {
+  co = asCode(createCodeObjectValue("main"));
+  constantObjects_.insert((Traceable *)co);
+  main = asFunction(allocFunction(co));
+  constantObjects_.insert((Traceable *)main);
+
+  analyze(exp, nullptr);
+
+  auto reg = allocRegister();
+  genInto(exp, reg);
+  emitOp(RegisterOpCode::HALT);
+  emit(reg);
+
+  co->frameSize = maxRegisters_;
+
+  // Register operands have no WIDE forms: indices are single bytes and
+  // jump targets 16-bit, so larger programs need the stack tier
+  if (!longJumpTargets_.empty()) {
+    DIE << "[EvaRegisterCompiler]: Function too large for 16-bit jumps.";
+  }
+  if (global->globals.size() > NARROW_INDEX_LIMIT + 1) {
+    DIE << "[EvaRegisterCompiler]: Too many globals.";
+  }
+  for (auto co_ : codeObjects_) {
+    if (co_->constants.size() > NARROW_INDEX_LIMIT + 1 ||
+        co_->cellNames.size() > NARROW_INDEX_LIMIT + 1 ||
+        co_->shapes.size() > NARROW_INDEX_LIMIT + 1 ||
+        co_->propertyCaches.size() > NARROW_INDEX_LIMIT + 1) {
+      DIE << "[EvaRegisterCompiler]: Too many constants, cells, shapes or "
+          << "property sites in " << co_->name << ".";
+    }
+  }
+}
+
+void EvaRegisterCompiler::disassembleBytecode() {
+  for (auto &co_ : codeObjects_) {
+    registerDisassembler->disassemble(co_);
+  }
+}
+
+void EvaRegisterCompiler::genInto(const Exp &exp, uint8_t reg) {
+  auto isTail = tailPosition_;
+  tailPosition_ = false;
+
+  switch (exp.type) {
+  case ExpType::NUMBER:
+    emitOp(RegisterOpCode::LOADK);
+    emit(reg);
+    emit(numericConstIdx(exp.number));
+    break;
+
+  case ExpType::STRING:
+    emitOp(RegisterOpCode::LOADK);
+    emit(reg);
+    emit(stringConstIdx(exp.string));
+    break;
+
+  case ExpType::SYMBOL:
+    if (exp.string == "true" || exp.string == "false") {
+      emitOp(RegisterOpCode::LOADK);
+      emit(reg);
+      emit(booleanConstIdx(exp.string == "true"));
+    } else {
+      auto varName = exp.string;
+
+      auto opCodeGetter = scopeStack_.top()->getNameGetter(varName);
+
+      if (opCodeGetter == static_cast<int>(OpCode::GET_LOCAL)) {
+        auto localReg = getLocalRegister(varName);
+        if (localReg != reg) {
+          emitOp(RegisterOpCode::MOVE);
+          emit(reg);
+          emit(localReg);
+        }
+      } else if (opCodeGetter == static_cast<int>(OpCode::GET_CELL)) {
+        emitOp(RegisterOpCode::GET_CELL);
+        emit(reg);
+        emit(co->getCellIndex(varName));
+      } else {
+        if (!global->exists(varName)) {
+          DIE << "[EvaRegisterCompiler]: Reference error:" << varName;
+        }
+        emitOp(RegisterOpCode::GET_GLOBAL);
+        emit(reg);
+        emit(global->getGlobalIndex(varName));
+      }
+    }
+    break;
+
+  case ExpType::LIST:
+    auto tag = exp.list[0];
+
+    if (tag.type != ExpType::SYMBOL) {
+      genCall(exp, reg, isTail);
+      break;
+    }
+
+    auto op = tag.string;
+
+    if (op == "+") {
+      genArithmetic(exp, RegisterOpCode::ADD, reg);
+    } else if (op == "-") {
+      genArithmetic(exp, RegisterOpCode::SUB, reg);
+    } else if (op == "*") {
+      genArithmetic(exp, RegisterOpCode::MUL, reg);
+    } else if (op == "/") {
+      genArithmetic(exp, RegisterOpCode::DIV, reg);
+    } else if (compareOps_.count(op) != 0) {
+      auto savedRegister = freeRegister_;
+      auto op1 = genOperand(exp.list[1], exp.list[2].type != ExpType::LIST);
+      auto op2 = genOperand(exp.list[2], true);
+      emitOp(RegisterOpCode::COMPARE);
+      emit(reg);
+      emit(op1);
+      emit(op2);
+      emit(compareOps_[op]);
+      freeRegisters(savedRegister);
+    } else if (op == "if") {
+      auto elseJmpPlaceholderAddr = genTestJump(exp.list[1]);
+      tailPosition_ = isTail;
+      genInto(exp.list[2], reg);
+      emitOp(RegisterOpCode::JMP);
+      emitJumpPlaceholder();
+      auto jmpPlaceholderAddr = getOffset() - 2;
+
+      patchJumpAddress(elseJmpPlaceholderAddr, getOffset());
+
+      if (exp.list.size() == 4) {
+        tailPosition_ = isTail;
+        genInto(exp.list[3], reg);
+      }
+
+      patchJumpAddress(jmpPlaceholderAddr, getOffset());
+    } else if (op == "while") {
+      auto loopStartAddr = getOffset();
+      auto loopEndJmpPlaceholderAddr = genTestJump(exp.list[1]);
+
+      auto bodyReg = allocRegister();
+      genInto(exp.list[2], bodyReg);
+      freeRegisters(bodyReg);
+
+      emitOp(RegisterOpCode::JMP);
+      emitJumpPlaceholder();
+      patchJumpAddress(getOffset() - 2, loopStartAddr);
+      patchJumpAddress(loopEndJmpPlaceholderAddr, getOffset());
+
+      emitOp(RegisterOpCode::LOADK);
+      emit(reg);
+      emit(booleanConstIdx(false));
+    } else if (op == "for") {
+      genForLoop(exp, reg);
+    } else if (op == "var" || op == "def") {
+      genDeclaration(exp);
+      genInto(exp.list[1], reg);
+    } else if (op == "set") {
+      genAssignment(exp, reg);
+    } else if (op == "begin") {
+      tailPosition_ = isTail;
+      genBlock(exp, reg);
+    } else if (op == "lambda") {
+      genFunction(exp, "lambda", exp.list[1], exp.list[2], reg);
+    } else if (op == "array") {
+      genArray(exp, reg);
+    } else if (op == "index") {
+      auto savedRegister = freeRegister_;
+      auto array = genOperand(exp.list[1], exp.list[2].type != ExpType::LIST);
+      auto index = genOperand(exp.list[2], true);
+      emitOp(RegisterOpCode::GET_INDEX);
+      emit(reg);
+      emit(array);
+      emit(index);
+      freeRegisters(savedRegister);
+    } else if (op == "len") {
+      auto savedRegister = freeRegister_;
+      auto value = genOperand(exp.list[1], true);
+      emitOp(RegisterOpCode::LENGTH);
+      emit(reg);
+      emit(value);
+      freeRegisters(savedRegister);
+    } else if (op == "object") {
+      genObject(exp, reg);
+    } else if (op == "prop") {
+      auto savedRegister = freeRegister_;
+      auto record = genOperand(exp.list[1], true);
+      emitOp(RegisterOpCode::GET_PROP);
+      emit(reg);
+      emit(record);
+      emit(propertyCacheIdx(exp.list[2]));
+      freeRegisters(savedRegister);
+    } else if (op == "set-prop") {
+      genPropAssignment(exp, reg);
+    } else if (op == "resume") {
+      auto savedRegister = freeRegister_;
+      auto co = genOperand(exp.list[1], exp.list.size() < 3 ||
+                                            exp.list[2].type != ExpType::LIST);
+      auto value = genPassedOperand(exp, 2);
+      emitOp(RegisterOpCode::RESUME);
+      emit(reg);
+      emit(co);
+      emit(value);
+      freeRegisters(savedRegister);
+    } else if (op == "yield") {
+      auto savedRegister = freeRegister_;
+      auto value = genPassedOperand(exp, 1);
+      emitOp(RegisterOpCode::YIELD);
+      emit(reg);
+      emit(value);
+      freeRegisters(savedRegister);
+    } else {
+      genCall(exp, reg, isTail);
+    }
+  }
+}
+
+uint8_t EvaRegisterCompiler::genOperand(const Exp &exp, bool allowLocal) {
+  // Literals are addressed directly from the constant pool when their
+  // index fits into an RK operand, locals directly from their slot
+  if (isLiteral(exp)) {
+    size_t constIndex;
+    if (exp.type == ExpType::NUMBER) {
+      constIndex = numericConstIdx(exp.number);
+    } else if (exp.type == ExpType::STRING) {
+      constIndex = stringConstIdx(exp.string);
+    } else {
+      constIndex = booleanConstIdx(exp.string == "true");
+    }
+
+    if (constIndex < REGISTER_CONST_BIT) {
+      return constIndex | REGISTER_CONST_BIT;
+    }
+  } else if (allowLocal && isLocalVar(exp)) {
+    return getLocalRegister(exp.string);
+  }
+
+  auto reg = allocRegister();
+  genInto(exp, reg);
+  return reg;
+}
+
+uint8_t EvaRegisterCompiler::genPassedOperand(const Exp &exp, size_t index) {
+  if (index < exp.list.size()) {
+    return genOperand(exp.list[index], true);
+  }
+
+  auto constIndex = booleanConstIdx(false);
+  if (constIndex < REGISTER_CONST_BIT) {
+    return constIndex | REGISTER_CONST_BIT;
+  }
+  auto reg = allocRegister();
+  emitOp(RegisterOpCode::LOADK);
+  emit(reg);
+  emit(constIndex);
+  return reg;
+}
+
+void EvaRegisterCompiler::genArithmetic(const Exp &exp, RegisterOpCode op,
+                                        uint8_t reg) {
+  auto savedRegister = freeRegister_;
+  // The first operand may only alias a local slot if evaluating the second
+  // one cannot reassign it
+  auto op1 = genOperand(exp.list[1], exp.list[2].type != ExpType::LIST);
+  auto op2 = genOperand(exp.list[2], true);
+  emitOp(op);
+  emit(reg);
+  emit(op1);
+  emit(op2);
+  freeRegisters(savedRegister);
+}
+
+size_t EvaRegisterCompiler::genTestJump(const Exp &test) {
+  auto savedRegister = freeRegister_;
+
+  if (test.type == ExpType::LIST && test.list.size() == 3 &&
+      test.list[0].type == ExpType::SYMBOL &&
+      compareJumpOps_.count(test.list[0].string) != 0) {
+    auto op1 = genOperand(test.list[1], test.list[2].type != ExpType::LIST);
+    auto op2 = genOperand(test.list[2], true);
+    emitOp(compareJumpOps_[test.list[0].string]);
+    emit(op1);
+    emit(op2);
+  } else {
+    auto reg = genOperand(test, true);
+    emitOp(RegisterOpCode::JMP_IF_FALSE);
+    emit(reg);
+  }
+
+  freeRegisters(savedRegister);
+  emitJumpPlaceholder();
+  return getOffset() - 2;
+}
+
+void EvaRegisterCompiler::genBlock(const Exp &exp, uint8_t reg) {
+  auto isTail = tailPosition_;
+  tailPosition_ = false;
+
+  scopeStack_.push(scopeInfo_.at(&exp));
+  co->scopeLevel++;
+
+  auto savedRegister = freeRegister_;
+  auto savedFloor = registerFloor_;
+
+  for (auto i = 1; i < exp.list.size(); i++) {
+    bool isLast = i == exp.list.size() - 1;
+    auto &stmt = exp.list[i];
+
+    if (!isLast && isLiteral(stmt)) {
+      continue;
+    }
+
+    if (isVarDeclaration(stmt) || isFunctionDeclaration(stmt)) {
+      genDeclaration(stmt);
+      if (isLast) {
+        genInto(stmt.list[1], reg);
+      }
+    } else if (isLast) {
+      tailPosition_ = isTail;
+      genInto(stmt, reg);
+    } else {
+      auto stmtReg = allocRegister();
+      genInto(stmt, stmtReg);
+      freeRegisters(stmtReg);
+    }
+  }
+
+  while (!co->locals.empty() &&
+         co->locals.back().scopeLevel == co->scopeLevel) {
+    co->locals.pop_back();
+    localRegisters_.pop_back();
+  }
+
+  registerFloor_ = savedFloor;
+  freeRegister_ = savedRegister;
+
+  co->scopeLevel--;
+  scopeStack_.pop();
+}
+
+void EvaRegisterCompiler::genForLoop(const Exp &exp, uint8_t reg) {
+  auto &header = exp.list[1];
+  auto isCounted = isCountedLoop(exp);
+
+  auto savedRegister = freeRegister_;
+  auto savedFloor = registerFloor_;
+
+  auto base = allocRegister();
+  allocRegister();
+  allocRegister();
+
+  if (isCounted) {
+    genInto(header.list[1], base);
+    genInto(header.list[2], base + 1);
+    if (header.list.size() == 4) {
+      genInto(header.list[3], base + 2);
+    } else {
+      emitOp(RegisterOpCode::LOADK);
+      emit(base + 2);
+      emit(numericConstIdx(1));
+    }
+  } else {
+    genInto(header.list[1], base + 1);
+  }
+
+  scopeStack_.push(scopeInfo_.at(&exp));
+  co->scopeLevel++;
+
+  auto varName = header.list[0].string;
+  auto isCell = scopeStack_.top()->getNameSetter(varName) ==
+                static_cast<int>(OpCode::SET_CELL);
+
+  auto names = forSlotNames(exp, isCell);
+  for (auto i = 0; i < names.size(); i++) {
+    declareLocal(names[i], base + i);
+  }
+
+  emitOp(isCounted ? RegisterOpCode::FOR_PREP : RegisterOpCode::FOR_EACH_PREP);
+  emit(base);
+  emitJumpPlaceholder();
+  auto loopEndJmpPlaceholderAddr = getOffset() - 2;
+
+  auto loopBodyAddr = getOffset();
+  if (isCell) {
+    co->cellNames.push_back(varName);
+    emitOp(RegisterOpCode::SET_CELL);
+    emit(base);
+    emit(co->cellNames.size() - 1);
+  }
+
+  auto bodyReg = allocRegister();
+  genInto(exp.list[2], bodyReg);
+  freeRegisters(bodyReg);
+
+  emitOp(isCounted ? RegisterOpCode::FOR_LOOP : RegisterOpCode::FOR_EACH_LOOP);
+  emit(base);
+  emitJumpPlaceholder();
+  patchJumpAddress(getOffset() - 2, loopBodyAddr);
+  patchJumpAddress(loopEndJmpPlaceholderAddr, getOffset());
+
+  while (!co->locals.empty() &&
+         co->locals.back().scopeLevel == co->scopeLevel) {
+    co->locals.pop_back();
+    localRegisters_.pop_back();
+  }
+
+  registerFloor_ = savedFloor;
+  freeRegister_ = savedRegister;
+
+  co->scopeLevel--;
+  scopeStack_.pop();
+
+  emitOp(RegisterOpCode::LOADK);
+  emit(reg);
+  emit(booleanConstIdx(false));
+}
+
+void EvaRegisterCompiler::genDeclaration(const Exp &exp) {
+  auto name = exp.list[1].string;
+  auto isDef = isFunctionDeclaration(exp);
+  auto &value = isDef ? exp : exp.list[2];
+
+  auto opCodeSetter = scopeStack_.top()->getNameSetter(name);
+
+  if (opCodeSetter == static_cast<int>(OpCode::SET_GLOBAL)) {
+    global->define(name);
+    auto reg = allocRegister();
+    genValue(value, name, reg);
+    emitOp(RegisterOpCode::SET_GLOBAL);
+    emit(reg);
+    emit(global->getGlobalIndex(name));
+    freeRegisters(reg);
+  } else if (opCodeSetter == static_cast<int>(OpCode::SET_CELL)) {
+    auto cellIndex = co->getCellIndex(name);
+    if (cellIndex == -1) {
+      co->cellNames.push_back(name);
+      cellIndex = co->cellNames.size() - 1;
+    }
+    auto reg = allocRegister();
+    genValue(value, name, reg);
+    emitOp(RegisterOpCode::SET_CELL);
+    emit(reg);
+    emit(cellIndex);
+    freeRegisters(reg);
+  } else {
+    auto reg = allocRegister();
+    genValue(value, name, reg);
+    declareLocal(name, reg);
+  }
+}
+
+void EvaRegisterCompiler::genValue(const Exp &exp, const std::string &name,
+                                   uint8_t reg) {
+  if (isFunctionDeclaration(exp)) {
+    genFunction(exp, name, exp.list[2], exp.list[3], reg);
+  } else if (isLambda(exp)) {
+    genFunction(exp, name, exp.list[1], exp.list[2], reg);
+  } else {
+    genInto(exp, reg);
+  }
+}
+
+void EvaRegisterCompiler::genArray(const Exp &exp, uint8_t reg) {
+  auto count = exp.list.size() - 1;
+  if (count > NARROW_INDEX_LIMIT) {
+    DIE << "[EvaRegisterCompiler]: Too many elements in an array literal.";
+  }
+
+  // The elements go to consecutive temporaries
+  auto base = freeRegister_;
+  for (auto i = 1; i < exp.list.size(); i++) {
+    genInto(exp.list[i], allocRegister());
+  }
+
+  emitOp(RegisterOpCode::MAKE_ARRAY);
+  emit(reg);
+  emit(base);
+  emit(count);
+  freeRegisters(base);
+}
+
+void EvaRegisterCompiler::genObject(const Exp &exp, uint8_t reg) {
+  // The property values go to consecutive temporaries, in slot order
+  auto base = freeRegister_;
+  for (auto i = 1; i < exp.list.size(); i++) {
+    genInto(exp.list[i].list[1], allocRegister());
+  }
+
+  emitOp(RegisterOpCode::MAKE_OBJECT);
+  emit(reg);
+  emit(shapeIdx(exp));
+  emit(base);
+  freeRegisters(base);
+}
+
+void EvaRegisterCompiler::genPropAssignment(const Exp &exp, uint8_t reg) {
+  auto &value = exp.list[3];
+
+  auto savedRegister = freeRegister_;
+  auto record = genOperand(exp.list[1], value.type != ExpType::LIST);
+
+  auto valueReg = record == reg ? allocRegister() : reg;
+  genInto(value, valueReg);
+  emitOp(RegisterOpCode::SET_PROP);
+  emit(record);
+  emit(propertyCacheIdx(exp.list[2]));
+  emit(valueReg);
+
+  if (valueReg != reg) {
+    emitOp(RegisterOpCode::MOVE);
+    emit(reg);
+    emit(valueReg);
+  }
+  freeRegisters(savedRegister);
+}
+
+void EvaRegisterCompiler::genIndexAssignment(const Exp &exp, uint8_t reg) {
+  auto &target = exp.list[1];
+  auto &value = exp.list[2];
+
+  // Operands may only alias local slots that the later ones cannot
+  // reassign
+  auto savedRegister = freeRegister_;
+  auto array = genOperand(target.list[1], target.list[2].type !=
+                                              ExpType::LIST &&
+                                              value.type != ExpType::LIST);
+  auto index = genOperand(target.list[2], value.type != ExpType::LIST);
+
+  // The destination may be the local slot an operand was just read from
+  auto valueReg = array == reg || index == reg ? allocRegister() : reg;
+  genInto(value, valueReg);
+  emitOp(RegisterOpCode::SET_INDEX);
+  emit(array);
+  emit(index);
+  emit(valueReg);
+
+  if (valueReg != reg) {
+    emitOp(RegisterOpCode::MOVE);
+    emit(reg);
+    emit(valueReg);
+  }
+  freeRegisters(savedRegister);
+}
+
+void EvaRegisterCompiler::genAssignment(const Exp &exp, uint8_t reg) {
+  if (isTaggedList(exp.list[1], "index")) {
+    genIndexAssignment(exp, reg);
+    return;
+  }
+
+  auto varName = exp.list[1].string;
+
+  auto opCodeSetter = scopeStack_.top()->getNameSetter(varName);
+
+  if (opCodeSetter == static_cast<int>(OpCode::SET_LOCAL)) {
+    auto localReg = getLocalRegister(varName);
+    genInto(exp.list[2], localReg);
+    if (localReg != reg) {
+      emitOp(RegisterOpCode::MOVE);
+      emit(reg);
+      emit(localReg);
+    }
+  } else if (opCodeSetter == static_cast<int>(OpCode::SET_CELL)) {
+    genInto(exp.list[2], reg);
+    emitOp(RegisterOpCode::SET_CELL);
+    emit(reg);
+    emit(co->getCellIndex(varName));
+  } else {
+    auto globalIndex = global->getGlobalIndex(varName);
+    if (globalIndex == -1) {
+      DIE << "Reference error: " << varName << " is not defined.";
+    }
+    genInto(exp.list[2], reg);
+    emitOp(RegisterOpCode::SET_GLOBAL);
+    emit(reg);
+    emit(globalIndex);
+  }
+}
+
+void EvaRegisterCompiler::genCall(const Exp &exp, uint8_t reg,
+                                  bool isTailCall) {
+  // The callee and its arguments occupy consecutive slots on top of the
+  // frame, the callee slot becomes the base of the new frame
+  auto argsCount = exp.list.size() - 1;
+  auto base = allocRegister();
+  for (auto i = 0; i < argsCount; i++) {
+    allocRegister();
+  }
+
+  for (auto i = 0; i <= argsCount; i++) {
+    genInto(exp.list[i], base + i);
+  }
+
+  emitOp(isTailCall ? RegisterOpCode::TAIL_CALL : RegisterOpCode::CALL);
+  emit(base);
+  emit(argsCount);
+
+  if (base != reg) {
+    emitOp(RegisterOpCode::MOVE);
+    emit(reg);
+    emit(base);
+  }
+
+  freeRegisters(base);
+}
+
+void EvaRegisterCompiler::genFunction(const Exp &exp,
+                                      const std::string &fnName,
+                                      const Exp &params, const Exp &body,
+                                      uint8_t reg) {
+  auto scopeInfo = scopeInfo_.at(&exp);
+  scopeStack_.push(scopeInfo);
+
+  auto arity = params.list.size();
+  auto prevCo = co;
+  auto coValue = createCodeObjectValue(fnName, arity);
+  co = asCode(coValue);
+
+  co->freeCount = scopeInfo->free.size();
+
+  co->cellNames.reserve(scopeInfo->free.size() + scopeInfo->cells.size());
+
+  co->cellNames.insert(co->cellNames.end(), scopeInfo->free.begin(),
+                       scopeInfo->free.end());
+  co->cellNames.insert(co->cellNames.end(), scopeInfo->cells.begin(),
+                       scopeInfo->cells.end());
+
+  prevCo->addConst(coValue);
+  auto coIndex = prevCo->constants.size() - 1;
+
+  auto prevLocalRegisters = std::move(localRegisters_);
+  auto prevFreeRegister = freeRegister_;
+  auto prevRegisterFloor = registerFloor_;
+  auto prevMaxRegisters = maxRegisters_;
+
+  localRegisters_ = {};
+  freeRegister_ = 0;
+  registerFloor_ = 0;
+  maxRegisters_ = 0;
+
+  declareLocal(fnName, allocRegister());
+
+  for (auto i = 0; i < arity; i++) {
+    auto argName = params.list[i].string;
+    auto argReg = allocRegister();
+    declareLocal(argName, argReg);
+
+    auto cellIndex = co->getCellIndex(argName);
+    if (cellIndex != -1) {
+      emitOp(RegisterOpCode::SET_CELL);
+      emit(argReg);
+      emit(cellIndex);
+    }
+  }
+
+  auto resultReg = allocRegister();
+  tailPosition_ = true;
+  genInto(body, resultReg);
+  emitOp(RegisterOpCode::RETURN);
+  emit(resultReg);
+
+  co->frameSize = maxRegisters_;
+
+  localRegisters_ = std::move(prevLocalRegisters);
+  freeRegister_ = prevFreeRegister;
+  registerFloor_ = prevRegisterFloor;
+  maxRegisters_ = prevMaxRegisters;
+
+  if (scopeInfo->free.size() == 0) {
+    auto fn = allocFunction(co);
+    constantObjects_.insert((Traceable *)asObject(fn));
+
+    co = prevCo;
+
+    co->addConst(fn);
+
+    emitOp(RegisterOpCode::LOADK);
+    emit(reg);
+    emit(co->constants.size() - 1);
+  } else {
+    co = prevCo;
+
+    auto base = freeRegister_;
+    for (const auto &freeVar : scopeInfo->free) {
+      emitOp(RegisterOpCode::LOAD_CELL);
+      emit(allocRegister());
+      emit(prevCo->getCellIndex(freeVar));
+    }
+
+    emitOp(RegisterOpCode::MAKE_FUNCTION);
+    emit(reg);
+    emit(coIndex);
+    emit(base);
+    emit(scopeInfo->free.size());
+
+    freeRegisters(base);
+  }
+
+  scopeStack_.pop();
+}
+
+void EvaRegisterCompiler::emitOp(RegisterOpCode op) {
+  emit(static_cast<uint8_t>(op));
+}
+
+void EvaRegisterCompiler::emitJumpPlaceholder() {
+  emit(0); // The placeholder consists of two consecutive 8-bit cells
+  emit(0); // representing a 16-bit address
+}
+
+uint8_t EvaRegisterCompiler::allocRegister() {
+  if (freeRegister_ == REGISTER_LIMIT) {
+    DIE << "[EvaRegisterCompiler]: too many registers in " << co->name;
+  }
+  auto reg = freeRegister_++;
+  maxRegisters_ = std::max(maxRegisters_, freeRegister_);
+  return reg;
+}
+
+void EvaRegisterCompiler::freeRegisters(uint8_t reg) {
+  // Locals declared inside an expression stay allocated until their block
+  // exits, even if temporaries below them are released
+  freeRegister_ = std::max((size_t)reg, registerFloor_);
+}
+
+void EvaRegisterCompiler::declareLocal(const std::string &name, uint8_t reg) {
+  co->addLocal(name);
+  localRegisters_.push_back(reg);
+  registerFloor_ = std::max(registerFloor_, (size_t)reg + 1);
+}
+
+uint8_t EvaRegisterCompiler::getLocalRegister(const std::string &name) {
+  auto localIndex = co->getLocalIndex(name);
+  if (localIndex == -1) {
+    DIE << "[EvaRegisterCompiler]: Reference error:" << name;
+  }
+  return localRegisters_[localIndex];
+}
+
+std::map<std::string, RegisterOpCode> EvaRegisterCompiler::compareJumpOps_ = {
+    {"<", RegisterOpCode::JGE},  {">", RegisterOpCode::JLE},
+    {"==", RegisterOpCode::JNE}, {">=", RegisterOpCode::JLT},
+    {"<=", RegisterOpCode::JGT}, {"!=", RegisterOpCode::JEQ},
+};
@@ -0,0 +1,100 @@
+#ifndef __EvaRegisterCompiler_h
+#define __EvaRegisterCompiler_h
+
+#include "../bytecode/RegisterOpCode.h"
+#include "../disassembler/EvaRegisterDisassembler.h"
+#include "../parser/Expression.h"
+#include "../vm/EvaValue.h"
+#include "../vm/Global.h"
+#include "EvaCompiler.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Code generator for the register-based instruction set. Reuses the scope
+ * analysis, constant pools and code objects of EvaCompiler, but compiles
+ * every expression into a destination frame slot instead of onto the
+ * value stack.
+ */
+class EvaRegisterCompiler : public EvaCompiler {
+public:
+  EvaRegisterCompiler(std::shared_ptr<Global> global);
+
+  void compile(const Exp &exp) override;
+
+  void disassembleBytecode() override;
+
+private:
+  std::unique_ptr<EvaRegisterDisassembler> registerDisassembler;
+
+  void genInto(const Exp &exp, uint8_t reg);
+
+  uint8_t genOperand(const Exp &exp, bool allowLocal);
+
+  /**
+   * Operand of the value passed by resume / yield, false when omitted.
+   */
+  uint8_t genPassedOperand(const Exp &exp, size_t index);
+
+  void genArithmetic(const Exp &exp, RegisterOpCode op, uint8_t reg);
+
+  size_t genTestJump(const Exp &test);
+
+  void genBlock(const Exp &exp, uint8_t reg);
+
+  /**
+   * The loop slots take three consecutive registers, see
+   * EvaCompiler::genForLoop.
+   */
+  void genForLoop(const Exp &exp, uint8_t reg);
+
+  void genDeclaration(const Exp &exp);
+
+  void genAssignment(const Exp &exp, uint8_t reg);
+
+  /**
+   * (set (index array i) value)
+   */
+  void genIndexAssignment(const Exp &exp, uint8_t reg);
+
+  void genArray(const Exp &exp, uint8_t reg);
+
+  void genObject(const Exp &exp, uint8_t reg);
+
+  /**
+   * (set-prop record name value)
+   */
+  void genPropAssignment(const Exp &exp, uint8_t reg);
+
+  void genCall(const Exp &exp, uint8_t reg, bool isTailCall = false);
+
+  void genFunction(const Exp &exp, const std::string &fnName,
+                   const Exp &params, const Exp &body, uint8_t reg);
+
+  void genValue(const Exp &exp, const std::string &name, uint8_t reg);
+
+  void emitOp(RegisterOpCode op);
+
+  void emitJumpPlaceholder();
+
+  uint8_t allocRegister();
+
+  void freeRegisters(uint8_t reg);
+
+  void declareLocal(const std::string &name, uint8_t reg);
+
+  uint8_t getLocalRegister(const std::string &name);
+
+  std::vector<uint8_t> localRegisters_;
+
+  size_t freeRegister_ = 0;
+
+  size_t registerFloor_ = 0;
+
+  size_t maxRegisters_ = 0;
+
+  static std::map<std::string, RegisterOpCode> compareJumpOps_;
+};
+
+#endif // __EvaRegisterCompiler_h
@@ -74,7 +74,12 @@ std::pair<Scope *, AllocType> Scope::resolve(const std::string &name,
                                              AllocType allocType) {
   if (allocInfo.count(name) != 0 &&
       allocInfo[name] != AllocType::LOCAL_FROM_FN) {
-    return std::make_pair(this, allocType);
+    // A free cell here is owned further out, where it must be captured
+    // from; resolving it here would make it a local of this scope
+    if (std::find(free.begin(), free.end(), name) == free.end()) {
+      return std::make_pair(this, allocType);
+    }
+    return parent->resolve(name, AllocType::CELL);
   }
 
   if (allocInfo[name] == AllocType::LOCAL_FROM_FN) {
@@ -118,6 +123,6 @@ int Scope::getNameSetter(const std::string &name) {
   case AllocType::CELL:
     return static_cast<int>(OpCode::SET_CELL);
   case AllocType::LOCAL_FROM_FN:
-    return static_cast<int>(OpCode::GET_LOCAL);
+    return static_cast<int>(OpCode::SET_LOCAL);
   }
 }
@@ -35,20 +35,53 @@ size_t EvaDisassembler::disassembleInstruction(CodeObject *co, size_t offset) {
   case OpCode::CONST:
     return disassembleConst(co, opcode, offset);
   case OpCode::ADD:
+  case OpCode::ADD_NUM:
+  case OpCode::ADD_STR:
   case OpCode::SUB:
   case OpCode::MUL:
   case OpCode::DIV:
   case OpCode::POP:
   case OpCode::RETURN:
+  case OpCode::GET_INDEX:
+  case OpCode::SET_INDEX:
+  case OpCode::LENGTH:
+  case OpCode::RESUME:
+  case OpCode::YIELD:
     return disassembleSimple(co, opcode, offset);
   case OpCode::SCOPE_EXIT:
-  case OpCode::CALL:
+  case OpCode::MAKE_ARRAY:
     return disassembleWord(co, opcode, offset);
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+    return disassembleCall(co, opcode, offset);
   case OpCode::COMPARE:
+  case OpCode::COMPARE_NUM_LT:
+  case OpCode::COMPARE_NUM_GT:
+  case OpCode::COMPARE_NUM_EQ:
+  case OpCode::COMPARE_NUM_GE:
+  case OpCode::COMPARE_NUM_LE:
+  case OpCode::COMPARE_NUM_NE:
     return disassembleCompare(co, opcode, offset);
   case OpCode::JMP_IF_FALSE:
   case OpCode::JMP:
+  case OpCode::JLT:
+  case OpCode::JGT:
+  case OpCode::JEQ:
+  case OpCode::JGE:
+  case OpCode::JLE:
+  case OpCode::JNE:
+  case OpCode::JLT_NUM:
+  case OpCode::JGT_NUM:
+  case OpCode::JEQ_NUM:
+  case OpCode::JGE_NUM:
+  case OpCode::JLE_NUM:
+  case OpCode::JNE_NUM:
     return disassembleJump(co, opcode, offset);
+  case OpCode::FOR_PREP:
+  case OpCode::FOR_LOOP:
+  case OpCode::FOR_EACH_PREP:
+  case OpCode::FOR_EACH_LOOP:
+    return disassembleForLoop(co, opcode, offset);
   case OpCode::GET_GLOBAL:
   case OpCode::SET_GLOBAL:
     return disassembleGlobal(co, opcode, offset);
@@ -61,6 +94,16 @@ size_t EvaDisassembler::disassembleInstruction(CodeObject *co, size_t offset) {
     return disassembleCell(co, opcode, offset);
   case OpCode::MAKE_FUNCTION:
     return disassembleMakeFunction(co, opcode, offset);
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::SUB_LOCAL_CONST:
+    return disassembleLocalConst(co, opcode, offset);
+  case OpCode::MAKE_OBJECT:
+    return disassembleShape(co, opcode, offset);
+  case OpCode::GET_PROP:
+  case OpCode::SET_PROP:
+    return disassembleProperty(co, opcode, offset);
+  case OpCode::WIDE:
+    return disassembleWide(co, offset);
   default:
     DIE << "disassembleInstruction: no disassembly for "
         << opcodeToString(opcode);
@@ -86,6 +129,19 @@ size_t EvaDisassembler::disassembleWord(CodeObject *co, uint8_t opcode,
   return offset + 2;
 }
 
+size_t EvaDisassembler::disassembleCall(CodeObject *co, uint8_t opcode,
+                                        size_t offset) {
+  dumpBytes(co, offset, 3);
+  printOpCode(opcode);
+  std::cout << (int)co->code[offset + 1];
+  auto siteIndex = co->code[offset + 2];
+  if (siteIndex != NO_CALL_SITE_CACHE) {
+    auto globalIndex = co->callSiteCaches[siteIndex].globalIndex;
+    std::cout << " (cached " << global->get(globalIndex).name << ")";
+  }
+  return offset + 3;
+}
+
 size_t EvaDisassembler::disassembleConst(CodeObject *co, uint8_t opcode,
                                          size_t offset) {
   dumpBytes(co, offset, 2);
@@ -119,6 +175,21 @@ size_t EvaDisassembler::disassembleJump(CodeObject *co, uint8_t opcode,
   return offset + 3;
 }
 
+size_t EvaDisassembler::disassembleForLoop(CodeObject *co, uint8_t opcode,
+                                           size_t offset) {
+  std::ios_base::fmtflags f(std::cout.flags());
+  dumpBytes(co, offset, 4);
+  printOpCode(opcode);
+  auto slot = co->code[offset + 1];
+  uint16_t address = readWordAtOffset(co, offset + 2);
+
+  std::cout << (int)slot << " " << std::uppercase << std::hex
+            << std::setfill('0') << std::setw(4) << (int)address << " ";
+
+  std::cout.flags(f);
+  return offset + 4;
+}
+
 size_t EvaDisassembler::disassembleGlobal(CodeObject *co, uint8_t opcode,
                                           size_t offset) {
   dumpBytes(co, offset, 2);
@@ -137,6 +208,18 @@ size_t EvaDisassembler::disassembleLocal(CodeObject *co, uint8_t opcode,
   return offset + 2;
 }
 
+size_t EvaDisassembler::disassembleLocalConst(CodeObject *co, uint8_t opcode,
+                                              size_t offset) {
+  dumpBytes(co, offset, 3);
+  printOpCode(opcode);
+  auto localIndex = co->code[offset + 1];
+  auto constIndex = co->code[offset + 2];
+  std::cout << (int)localIndex << " (" << co->locals[localIndex].name << ") "
+            << (int)constIndex << " ("
+            << evaValueToConstantString(co->constants[constIndex]) << ")";
+  return offset + 3;
+}
+
 size_t EvaDisassembler::disassembleCell(CodeObject *co, uint8_t opcode,
                                         size_t offset) {
   dumpBytes(co, offset, 2);
@@ -151,6 +234,96 @@ size_t EvaDisassembler::disassembleMakeFunction(CodeObject *co, uint8_t opcode,
   return disassembleWord(co, opcode, offset);
 }
 
+size_t EvaDisassembler::disassembleShape(CodeObject *co, uint8_t opcode,
+                                         size_t offset) {
+  dumpBytes(co, offset, 2);
+  printOpCode(opcode);
+  auto shapeIndex = co->code[offset + 1];
+  std::cout << (int)shapeIndex;
+  printShape(co->shapes[shapeIndex]);
+  return offset + 2;
+}
+
+size_t EvaDisassembler::disassembleProperty(CodeObject *co, uint8_t opcode,
+                                            size_t offset) {
+  dumpBytes(co, offset, 2);
+  printOpCode(opcode);
+  auto cacheIndex = co->code[offset + 1];
+  std::cout << (int)cacheIndex << " ("
+            << co->propertyCaches[cacheIndex].name->view() << ")";
+  return offset + 2;
+}
+
+void EvaDisassembler::printShape(Shape *shape) {
+  std::cout << " (";
+  for (size_t i = 0; i < shape->names.size(); i++) {
+    std::cout << (i == 0 ? "" : " ") << shape->names[i]->view();
+  }
+  std::cout << ")";
+}
+
+size_t EvaDisassembler::disassembleWide(CodeObject *co, size_t offset) {
+  std::ios_base::fmtflags f(std::cout.flags());
+  auto opcode = co->code[offset + 1];
+  auto size = instructionSize(&co->code[offset]);
+
+  dumpBytes(co, offset, size);
+  printOpCode("WIDE " + opcodeToString(opcode));
+
+  if (isJumpOpcode(opcode)) {
+    if (isForLoopOpcode(opcode)) {
+      std::cout << (int)readWordAtOffset(co, offset + 2) << " ";
+    }
+    auto relative = (int32_t)((readWordAtOffset(co, offset + size - 4) << 16) |
+                              readWordAtOffset(co, offset + size - 2));
+    std::cout << std::uppercase << std::hex << std::setfill('0')
+              << std::setw(4) << (int)(offset + size + relative) << " ";
+    std::cout.flags(f);
+    return offset + size;
+  }
+
+  auto index = readWordAtOffset(co, offset + 2);
+  std::cout << (int)index;
+
+  switch (static_cast<OpCode>(opcode)) {
+  case OpCode::CONST:
+    std::cout << " (" << evaValueToConstantString(co->constants[index])
+              << ")";
+    break;
+  case OpCode::GET_GLOBAL:
+  case OpCode::SET_GLOBAL:
+    std::cout << " (" << global->get(index).name << ")";
+    break;
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+    std::cout << " (" << co->locals[index].name << ")";
+    break;
+  case OpCode::GET_CELL:
+  case OpCode::SET_CELL:
+  case OpCode::LOAD_CELL:
+    std::cout << " (" << co->cellNames[index] << ")";
+    break;
+  case OpCode::MAKE_OBJECT:
+    printShape(co->shapes[index]);
+    break;
+  case OpCode::GET_PROP:
+  case OpCode::SET_PROP:
+    std::cout << " (" << co->propertyCaches[index].name->view() << ")";
+    break;
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::SUB_LOCAL_CONST: {
+    auto constIndex = readWordAtOffset(co, offset + 4);
+    std::cout << " (" << co->locals[index].name << ") " << (int)constIndex
+              << " (" << evaValueToConstantString(co->constants[constIndex])
+              << ")";
+    break;
+  }
+  default:
+    break;
+  }
+  return offset + size;
+}
+
 uint16_t EvaDisassembler::readWordAtOffset(CodeObject *co, size_t offset) {
   return (uint16_t)((co->code[offset] << 8) | co->code[offset + 1]);
 }
@@ -169,9 +342,12 @@ void EvaDisassembler::dumpBytes(CodeObject *co, size_t offset, size_t count) {
 }
 
 void EvaDisassembler::printOpCode(uint8_t opcode) {
+  printOpCode(opcodeToString(opcode));
+}
+
+void EvaDisassembler::printOpCode(const std::string &name) {
   std::ios_base::fmtflags f(std::cout.flags());
-  std::cout << std::left << std::setfill(' ') << std::setw(20)
-            << opcodeToString(opcode) << " ";
+  std::cout << std::left << std::setfill(' ') << std::setw(20) << name << " ";
   std::cout.flags(f);
 }
 
@@ -15,17 +15,25 @@ private:
   size_t disassembleInstruction(CodeObject *co, size_t offset);
   size_t disassembleSimple(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleWord(CodeObject *co, uint8_t opcode, size_t offset);
+  size_t disassembleCall(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleConst(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleCompare(CodeObject *co, uint8_t opcode, size_t offset);
   static std::array<std::string, 6> inverseCompareOps_;
   size_t disassembleJump(CodeObject *co, uint8_t opcode, size_t offset);
+  size_t disassembleForLoop(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleGlobal(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleLocal(CodeObject *co, uint8_t opcode, size_t offset);
+  size_t disassembleLocalConst(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleCell(CodeObject *co, uint8_t opcode, size_t offset);
   size_t disassembleMakeFunction(CodeObject *co, uint8_t opcode, size_t offset);
+  size_t disassembleShape(CodeObject *co, uint8_t opcode, size_t offset);
+  size_t disassembleProperty(CodeObject *co, uint8_t opcode, size_t offset);
+  void printShape(Shape *shape);
+  size_t disassembleWide(CodeObject *co, size_t offset);
   uint16_t readWordAtOffset(CodeObject *co, size_t offset);
   void dumpBytes(CodeObject *co, size_t offset, size_t count);
   void printOpCode(uint8_t opcode);
+  void printOpCode(const std::string &name);
 };
 
 #endif // __EvaDisassembler_h
@@ -0,0 +1,206 @@
+#include "EvaRegisterDisassembler.h"
+#include "../Logger.h"
+#include "../bytecode/RegisterOpCode.h"
+#include "../vm/EvaValue.h"
+#include "../vm/Global.h"
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <memory>
+
+EvaRegisterDisassembler::EvaRegisterDisassembler(std::shared_ptr<Global> global)
+    : global(global) {}
+
+void EvaRegisterDisassembler::disassemble(CodeObject *co) {
+  std::cout << "\n-------------- Disassembly (registers: " << co->frameSize
+            << "): " << co->name << " ---------------\n\n";
+  size_t offset = 0;
+  while (offset < co->code.size()) {
+    offset = disassembleInstruction(co, offset);
+    std::cout << "\n";
+  }
+}
+
+/**
+ * Operand layouts: R register, X register or constant (RK), K constant,
+ * G global, C cell, N count, O compare operator, A 16-bit jump address,
+ * S shape, P property cache.
+ */
+size_t EvaRegisterDisassembler::disassembleInstruction(CodeObject *co,
+                                                       size_t offset) {
+  std::ios_base::fmtflags f(std::cout.flags());
+
+  std::cout << std::uppercase << std::hex << std::setfill('0') << std::setw(4)
+            << offset << "    ";
+
+  std::cout.flags(f);
+
+  auto opcode = co->code[offset];
+
+  switch (static_cast<RegisterOpCode>(opcode)) {
+  case RegisterOpCode::HALT:
+  case RegisterOpCode::RETURN:
+    return disassembleOperands(co, opcode, offset, "R");
+  case RegisterOpCode::LOADK:
+    return disassembleOperands(co, opcode, offset, "RK");
+  case RegisterOpCode::MOVE:
+    return disassembleOperands(co, opcode, offset, "RR");
+  case RegisterOpCode::ADD:
+  case RegisterOpCode::SUB:
+  case RegisterOpCode::MUL:
+  case RegisterOpCode::DIV:
+    return disassembleOperands(co, opcode, offset, "RXX");
+  case RegisterOpCode::COMPARE:
+    return disassembleOperands(co, opcode, offset, "RXXO");
+  case RegisterOpCode::JMP_IF_FALSE:
+    return disassembleOperands(co, opcode, offset, "XA");
+  case RegisterOpCode::JMP:
+    return disassembleOperands(co, opcode, offset, "A");
+  case RegisterOpCode::GET_GLOBAL:
+  case RegisterOpCode::SET_GLOBAL:
+    return disassembleOperands(co, opcode, offset, "RG");
+  case RegisterOpCode::CALL:
+  case RegisterOpCode::TAIL_CALL:
+    return disassembleOperands(co, opcode, offset, "RN");
+  case RegisterOpCode::GET_CELL:
+  case RegisterOpCode::SET_CELL:
+  case RegisterOpCode::LOAD_CELL:
+    return disassembleOperands(co, opcode, offset, "RC");
+  case RegisterOpCode::MAKE_FUNCTION:
+    return disassembleOperands(co, opcode, offset, "RKRN");
+  case RegisterOpCode::MAKE_ARRAY:
+    return disassembleOperands(co, opcode, offset, "RRN");
+  case RegisterOpCode::GET_INDEX:
+  case RegisterOpCode::RESUME:
+    return disassembleOperands(co, opcode, offset, "RXX");
+  case RegisterOpCode::SET_INDEX:
+    return disassembleOperands(co, opcode, offset, "XXR");
+  case RegisterOpCode::LENGTH:
+  case RegisterOpCode::YIELD:
+    return disassembleOperands(co, opcode, offset, "RX");
+  case RegisterOpCode::MAKE_OBJECT:
+    return disassembleOperands(co, opcode, offset, "RSR");
+  case RegisterOpCode::GET_PROP:
+    return disassembleOperands(co, opcode, offset, "RXP");
+  case RegisterOpCode::SET_PROP:
+    return disassembleOperands(co, opcode, offset, "XPR");
+  case RegisterOpCode::JLT:
+  case RegisterOpCode::JGT:
+  case RegisterOpCode::JEQ:
+  case RegisterOpCode::JGE:
+  case RegisterOpCode::JLE:
+  case RegisterOpCode::JNE:
+    return disassembleOperands(co, opcode, offset, "XXA");
+  case RegisterOpCode::FOR_PREP:
+  case RegisterOpCode::FOR_LOOP:
+  case RegisterOpCode::FOR_EACH_PREP:
+  case RegisterOpCode::FOR_EACH_LOOP:
+    return disassembleOperands(co, opcode, offset, "RA");
+  default:
+    DIE << "disassembleInstruction: no disassembly for "
+        << registerOpcodeToString(opcode);
+  }
+
+  return 0;
+}
+
+size_t EvaRegisterDisassembler::disassembleOperands(CodeObject *co,
+                                                    uint8_t opcode,
+                                                    size_t offset,
+                                                    const std::string &layout) {
+  auto size = 1 + layout.size() + (layout.back() == 'A' ? 1 : 0);
+  dumpBytes(co, offset, size);
+  printOpCode(opcode);
+
+  auto operandOffset = offset + 1;
+  for (auto kind : layout) {
+    printOperand(co, kind, operandOffset);
+    operandOffset += kind == 'A' ? 2 : 1;
+  }
+
+  return offset + size;
+}
+
+void EvaRegisterDisassembler::printOperand(CodeObject *co, char kind,
+                                           size_t offset) {
+  auto operand = co->code[offset];
+
+  if (kind == 'X' && (operand & REGISTER_CONST_BIT)) {
+    operand &= ~REGISTER_CONST_BIT;
+    kind = 'K';
+  }
+
+  switch (kind) {
+  case 'R':
+  case 'X':
+    std::cout << "r" << (int)operand << " ";
+    break;
+  case 'K':
+    std::cout << "k" << (int)operand << " ("
+              << evaValueToConstantString(co->constants[operand]) << ") ";
+    break;
+  case 'G':
+    std::cout << "g" << (int)operand << " (" << global->get(operand).name
+              << ") ";
+    break;
+  case 'C':
+    std::cout << "c" << (int)operand << " (" << co->cellNames[operand] << ") ";
+    break;
+  case 'N':
+    std::cout << (int)operand << " ";
+    break;
+  case 'O':
+    std::cout << "(" << inverseCompareOps_[operand] << ") ";
+    break;
+  case 'S': {
+    auto shape = co->shapes[operand];
+    std::cout << "s" << (int)operand << " (";
+    for (size_t i = 0; i < shape->names.size(); i++) {
+      std::cout << (i == 0 ? "" : " ") << shape->names[i]->view();
+    }
+    std::cout << ") ";
+    break;
+  }
+  case 'P':
+    std::cout << "p" << (int)operand << " ("
+              << co->propertyCaches[operand].name->view() << ") ";
+    break;
+  case 'A': {
+    std::ios_base::fmtflags f(std::cout.flags());
+    std::cout << std::uppercase << std::hex << std::setfill('0')
+              << std::setw(4) << (int)readWordAtOffset(co, offset) << " ";
+    std::cout.flags(f);
+    break;
+  }
+  }
+}
+
+uint16_t EvaRegisterDisassembler::readWordAtOffset(CodeObject *co,
+                                                   size_t offset) {
+  return (uint16_t)((co->code[offset] << 8) | co->code[offset + 1]);
+}
+
+void EvaRegisterDisassembler::dumpBytes(CodeObject *co, size_t offset,
+                                        size_t count) {
+  std::ios_base::fmtflags f(std::cout.flags());
+  std::stringstream ss;
+
+  for (auto i = 0; i < count; i++) {
+    ss << std::uppercase << std::hex << std::setfill('0') << std::setw(2)
+       << (((int)co->code[offset + i]) & 0xff) << " ";
+  }
+
+  std::cout << std::left << std::setfill(' ') << std::setw(18) << ss.str();
+  std::cout.flags(f);
+}
+
+void EvaRegisterDisassembler::printOpCode(uint8_t opcode) {
+  std::ios_base::fmtflags f(std::cout.flags());
+  std::cout << std::left << std::setfill(' ') << std::setw(20)
+            << registerOpcodeToString(opcode) << " ";
+  std::cout.flags(f);
+}
+
+std::array<std::string, 6> EvaRegisterDisassembler::inverseCompareOps_ = {
+    "<", ">", "==", ">=", "<=", "!=",
+};
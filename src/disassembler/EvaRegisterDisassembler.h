@@ -0,0 +1,27 @@
+#ifndef __EvaRegisterDisassembler_h
+#define __EvaRegisterDisassembler_h
+
+#include "../vm/EvaValue.h"
+#include "../vm/Global.h"
+#include <array>
+#include <memory>
+#include <string>
+
+class EvaRegisterDisassembler {
+public:
+  EvaRegisterDisassembler(std::shared_ptr<Global> global);
+  void disassemble(CodeObject *co);
+
+private:
+  std::shared_ptr<Global> global;
+  size_t disassembleInstruction(CodeObject *co, size_t offset);
+  size_t disassembleOperands(CodeObject *co, uint8_t opcode, size_t offset,
+                             const std::string &layout);
+  void printOperand(CodeObject *co, char kind, size_t offset);
+  uint16_t readWordAtOffset(CodeObject *co, size_t offset);
+  void dumpBytes(CodeObject *co, size_t offset, size_t count);
+  void printOpCode(uint8_t opcode);
+  static std::array<std::string, 6> inverseCompareOps_;
+};
+
+#endif // __EvaRegisterDisassembler_h
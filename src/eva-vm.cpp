@@ -4,7 +4,8 @@
 
 int main(int argc, char *argv[]) {
   {
-    EvaVm vm;
+    EvaVm vm(EvalMode::STACK, DEFAULT_STACK_SIZE,
+             EvalOptions::fromEnvironment());
 
     auto program = R"(
       (def t (a q)
@@ -7,19 +7,57 @@ void EvaCollector::gc(const std::set<Traceable *> &roots) {
   sweep();
 }
 
+/**
+ * Referents held weakly: objects other than strings, which are values
+ * rather than identities.
+ */
+static bool isWeakReferent(const EvaValue &value) {
+  return isObject(value) && !isString(value);
+}
+
 void EvaCollector::mark(const std::set<Traceable *> &roots) {
   std::vector<Traceable *> worklist(roots.begin(), roots.end());
+  weakMaps_.clear();
+  weakRefs_.clear();
 
-  while (!worklist.empty()) {
-    auto object = worklist.back();
-    worklist.pop_back();
+  // A key marked late can make more ephemeron values reachable, so the
+  // weak maps are rescanned until no more values turn up
+  do {
+    while (!worklist.empty()) {
+      auto object = worklist.back();
+      worklist.pop_back();
 
-    if (!object->marked) {
+      if (object->marked) {
+        continue;
+      }
       object->marked = true;
+
+      auto evaValue = makeObject((Object *)object);
+      if (isMap(evaValue) && asMap(evaValue)->weakKeys) {
+        weakMaps_.push_back(asMap(evaValue));
+      } else if (isWeakRef(evaValue)) {
+        weakRefs_.push_back(asWeakRef(evaValue));
+      }
+
       for (auto &p : getPointers(object)) {
         worklist.push_back(p);
       }
     }
+    markEphemerons(worklist);
+  } while (!worklist.empty());
+}
+
+void EvaCollector::markEphemerons(std::vector<Traceable *> &worklist) {
+  for (auto map : weakMaps_) {
+    for (auto &entry : map->entries) {
+      if (!entry.isLive() || !isWeakReferent(entry.key) ||
+          !asObject(entry.key)->marked) {
+        continue;
+      }
+      if (isObject(entry.value) && !asObject(entry.value)->marked) {
+        worklist.push_back((Traceable *)asObject(entry.value));
+      }
+    }
   }
 }
 
@@ -31,23 +69,143 @@ std::set<Traceable *> EvaCollector::getPointers(const Traceable *object) {
   if (isFunction(evaValue)) {
     auto fn = asFunction(evaValue);
     for (auto &cell : fn->cells) {
-      pointers.insert((Traceable *)cell);
+      if (cell != nullptr) {
+        pointers.insert((Traceable *)cell);
+      }
+    }
+  } else if (isCell(evaValue)) {
+    auto cell = asCell(evaValue);
+    pointers.insert((Traceable *)cell->block);
+    if (isObject(cell->value)) {
+      pointers.insert((Traceable *)asObject(cell->value));
+    }
+  } else if (isCellBlock(evaValue)) {
+    auto block = asCellBlock(evaValue);
+    for (size_t i = 0; i < block->count; i++) {
+      auto &value = block->cells()[i].value;
+      if (isObject(value)) {
+        pointers.insert((Traceable *)asObject(value));
+      }
+    }
+  } else if (isString(evaValue)) {
+    auto string = asString(evaValue);
+    if (string->isRope()) {
+      pointers.insert((Traceable *)string->left);
+      pointers.insert((Traceable *)string->right);
+    }
+    if (string->interned != nullptr && string->interned != string) {
+      pointers.insert((Traceable *)string->interned);
+    }
+  } else if (isArray(evaValue)) {
+    // Unboxed numeric arrays hold no references
+    for (auto &value : asArray(evaValue)->values) {
+      if (isObject(value)) {
+        pointers.insert((Traceable *)asObject(value));
+      }
+    }
+  } else if (isRecord(evaValue)) {
+    // Shapes are not collected, see Shape
+    for (auto &value : asRecord(evaValue)->slots) {
+      if (isObject(value)) {
+        pointers.insert((Traceable *)asObject(value));
+      }
+    }
+  } else if (isCoroutine(evaValue)) {
+    // A suspended coroutine holds its activations: the values of its
+    // stack slice, which include the callees, and the cells of its
+    // frames. While it runs they are on the VM stacks instead.
+    auto co = asCoroutine(evaValue);
+    pointers.insert((Traceable *)co->fn);
+    for (auto &value : co->stack) {
+      if (isObject(value)) {
+        pointers.insert((Traceable *)asObject(value));
+      }
+    }
+    for (auto &frame : co->frames) {
+      if (frame.env != nullptr) {
+        pointers.insert((Traceable *)frame.env);
+      }
+    }
+    if (co->state.env != nullptr) {
+      pointers.insert((Traceable *)co->state.env);
+    }
+  } else if (isWeakRef(evaValue)) {
+    auto &target = asWeakRef(evaValue)->target;
+    if (isObject(target) && !isWeakReferent(target)) {
+      pointers.insert((Traceable *)asObject(target));
+    }
+  } else if (isMap(evaValue)) {
+    auto map = asMap(evaValue);
+    for (auto &entry : map->entries) {
+      // Weakly keyed entries are traced by markEphemerons
+      if (!entry.isLive() || (map->weakKeys && isWeakReferent(entry.key))) {
+        continue;
+      }
+      if (isObject(entry.key)) {
+        pointers.insert((Traceable *)asObject(entry.key));
+      }
+      if (isObject(entry.value)) {
+        pointers.insert((Traceable *)asObject(entry.value));
+      }
     }
   }
 
   return pointers;
 }
 
+void EvaCollector::unmarkCells(Traceable *object) {
+  auto evaValue = makeObject((Object *)object);
+
+  // Embedded cells are not in the object list, so the sweep of their
+  // block resets them
+  if (isCellBlock(evaValue)) {
+    auto block = asCellBlock(evaValue);
+    for (size_t i = 0; i < block->count; i++) {
+      block->cells()[i].marked = false;
+    }
+  }
+}
+
+void EvaCollector::clearWeakReferences() {
+  for (auto map : weakMaps_) {
+    for (auto &entry : map->entries) {
+      if (entry.isLive() && isWeakReferent(entry.key) &&
+          !asObject(entry.key)->marked) {
+        map->removeEntry(entry);
+      }
+    }
+  }
+
+  for (auto ref : weakRefs_) {
+    if (isWeakReferent(ref->target) && !asObject(ref->target)->marked) {
+      ref->target = makeBoolean(false);
+    }
+  }
+
+  weakMaps_.clear();
+  weakRefs_.clear();
+}
+
 void EvaCollector::sweep() {
+  // Before anything is freed, while the referents can still be looked at
+  clearWeakReferences();
+
   auto it = Traceable::objects.begin();
   while (it != Traceable::objects.end()) {
     auto object = (Traceable *)*it;
     if (object->marked) {
       object->marked = false;
+      unmarkCells(object);
       ++it;
     } else {
       it = Traceable::objects.erase(it);
-      delete object;
+      // The intern table is weak
+      auto string = (StringObject *)object;
+      if (isString(makeObject((Object *)object)) &&
+          string->interned == string) {
+        StringObject::strings.remove(string);
+      }
+      Traceable::destroy(object);
     }
   }
 }
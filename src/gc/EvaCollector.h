@@ -4,6 +4,8 @@
 #include "../vm/EvaValue.h"
 
 #include <set>
+#include <vector>
+
 struct EvaCollector {
   void gc(const std::set<Traceable *> &roots);
 
@@ -12,6 +14,26 @@ struct EvaCollector {
   std::set<Traceable *> getPointers(const Traceable *object);
 
   void sweep();
+
+  void unmarkCells(Traceable *object);
+
+private:
+  /**
+   * Values of weak maps whose keys are marked by now: an ephemeron value
+   * is only reachable through its key.
+   */
+  void markEphemerons(std::vector<Traceable *> &worklist);
+
+  /**
+   * Drops the entries of weak maps and clears the weak references whose
+   * referents are about to be freed.
+   */
+  void clearWeakReferences();
+
+  // Weak maps and references marked by the current collection
+  std::vector<MapObject *> weakMaps_;
+
+  std::vector<WeakRefObject *> weakRefs_;
 };
 
 #endif // !__EvaCollector_h
@@ -0,0 +1,939 @@
+#ifdef EVA_JIT
+
+#include "EvaJit.h"
+#include "../Logger.h"
+#include "../bytecode/OpCode.h"
+#include "../vm/EvaVm.h"
+#include "X86Assembler.h"
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <sys/mman.h>
+
+using JitEntry = void (*)(EvaVm *vm, const uint8_t *target);
+
+constexpr uint32_t NO_JIT_ENTRY = std::numeric_limits<uint32_t>::max();
+
+JitCode::JitCode(const std::vector<uint8_t> &machineCode,
+                 std::vector<uint32_t> entries)
+    : size(machineCode.size()), entries(std::move(entries)) {
+  auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    DIE << "JitCode: mmap failed.";
+  }
+  std::memcpy(memory, machineCode.data(), size);
+
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    DIE << "JitCode: mprotect failed.";
+  }
+  base = static_cast<uint8_t *>(memory);
+}
+
+JitCode::~JitCode() { munmap(base, size); }
+
+/**
+ * Out-of-line parts of the templates, called with the VM and the decoded
+ * operand of the instruction. Jump helpers return whether to branch.
+ */
+struct EvaJit::Runtime {
+  static void constant(EvaVm *vm, uint64_t index) {
+    vm->push(vm->fn->co->constants[index]);
+  }
+
+  static void add(EvaVm *vm, uint64_t) {
+    auto op2 = vm->pop();
+    auto op1 = vm->pop();
+    vm->add(op1, op2);
+  }
+
+  static void sub(EvaVm *vm, uint64_t) { vm->binaryOp("-", subNumbers); }
+
+  static void mul(EvaVm *vm, uint64_t) { vm->binaryOp("*", mulNumbers); }
+
+  static void div(EvaVm *vm, uint64_t) { vm->binaryOp("/", divNumbers); }
+
+  static void compare(EvaVm *vm, uint64_t op) {
+    auto op2 = vm->pop();
+    auto op1 = vm->pop();
+
+    if (isNumber(op1) && isNumber(op2)) {
+      vm->push(makeBoolean(EvaVm::compareNumbers(
+          [op](auto a, auto b) { return EvaVm::compareValues(op, a, b); },
+          op1, op2)));
+    } else if (isString(op1) && isString(op2)) {
+      vm->push(makeBoolean(EvaVm::compareStrings(op, op1, op2)));
+    } else {
+      vm->push(makeBoolean(EvaVm::compareOthers(op, op1, op2)));
+    }
+  }
+
+  static bool jumpIfFalse(EvaVm *vm, uint64_t) {
+    return !asBoolean(vm->pop());
+  }
+
+  template <typename Compare> static bool jumpUnless(EvaVm *vm, uint64_t) {
+    auto op2 = vm->pop();
+    auto op1 = vm->pop();
+    return !EvaVm::compareOperands(Compare(), op1, op2);
+  }
+
+  // Jumps past a loop that doesn't run, and back to the body of one that
+  // runs again
+  static bool forPrep(EvaVm *vm, uint64_t slot) {
+    return !::forPrep(vm->bp + slot);
+  }
+
+  static bool forLoop(EvaVm *vm, uint64_t slot) {
+    return ::forLoop(vm->bp + slot);
+  }
+
+  static bool forEachPrep(EvaVm *vm, uint64_t slot) {
+    return !::forEachPrep(vm->bp + slot);
+  }
+
+  static bool forEachLoop(EvaVm *vm, uint64_t slot) {
+    return ::forEachLoop(vm->bp + slot);
+  }
+
+  static void getGlobal(EvaVm *vm, uint64_t slot) {
+    vm->push(reinterpret_cast<GlobalVar *>(slot)->value);
+  }
+
+  static void setGlobal(EvaVm *vm, uint64_t slot) {
+    vm->global->set(*reinterpret_cast<GlobalVar *>(slot), vm->peek(0));
+  }
+
+  static void pop(EvaVm *vm, uint64_t) { vm->pop(); }
+
+  static void getLocal(EvaVm *vm, uint64_t index) {
+    vm->push(vm->bp[index]);
+  }
+
+  static void setLocal(EvaVm *vm, uint64_t index) {
+    vm->bp[index] = vm->peek(0);
+  }
+
+  static void scopeExit(EvaVm *vm, uint64_t count) {
+    *(vm->sp - 1 - count) = vm->peek(0);
+    vm->popN(count);
+  }
+
+  static void getCell(EvaVm *vm, uint64_t index) {
+    vm->push(vm->cellAt(index)->value);
+  }
+
+  static void setCell(EvaVm *vm, uint64_t index) {
+    vm->setCell(index, vm->peek(0));
+  }
+
+  static void loadCell(EvaVm *vm, uint64_t index) {
+    vm->push(cell(vm->cellAt(index)));
+  }
+
+  static void makeFunction(EvaVm *vm, uint64_t cellsCount) {
+    auto co = asCode(vm->pop());
+    vm->maybeGC();
+    auto fnValue = allocFunction(co);
+    auto fn = asFunction(fnValue);
+
+    fn->cells.resize(cellsCount);
+    for (auto i = cellsCount; i > 0; i--) {
+      fn->cells[i - 1] = asCell(vm->pop());
+    }
+    vm->push(fnValue);
+  }
+
+  static void makeArray(EvaVm *vm, uint64_t count) { vm->makeArray(count); }
+
+  static void getIndex(EvaVm *vm, uint64_t) { vm->getIndex(); }
+
+  static void setIndex(EvaVm *vm, uint64_t) { vm->setIndex(); }
+
+  static void length(EvaVm *vm, uint64_t) { vm->push(lengthOf(vm->pop())); }
+
+  static void makeRecord(EvaVm *vm, uint64_t index) {
+    vm->makeRecord(vm->fn->co->shapes[index]);
+  }
+
+  static void getProp(EvaVm *vm, uint64_t index) {
+    vm->getProp(vm->fn->co->propertyCaches[index]);
+  }
+
+  static void setProp(EvaVm *vm, uint64_t index) {
+    vm->setProp(vm->fn->co->propertyCaches[index]);
+  }
+
+  // Operand: local index in the low 16 bits, constant index above them
+  static void addLocalConst(EvaVm *vm, uint64_t operands) {
+    auto &op1 = vm->bp[operands & 0xFFFF];
+    auto &op2 = vm->fn->co->constants[operands >> 16];
+
+    if (isNumber(op1)) {
+      vm->push(addNumbers(op1, op2));
+    } else {
+      vm->add(op1, op2);
+    }
+  }
+
+  static void subLocalConst(EvaVm *vm, uint64_t operands) {
+    auto &op1 = vm->bp[operands & 0xFFFF];
+    auto &op2 = vm->fn->co->constants[operands >> 16];
+    requireNumbers("-", op1, op2);
+    vm->push(subNumbers(op1, op2));
+  }
+};
+
+/**
+ * Undoes quickening: compiled code does its own type dispatch.
+ */
+static OpCode genericOpcode(OpCode opcode) {
+  switch (opcode) {
+  case OpCode::ADD_NUM:
+  case OpCode::ADD_STR:
+    return OpCode::ADD;
+  case OpCode::COMPARE_NUM_LT:
+  case OpCode::COMPARE_NUM_GT:
+  case OpCode::COMPARE_NUM_EQ:
+  case OpCode::COMPARE_NUM_GE:
+  case OpCode::COMPARE_NUM_LE:
+  case OpCode::COMPARE_NUM_NE:
+    return OpCode::COMPARE;
+  case OpCode::JLT_NUM:
+    return OpCode::JLT;
+  case OpCode::JGT_NUM:
+    return OpCode::JGT;
+  case OpCode::JEQ_NUM:
+    return OpCode::JEQ;
+  case OpCode::JGE_NUM:
+    return OpCode::JGE;
+  case OpCode::JLE_NUM:
+    return OpCode::JLE;
+  case OpCode::JNE_NUM:
+    return OpCode::JNE;
+  default:
+    return opcode;
+  }
+}
+
+template <typename T> static int32_t memberOffset(EvaVm *vm, T *member) {
+  return static_cast<int32_t>(reinterpret_cast<uint8_t *>(member) -
+                              reinterpret_cast<uint8_t *>(vm));
+}
+
+EvaJit::EvaJit(EvaVm *vm)
+    : vm_(vm), ipOffset_(memberOffset(vm, &vm->ip)),
+      spOffset_(memberOffset(vm, &vm->sp)),
+      bpOffset_(memberOffset(vm, &vm->bp)) {}
+
+EvaJit::~EvaJit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_one();
+
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+
+  for (auto co : queued_) {
+    co->jitCode = nullptr;
+  }
+}
+
+void EvaJit::run(JitCode *code) {
+  auto offset = vm_->ip - &vm_->fn->co->code[0];
+  auto entry = code->entries[offset];
+
+  if (entry == NO_JIT_ENTRY) {
+    return;
+  }
+
+  auto native = reinterpret_cast<JitEntry>(code->base);
+  native(vm_, code->base + entry);
+}
+
+std::vector<GlobalVar *> EvaJit::globalSlots() {
+  std::vector<GlobalVar *> slots;
+  for (auto &globalVar : vm_->global->globals) {
+    slots.push_back(&globalVar);
+  }
+  return slots;
+}
+
+void EvaJit::enqueue(CodeObject *co) {
+  queued_.push_back(co);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(Job{co, &co->code[0], co->code, co->constants,
+                         globalSlots()});
+  }
+  ready_.notify_one();
+
+  if (!worker_.joinable()) {
+    worker_ = std::thread(&EvaJit::workerLoop, this);
+  }
+}
+
+void EvaJit::workerLoop() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+
+      if (stopping_) {
+        return;
+      }
+      job = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    auto code = compile(job);
+    job.co->jitCode.store(code.get(), std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    codes_.push_back(std::move(code));
+  }
+}
+
+/**
+ * Emits the templates of one CodeObject. Registers: rbx is the VM; rax,
+ * rcx, rdx, rsi, rdi, xmm0 and xmm1 are scratch. Stack slots are addressed
+ * through vm->sp and vm->bp in memory, so runtime helpers see the same
+ * state as the templates.
+ */
+class TemplateCompiler {
+public:
+  TemplateCompiler(const std::vector<uint8_t> &code,
+                   const std::vector<EvaValue> &constants,
+                   const std::vector<GlobalVar *> &globals,
+                   const uint8_t *bytecode, int32_t ipOffset,
+                   int32_t spOffset, int32_t bpOffset)
+      : code_(code), constants_(constants), globals_(globals),
+        bytecode_(bytecode), ipOffset_(ipOffset), spOffset_(spOffset),
+        bpOffset_(bpOffset), entries_(code.size(), NO_JIT_ENTRY) {}
+
+  std::unique_ptr<JitCode> compile();
+
+private:
+  void genInstruction(OpCode opcode, size_t offset, bool wide);
+
+  void genExit(size_t offset);
+
+  void genHelper(const void *helper, uint64_t operand = 0);
+
+  void genHelperJump(const void *helper, size_t target, uint64_t operand = 0);
+
+  void genPushRdx();
+
+#ifdef EVA_NAN_BOXING
+  void genGuardDouble(Reg reg, std::vector<size_t> &slowPaths);
+
+  void genGuardInteger(Reg reg, std::vector<size_t> &slowPaths);
+
+  void genIntegerOp(OpCode opcode, std::vector<size_t> &slowPaths);
+
+  void genLoadDouble(Xmm dst, Reg reg, std::vector<size_t> &slowPaths);
+
+  void genArithmetic(OpCode opcode, SseOp op, const void *helper);
+
+  void genCompareJump(OpCode opcode, const void *helper, size_t target);
+
+  void genLocalConst(OpCode opcode, SseOp op, const void *helper,
+                     size_t localIndex, size_t constIndex);
+#endif
+
+  void bind(std::vector<size_t> &branches);
+
+  size_t readShort(size_t offset) {
+    return (size_t)((code_[offset] << 8) | code_[offset + 1]);
+  }
+
+  size_t jumpTarget(size_t offset) { return ::jumpTarget(&code_[0], offset); }
+
+  const std::vector<uint8_t> &code_;
+
+  const std::vector<EvaValue> &constants_;
+
+  const std::vector<GlobalVar *> &globals_;
+
+  const uint8_t *bytecode_;
+
+  int32_t ipOffset_;
+
+  int32_t spOffset_;
+
+  int32_t bpOffset_;
+
+  X86Assembler as_;
+
+  std::vector<uint32_t> entries_;
+
+  // Branches to bytecode offsets and to the exit
+  std::vector<std::pair<size_t, size_t>> jumps_;
+
+  std::vector<size_t> exits_;
+};
+
+std::unique_ptr<JitCode> TemplateCompiler::compile() {
+  as_.prologue();
+
+  size_t offset = 0;
+  while (offset < code_.size()) {
+    entries_[offset] = as_.size();
+    auto wide = code_[offset] == static_cast<uint8_t>(OpCode::WIDE);
+    auto opcode = static_cast<OpCode>(code_[wide ? offset + 1 : offset]);
+    genInstruction(genericOpcode(opcode), offset, wide);
+    offset += instructionSize(&code_[offset]);
+  }
+
+  bind(exits_);
+  as_.epilogue();
+
+  for (auto &[at, target] : jumps_) {
+    as_.patch(at, entries_[target]);
+  }
+
+  return std::make_unique<JitCode>(as_.code(), std::move(entries_));
+}
+
+void TemplateCompiler::genInstruction(OpCode opcode, size_t offset,
+                                      bool wide) {
+  using Runtime = EvaJit::Runtime;
+
+  size_t operand = 0;
+  size_t operand2 = 0;
+  if (wide) {
+    operand = readShort(offset + 2);
+    operand2 = readShort(offset + 4);
+  } else if (offset + 1 < code_.size()) {
+    operand = code_[offset + 1];
+    operand2 = offset + 2 < code_.size() ? code_[offset + 2] : 0;
+  }
+
+  switch (opcode) {
+  case OpCode::HALT:
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL:
+  case OpCode::RETURN:
+  case OpCode::RESUME:
+  case OpCode::YIELD:
+    genExit(offset);
+    break;
+
+#ifdef EVA_NAN_BOXING
+  case OpCode::CONST:
+    as_.mov(Reg::RDX, constants_[operand].bits);
+    genPushRdx();
+    break;
+
+  case OpCode::GET_LOCAL:
+    as_.load(Reg::RCX, Reg::RBX, bpOffset_);
+    as_.load(Reg::RDX, Reg::RCX, operand * sizeof(EvaValue));
+    genPushRdx();
+    break;
+
+  case OpCode::SET_LOCAL:
+    as_.load(Reg::RAX, Reg::RBX, spOffset_);
+    as_.load(Reg::RDX, Reg::RAX, -(int32_t)sizeof(EvaValue));
+    as_.load(Reg::RCX, Reg::RBX, bpOffset_);
+    as_.store(Reg::RCX, operand * sizeof(EvaValue), Reg::RDX);
+    break;
+
+  case OpCode::POP:
+    as_.sub(Reg::RBX, spOffset_, sizeof(EvaValue));
+    break;
+
+  case OpCode::ADD:
+    genArithmetic(opcode, SseOp::ADD, (void *)Runtime::add);
+    break;
+
+  case OpCode::SUB:
+    genArithmetic(opcode, SseOp::SUB, (void *)Runtime::sub);
+    break;
+
+  case OpCode::MUL:
+    genArithmetic(opcode, SseOp::MUL, (void *)Runtime::mul);
+    break;
+
+  case OpCode::DIV:
+    genArithmetic(opcode, SseOp::DIV, (void *)Runtime::div);
+    break;
+
+  case OpCode::JLT:
+    genCompareJump(opcode, (void *)Runtime::jumpUnless<std::greater_equal<>>,
+                   jumpTarget(offset));
+    break;
+
+  case OpCode::JGT:
+    genCompareJump(opcode, (void *)Runtime::jumpUnless<std::less_equal<>>,
+                   jumpTarget(offset));
+    break;
+
+  case OpCode::JEQ:
+    genCompareJump(opcode, (void *)Runtime::jumpUnless<std::not_equal_to<>>,
+                   jumpTarget(offset));
+    break;
+
+  case OpCode::JGE:
+    genCompareJump(opcode, (void *)Runtime::jumpUnless<std::less<>>,
+                   jumpTarget(offset));
+    break;
+
+  case OpCode::JLE:
+    genCompareJump(opcode, (void *)Runtime::jumpUnless<std::greater<>>,
+                   jumpTarget(offset));
+    break;
+
+  case OpCode::JNE:
+    genCompareJump(opcode, (void *)Runtime::jumpUnless<std::equal_to<>>,
+                   jumpTarget(offset));
+    break;
+
+  case OpCode::ADD_LOCAL_CONST:
+    genLocalConst(opcode, SseOp::ADD, (void *)Runtime::addLocalConst,
+                  operand, operand2);
+    break;
+
+  case OpCode::SUB_LOCAL_CONST:
+    genLocalConst(opcode, SseOp::SUB, (void *)Runtime::subLocalConst,
+                  operand, operand2);
+    break;
+#else
+  case OpCode::CONST:
+    genHelper((void *)Runtime::constant, operand);
+    break;
+
+  case OpCode::GET_LOCAL:
+    genHelper((void *)Runtime::getLocal, operand);
+    break;
+
+  case OpCode::SET_LOCAL:
+    genHelper((void *)Runtime::setLocal, operand);
+    break;
+
+  case OpCode::POP:
+    genHelper((void *)Runtime::pop);
+    break;
+
+  case OpCode::ADD:
+    genHelper((void *)Runtime::add);
+    break;
+
+  case OpCode::SUB:
+    genHelper((void *)Runtime::sub);
+    break;
+
+  case OpCode::MUL:
+    genHelper((void *)Runtime::mul);
+    break;
+
+  case OpCode::DIV:
+    genHelper((void *)Runtime::div);
+    break;
+
+  case OpCode::JLT:
+    genHelperJump((void *)Runtime::jumpUnless<std::greater_equal<>>,
+                  jumpTarget(offset));
+    break;
+
+  case OpCode::JGT:
+    genHelperJump((void *)Runtime::jumpUnless<std::less_equal<>>,
+                  jumpTarget(offset));
+    break;
+
+  case OpCode::JEQ:
+    genHelperJump((void *)Runtime::jumpUnless<std::not_equal_to<>>,
+                  jumpTarget(offset));
+    break;
+
+  case OpCode::JGE:
+    genHelperJump((void *)Runtime::jumpUnless<std::less<>>,
+                  jumpTarget(offset));
+    break;
+
+  case OpCode::JLE:
+    genHelperJump((void *)Runtime::jumpUnless<std::greater<>>,
+                  jumpTarget(offset));
+    break;
+
+  case OpCode::JNE:
+    genHelperJump((void *)Runtime::jumpUnless<std::equal_to<>>,
+                  jumpTarget(offset));
+    break;
+
+  case OpCode::ADD_LOCAL_CONST:
+    genHelper((void *)Runtime::addLocalConst, operand | (operand2 << 16));
+    break;
+
+  case OpCode::SUB_LOCAL_CONST:
+    genHelper((void *)Runtime::subLocalConst, operand | (operand2 << 16));
+    break;
+#endif
+
+  case OpCode::COMPARE:
+    genHelper((void *)Runtime::compare, operand);
+    break;
+
+  case OpCode::JMP_IF_FALSE:
+    genHelperJump((void *)Runtime::jumpIfFalse, jumpTarget(offset));
+    break;
+
+  case OpCode::JMP:
+    jumps_.emplace_back(as_.jump(), jumpTarget(offset));
+    break;
+
+  case OpCode::FOR_PREP:
+    genHelperJump((void *)Runtime::forPrep, jumpTarget(offset), operand);
+    break;
+
+  case OpCode::FOR_LOOP:
+    genHelperJump((void *)Runtime::forLoop, jumpTarget(offset), operand);
+    break;
+
+  case OpCode::FOR_EACH_PREP:
+    genHelperJump((void *)Runtime::forEachPrep, jumpTarget(offset), operand);
+    break;
+
+  case OpCode::FOR_EACH_LOOP:
+    genHelperJump((void *)Runtime::forEachLoop, jumpTarget(offset), operand);
+    break;
+
+  case OpCode::GET_GLOBAL:
+    genHelper((void *)Runtime::getGlobal, (uint64_t)globals_[operand]);
+    break;
+
+  case OpCode::SET_GLOBAL:
+    genHelper((void *)Runtime::setGlobal, (uint64_t)globals_[operand]);
+    break;
+
+  case OpCode::SCOPE_EXIT:
+    genHelper((void *)Runtime::scopeExit, operand);
+    break;
+
+  case OpCode::GET_CELL:
+    genHelper((void *)Runtime::getCell, operand);
+    break;
+
+  case OpCode::SET_CELL:
+    genHelper((void *)Runtime::setCell, operand);
+    break;
+
+  case OpCode::LOAD_CELL:
+    genHelper((void *)Runtime::loadCell, operand);
+    break;
+
+  case OpCode::MAKE_FUNCTION:
+    genHelper((void *)Runtime::makeFunction, operand);
+    break;
+
+  case OpCode::MAKE_ARRAY:
+    genHelper((void *)Runtime::makeArray, operand);
+    break;
+
+  case OpCode::GET_INDEX:
+    genHelper((void *)Runtime::getIndex, 0);
+    break;
+
+  case OpCode::SET_INDEX:
+    genHelper((void *)Runtime::setIndex, 0);
+    break;
+
+  case OpCode::LENGTH:
+    genHelper((void *)Runtime::length, 0);
+    break;
+
+  case OpCode::MAKE_OBJECT:
+    genHelper((void *)Runtime::makeRecord, operand);
+    break;
+
+  case OpCode::GET_PROP:
+    genHelper((void *)Runtime::getProp, operand);
+    break;
+
+  case OpCode::SET_PROP:
+    genHelper((void *)Runtime::setProp, operand);
+    break;
+
+  default:
+    DIE << "EvaJit: no template for " << opcodeToString((uint8_t)opcode);
+  }
+}
+
+// mov rax, ip; mov [rbx + ip], rax; jmp exit
+void TemplateCompiler::genExit(size_t offset) {
+  as_.mov(Reg::RAX, reinterpret_cast<uint64_t>(bytecode_ + offset));
+  as_.store(Reg::RBX, ipOffset_, Reg::RAX);
+  exits_.push_back(as_.jump());
+}
+
+void TemplateCompiler::genHelper(const void *helper, uint64_t operand) {
+  as_.mov(Reg::RDI, Reg::RBX);
+  as_.mov(Reg::RSI, operand);
+  as_.call(helper);
+}
+
+void TemplateCompiler::genHelperJump(const void *helper, size_t target,
+                                     uint64_t operand) {
+  genHelper(helper, operand);
+  as_.testAl();
+  jumps_.emplace_back(as_.jump(Cond::NOT_EQUAL), target);
+}
+
+// Pushes rdx onto the value stack; overflow faults on its guard page
+void TemplateCompiler::genPushRdx() {
+  as_.load(Reg::RAX, Reg::RBX, spOffset_);
+  as_.store(Reg::RAX, 0, Reg::RDX);
+  as_.add(Reg::RAX, sizeof(EvaValue));
+  as_.store(Reg::RBX, spOffset_, Reg::RAX);
+}
+
+#ifdef EVA_NAN_BOXING
+
+// Doubles only: (bits & NANBOX_QNAN) != NANBOX_QNAN
+void TemplateCompiler::genGuardDouble(Reg reg, std::vector<size_t> &slowPaths) {
+  as_.mov(Reg::RSI, NANBOX_QNAN);
+  as_.mov(Reg::RDI, reg);
+  as_.andReg(Reg::RDI, Reg::RSI);
+  as_.cmp(Reg::RDI, Reg::RSI);
+  slowPaths.push_back(as_.jump(Cond::EQUAL));
+}
+
+// Same test as isInteger(): the high half holds the integer tag
+void TemplateCompiler::genGuardInteger(Reg reg,
+                                       std::vector<size_t> &slowPaths) {
+  as_.mov(Reg::RDI, reg);
+  as_.shr(Reg::RDI, 32);
+  as_.cmp32(Reg::RDI, static_cast<uint32_t>(NANBOX_INTEGER >> 32));
+  slowPaths.push_back(as_.jump(Cond::NOT_EQUAL));
+}
+
+/**
+ * Integer `opcode` on edx and ecx, leaving the boxed result in rdx. An
+ * overflow leaves both operands intact and takes a slow path.
+ */
+void TemplateCompiler::genIntegerOp(OpCode opcode,
+                                    std::vector<size_t> &slowPaths) {
+  as_.mov32(Reg::RDI, Reg::RDX);
+
+  switch (opcode) {
+  case OpCode::ADD:
+  case OpCode::ADD_LOCAL_CONST:
+    as_.add32(Reg::RDI, Reg::RCX);
+    break;
+  case OpCode::SUB:
+  case OpCode::SUB_LOCAL_CONST:
+    as_.sub32(Reg::RDI, Reg::RCX);
+    break;
+  default: // MUL
+    as_.imul32(Reg::RDI, Reg::RCX);
+    break;
+  }
+  slowPaths.push_back(as_.jump(Cond::SIGNED_OVERFLOW));
+
+  as_.mov(Reg::RSI, NANBOX_INTEGER);
+  as_.orReg(Reg::RDI, Reg::RSI);
+  as_.mov(Reg::RDX, Reg::RDI);
+}
+
+// Loads a number into `dst` as a double, converting a boxed integer
+void TemplateCompiler::genLoadDouble(Xmm dst, Reg reg,
+                                     std::vector<size_t> &slowPaths) {
+  std::vector<size_t> notInteger;
+  genGuardInteger(reg, notInteger);
+  as_.cvtsi2sd(dst, reg);
+  std::vector<size_t> loaded{as_.jump()};
+
+  bind(notInteger);
+  genGuardDouble(reg, slowPaths);
+  as_.movq(dst, reg);
+  bind(loaded);
+}
+
+/**
+ * Binary operation on the two top slots: integers and numbers inline,
+ * overflows and other types through `helper`. Division has no integer
+ * path since it mostly produces doubles.
+ */
+void TemplateCompiler::genArithmetic(OpCode opcode, SseOp op,
+                                     const void *helper) {
+  std::vector<size_t> slowPaths;
+  std::vector<size_t> done;
+
+  as_.load(Reg::RAX, Reg::RBX, spOffset_);
+  as_.load(Reg::RDX, Reg::RAX, -2 * (int32_t)sizeof(EvaValue));
+  as_.load(Reg::RCX, Reg::RAX, -(int32_t)sizeof(EvaValue));
+
+  if (opcode != OpCode::DIV) {
+    std::vector<size_t> notIntegers;
+    genGuardInteger(Reg::RDX, notIntegers);
+    genGuardInteger(Reg::RCX, notIntegers);
+    genIntegerOp(opcode, slowPaths);
+    as_.store(Reg::RAX, -2 * (int32_t)sizeof(EvaValue), Reg::RDX);
+    as_.sub(Reg::RAX, sizeof(EvaValue));
+    as_.store(Reg::RBX, spOffset_, Reg::RAX);
+    done.push_back(as_.jump());
+    bind(notIntegers);
+  }
+
+  genLoadDouble(Xmm::XMM0, Reg::RDX, slowPaths);
+  genLoadDouble(Xmm::XMM1, Reg::RCX, slowPaths);
+  as_.sse(op, Xmm::XMM0, Xmm::XMM1);
+  as_.movq(Reg::RDX, Xmm::XMM0);
+  as_.store(Reg::RAX, -2 * (int32_t)sizeof(EvaValue), Reg::RDX);
+  as_.sub(Reg::RAX, sizeof(EvaValue));
+  as_.store(Reg::RBX, spOffset_, Reg::RAX);
+  done.push_back(as_.jump());
+
+  bind(slowPaths);
+  genHelper(helper);
+  bind(done);
+}
+
+/**
+ * Fused compare-and-branch. Integers use signed conditions; ucomisd flags
+ * an unordered (NaN) comparison as below and equal, so each double
+ * condition is chosen to branch exactly when the interpreter's jumpUnless
+ * does.
+ */
+void TemplateCompiler::genCompareJump(OpCode opcode, const void *helper,
+                                      size_t target) {
+  std::vector<size_t> slowPaths;
+  std::vector<size_t> notIntegers;
+  std::vector<size_t> done;
+
+  as_.load(Reg::RAX, Reg::RBX, spOffset_);
+  as_.load(Reg::RDX, Reg::RAX, -2 * (int32_t)sizeof(EvaValue));
+  as_.load(Reg::RCX, Reg::RAX, -(int32_t)sizeof(EvaValue));
+  genGuardInteger(Reg::RDX, notIntegers);
+  genGuardInteger(Reg::RCX, notIntegers);
+
+  as_.sub(Reg::RAX, 2 * sizeof(EvaValue));
+  as_.store(Reg::RBX, spOffset_, Reg::RAX);
+  as_.cmp32(Reg::RDX, Reg::RCX);
+
+  switch (opcode) {
+  case OpCode::JLT:
+    jumps_.emplace_back(as_.jump(Cond::LESS), target);
+    break;
+  case OpCode::JGT:
+    jumps_.emplace_back(as_.jump(Cond::GREATER), target);
+    break;
+  case OpCode::JGE:
+    jumps_.emplace_back(as_.jump(Cond::GREATER_EQUAL), target);
+    break;
+  case OpCode::JLE:
+    jumps_.emplace_back(as_.jump(Cond::LESS_EQUAL), target);
+    break;
+  case OpCode::JEQ:
+    jumps_.emplace_back(as_.jump(Cond::EQUAL), target);
+    break;
+  default: // JNE
+    jumps_.emplace_back(as_.jump(Cond::NOT_EQUAL), target);
+    break;
+  }
+  done.push_back(as_.jump());
+
+  bind(notIntegers);
+  genLoadDouble(Xmm::XMM0, Reg::RDX, slowPaths);
+  genLoadDouble(Xmm::XMM1, Reg::RCX, slowPaths);
+
+  as_.sub(Reg::RAX, 2 * sizeof(EvaValue));
+  as_.store(Reg::RBX, spOffset_, Reg::RAX);
+
+  switch (opcode) {
+  case OpCode::JLT: // !(a >= b)
+    as_.ucomisd(Xmm::XMM0, Xmm::XMM1);
+    jumps_.emplace_back(as_.jump(Cond::BELOW), target);
+    break;
+  case OpCode::JGT: // !(a <= b)
+    as_.ucomisd(Xmm::XMM1, Xmm::XMM0);
+    jumps_.emplace_back(as_.jump(Cond::BELOW), target);
+    break;
+  case OpCode::JGE: // !(a < b)
+    as_.ucomisd(Xmm::XMM1, Xmm::XMM0);
+    jumps_.emplace_back(as_.jump(Cond::BELOW_EQUAL), target);
+    break;
+  case OpCode::JLE: // !(a > b)
+    as_.ucomisd(Xmm::XMM0, Xmm::XMM1);
+    jumps_.emplace_back(as_.jump(Cond::BELOW_EQUAL), target);
+    break;
+  case OpCode::JEQ: // !(a != b)
+    as_.ucomisd(Xmm::XMM0, Xmm::XMM1);
+    done.push_back(as_.jump(Cond::PARITY));
+    jumps_.emplace_back(as_.jump(Cond::EQUAL), target);
+    break;
+  default: // JNE: !(a == b)
+    as_.ucomisd(Xmm::XMM0, Xmm::XMM1);
+    jumps_.emplace_back(as_.jump(Cond::NOT_EQUAL), target);
+    jumps_.emplace_back(as_.jump(Cond::PARITY), target);
+    break;
+  }
+  done.push_back(as_.jump());
+
+  bind(slowPaths);
+  genHelperJump(helper, target);
+  bind(done);
+}
+
+/**
+ * (op local NUMBER) with the constant folded into the template.
+ */
+void TemplateCompiler::genLocalConst(OpCode opcode, SseOp op,
+                                     const void *helper, size_t localIndex,
+                                     size_t constIndex) {
+  auto operands = localIndex | (constIndex << 16);
+  auto &constant = constants_[constIndex];
+
+  if (!isNumber(constant)) {
+    return genHelper(helper, operands);
+  }
+
+  std::vector<size_t> slowPaths;
+  std::vector<size_t> done;
+
+  as_.load(Reg::RCX, Reg::RBX, bpOffset_);
+  as_.load(Reg::RDX, Reg::RCX, localIndex * sizeof(EvaValue));
+
+  if (isInteger(constant)) {
+    std::vector<size_t> notInteger;
+    genGuardInteger(Reg::RDX, notInteger);
+    as_.mov(Reg::RCX, constant.bits);
+    genIntegerOp(opcode, slowPaths);
+    genPushRdx();
+    done.push_back(as_.jump());
+    bind(notInteger);
+  }
+
+  genLoadDouble(Xmm::XMM0, Reg::RDX, slowPaths);
+  as_.mov(Reg::RCX, makeNumber(asNumber(constant)).bits);
+  as_.movq(Xmm::XMM1, Reg::RCX);
+  as_.sse(op, Xmm::XMM0, Xmm::XMM1);
+  as_.movq(Reg::RDX, Xmm::XMM0);
+  genPushRdx();
+  done.push_back(as_.jump());
+
+  bind(slowPaths);
+  genHelper(helper, operands);
+  bind(done);
+}
+
+#endif
+
+// Resolves forward branches to the current position
+void TemplateCompiler::bind(std::vector<size_t> &branches) {
+  for (auto at : branches) {
+    as_.patch(at, as_.size());
+  }
+  branches.clear();
+}
+
+std::unique_ptr<JitCode> EvaJit::compile(const Job &job) {
+  return TemplateCompiler(job.code, job.constants, job.globals, job.bytecode,
+                          ipOffset_, spOffset_, bpOffset_)
+      .compile();
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __EvaJit_h
+#define __EvaJit_h
+
+#include "../vm/EvaValue.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class EvaVm;
+struct GlobalVar;
+
+/**
+ * Calls plus loop back-edges after which a CodeObject is sent to the JIT.
+ */
+constexpr uint32_t JIT_HOTNESS_THRESHOLD = 1000;
+
+/**
+ * Machine code of one CodeObject in its own executable mapping. `entries`
+ * maps each instruction offset of the bytecode to the offset of its
+ * template, so the interpreter can enter at any instruction.
+ */
+struct JitCode {
+  JitCode(const std::vector<uint8_t> &machineCode,
+          std::vector<uint32_t> entries);
+
+  ~JitCode();
+
+  uint8_t *base;
+
+  size_t size;
+
+  std::vector<uint32_t> entries;
+};
+
+/**
+ * Baseline template JIT for the stack tier (x86-64).
+ *
+ * Each opcode becomes a fixed machine code template working on the VM's
+ * own value stack, so frames stay interchangeable with the interpreter.
+ * Calls, RETURN and HALT are not compiled: the native code stores ip and
+ * returns, the interpreter runs the instruction and re-enters compiled
+ * code at its next safepoint.
+ *
+ * Compilation happens on a background thread from a snapshot of the
+ * bytecode; the result is published through CodeObject::jitCode.
+ */
+class EvaJit {
+public:
+  EvaJit(EvaVm *vm);
+
+  ~EvaJit();
+
+  /**
+   * Counts a call or back-edge of `co`, queueing it once it gets hot.
+   */
+  void countHotness(CodeObject *co) {
+    if (co->hotness < JIT_HOTNESS_THRESHOLD &&
+        ++co->hotness == JIT_HOTNESS_THRESHOLD) {
+      enqueue(co);
+    }
+  }
+
+  /**
+   * Runs `code` from the VM's current ip until the next call, RETURN or
+   * HALT, leaving ip at that instruction.
+   */
+  void run(JitCode *code);
+
+private:
+  friend class TemplateCompiler;
+
+  struct Runtime;
+
+  struct Job {
+    CodeObject *co;
+
+    // Address the interpreter resumes at when compiled code exits
+    uint8_t *bytecode;
+
+    // Snapshot taken at enqueue: the interpreter keeps quickening co->code
+    std::vector<uint8_t> code;
+    std::vector<EvaValue> constants;
+
+    // Global slots, so that compiled code addresses them directly
+    std::vector<GlobalVar *> globals;
+  };
+
+  void enqueue(CodeObject *co);
+
+  std::vector<GlobalVar *> globalSlots();
+
+  void workerLoop();
+
+  std::unique_ptr<JitCode> compile(const Job &job);
+
+  EvaVm *vm_;
+
+  int32_t ipOffset_;
+
+  int32_t spOffset_;
+
+  int32_t bpOffset_;
+
+  std::vector<CodeObject *> queued_;
+
+  std::vector<std::unique_ptr<JitCode>> codes_;
+
+  std::deque<Job> queue_;
+
+  std::mutex mutex_;
+
+  std::condition_variable ready_;
+
+  bool stopping_ = false;
+
+  std::thread worker_;
+};
+
+#endif // !__EvaJit_h
@@ -0,0 +1,257 @@
+#ifndef __X86Assembler_h
+#define __X86Assembler_h
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+/**
+ * General purpose registers. Memory operands are always [base + disp32],
+ * so RSP is not valid as a base.
+ */
+enum class Reg : uint8_t {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+};
+
+enum class Xmm : uint8_t {
+  XMM0 = 0,
+  XMM1 = 1,
+};
+
+/**
+ * Condition codes of Jcc (after cmp or ucomisd).
+ */
+enum class Cond : uint8_t {
+  SIGNED_OVERFLOW = 0x0,
+  BELOW = 0x2,
+  ABOVE_EQUAL = 0x3,
+  EQUAL = 0x4,
+  NOT_EQUAL = 0x5,
+  BELOW_EQUAL = 0x6,
+  ABOVE = 0x7,
+  PARITY = 0xA,
+  LESS = 0xC,
+  GREATER_EQUAL = 0xD,
+  LESS_EQUAL = 0xE,
+  GREATER = 0xF,
+};
+
+/**
+ * Scalar double operations: the second opcode byte of F2 0F xx.
+ */
+enum class SseOp : uint8_t {
+  ADD = 0x58,
+  MUL = 0x59,
+  SUB = 0x5C,
+  DIV = 0x5E,
+};
+
+/**
+ * Minimal x86-64 encoder for the instructions used by the JIT templates.
+ * Branches return the position of their rel32 field, which is resolved
+ * later with patch().
+ */
+class X86Assembler {
+public:
+  size_t size() const { return code_.size(); }
+
+  std::vector<uint8_t> &code() { return code_; }
+
+  // push rbx; mov rbx, rdi; jmp rsi
+  void prologue() { emit({0x53, 0x48, 0x89, 0xFB, 0xFF, 0xE6}); }
+
+  // pop rbx; ret
+  void epilogue() { emit({0x5B, 0xC3}); }
+
+  // mov dst, src
+  void mov(Reg dst, Reg src) { rr(0x89, src, dst); }
+
+  // mov dst, imm64
+  void mov(Reg dst, uint64_t imm) {
+    emit({rex(Reg::RAX, dst), static_cast<uint8_t>(0xB8 + low(dst))});
+    imm64(imm);
+  }
+
+  // mov dst, [base + disp]
+  void load(Reg dst, Reg base, int32_t disp) { rm(0x8B, dst, base, disp); }
+
+  // mov [base + disp], src
+  void store(Reg base, int32_t disp, Reg src) { rm(0x89, src, base, disp); }
+
+  // and dst, src
+  void andReg(Reg dst, Reg src) { rr(0x21, src, dst); }
+
+  // or dst, src
+  void orReg(Reg dst, Reg src) { rr(0x09, src, dst); }
+
+  // shr dst, imm8
+  void shr(Reg dst, uint8_t imm) {
+    emit({rex(Reg::RAX, dst), 0xC1, modrm(3, 5, low(dst)), imm});
+  }
+
+  // mov dst32, src32 (zero-extends into the full register)
+  void mov32(Reg dst, Reg src) { rr32(0x89, src, dst); }
+
+  // add dst32, src32
+  void add32(Reg dst, Reg src) { rr32(0x01, src, dst); }
+
+  // sub dst32, src32
+  void sub32(Reg dst, Reg src) { rr32(0x29, src, dst); }
+
+  // imul dst32, src32
+  void imul32(Reg dst, Reg src) {
+    emit({0x0F, 0xAF, modrm(3, low(dst), low(src))});
+  }
+
+  // cmp a32, b32
+  void cmp32(Reg a, Reg b) { rr32(0x39, b, a); }
+
+  // cmp reg32, imm32
+  void cmp32(Reg reg, uint32_t imm) {
+    emit({0x81, modrm(3, 7, low(reg))});
+    imm32(imm);
+  }
+
+  // cmp a, b
+  void cmp(Reg a, Reg b) { rr(0x39, b, a); }
+
+  // add dst, imm8
+  void add(Reg dst, int8_t imm) { ri8(0, dst, imm); }
+
+  // sub dst, imm8
+  void sub(Reg dst, int8_t imm) { ri8(5, dst, imm); }
+
+  // sub qword [base + disp], imm8
+  void sub(Reg base, int32_t disp, int8_t imm) {
+    rm(0x83, static_cast<Reg>(5), base, disp);
+    code_.push_back(static_cast<uint8_t>(imm));
+  }
+
+  // test al, al
+  void testAl() { emit({0x84, 0xC0}); }
+
+  // movq dst, src
+  void movq(Xmm dst, Reg src) {
+    emit({0x66, rex(static_cast<Reg>(dst), src), 0x0F, 0x6E,
+          modrm(3, static_cast<uint8_t>(dst), low(src))});
+  }
+
+  // movq dst, src
+  void movq(Reg dst, Xmm src) {
+    emit({0x66, rex(static_cast<Reg>(src), dst), 0x0F, 0x7E,
+          modrm(3, static_cast<uint8_t>(src), low(dst))});
+  }
+
+  // addsd / subsd / mulsd / divsd dst, src
+  void sse(SseOp op, Xmm dst, Xmm src) {
+    emit({0xF2, 0x0F, static_cast<uint8_t>(op),
+          modrm(3, static_cast<uint8_t>(dst), static_cast<uint8_t>(src))});
+  }
+
+  // cvtsi2sd dst, src32
+  void cvtsi2sd(Xmm dst, Reg src) {
+    emit({0xF2, 0x0F, 0x2A, modrm(3, static_cast<uint8_t>(dst), low(src))});
+  }
+
+  // ucomisd a, b
+  void ucomisd(Xmm a, Xmm b) {
+    emit({0x66, 0x0F, 0x2E,
+          modrm(3, static_cast<uint8_t>(a), static_cast<uint8_t>(b))});
+  }
+
+  // mov rax, fn; call rax
+  void call(const void *fn) {
+    mov(Reg::RAX, reinterpret_cast<uint64_t>(fn));
+    emit({0xFF, 0xD0});
+  }
+
+  // jcc rel32
+  size_t jump(Cond cond) {
+    emit({0x0F, static_cast<uint8_t>(0x80 | static_cast<uint8_t>(cond))});
+    return rel32();
+  }
+
+  // jmp rel32
+  size_t jump() {
+    emit({0xE9});
+    return rel32();
+  }
+
+  /**
+   * Points the rel32 field at `at` (as returned by the jumps) to `target`.
+   */
+  void patch(size_t at, size_t target) {
+    int32_t rel = static_cast<int32_t>(target - (at + 4));
+    std::memcpy(&code_[at], &rel, sizeof(rel));
+  }
+
+private:
+  static uint8_t low(Reg reg) { return static_cast<uint8_t>(reg) & 7; }
+
+  static uint8_t high(Reg reg) { return static_cast<uint8_t>(reg) >> 3; }
+
+  // REX.W with the extension bits of the modrm reg and rm fields
+  static uint8_t rex(Reg reg, Reg rm) {
+    return 0x48 | (high(reg) << 2) | high(rm);
+  }
+
+  static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+    return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+  }
+
+  // Register to register form: op rm, reg
+  void rr(uint8_t opcode, Reg reg, Reg rm) {
+    emit({rex(reg, rm), opcode, modrm(3, low(reg), low(rm))});
+  }
+
+  // 32-bit register to register form, only for the low eight registers
+  void rr32(uint8_t opcode, Reg reg, Reg rm) {
+    emit({opcode, modrm(3, low(reg), low(rm))});
+  }
+
+  // Memory form: op reg, [base + disp32]
+  void rm(uint8_t opcode, Reg reg, Reg base, int32_t disp) {
+    emit({rex(reg, base), opcode, modrm(2, low(reg), low(base))});
+    imm32(static_cast<uint32_t>(disp));
+  }
+
+  // Group 1 with an 8-bit immediate: /ext rm, imm8
+  void ri8(uint8_t ext, Reg rm, int8_t imm) {
+    emit({rex(Reg::RAX, rm), 0x83, modrm(3, ext, low(rm)),
+          static_cast<uint8_t>(imm)});
+  }
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    code_.insert(code_.end(), bytes);
+  }
+
+  void imm32(uint32_t value) {
+    for (auto i = 0; i < 4; i++) {
+      code_.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+  }
+
+  void imm64(uint64_t value) {
+    for (auto i = 0; i < 8; i++) {
+      code_.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+  }
+
+  size_t rel32() {
+    auto at = code_.size();
+    imm32(0);
+    return at;
+  }
+
+  std::vector<uint8_t> code_;
+};
+
+#endif // !__X86Assembler_h
@@ -188,15 +188,19 @@ public:
       return toToken(TokenType::__EOF);
     }
 
-    auto strSlice = str_.substr(cursor_);
+    // Rules only match at the cursor: neither a copy of the rest of the
+    // input nor a search past the cursor, which made lexing quadratic
+    auto slice = str_.cbegin() + cursor_;
 
-    auto lexRulesForState = lexRulesByStartConditions_.at(getCurrentState());
+    const auto &lexRulesForState =
+        lexRulesByStartConditions_.at(getCurrentState());
 
     for (const auto &ruleIndex : lexRulesForState) {
-      auto rule = lexRules_[ruleIndex];
+      const auto &rule = lexRules_[ruleIndex];
       std::smatch sm;
 
-      if (std::regex_search(strSlice, sm, rule.regex)) {
+      if (std::regex_search(slice, str_.cend(), sm, rule.regex,
+                            std::regex_constants::match_continuous)) {
         yytext = sm[0];
 
         captureLocations_(yytext);
@@ -224,7 +228,7 @@ public:
       return toToken(TokenType::__EOF);
     }
 
-    throwUnexpectedToken(std::string(1, strSlice[0]), currentLine_,
+    throwUnexpectedToken(std::string(1, *slice), currentLine_,
                          currentColumn_);
   }
 
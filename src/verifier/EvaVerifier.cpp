@@ -0,0 +1,316 @@
+#include "EvaVerifier.h"
+#include "../Logger.h"
+#include "../bytecode/OpCode.h"
+#include <algorithm>
+#include <string>
+
+// depths_ entries of offsets that are not reached yet, or that are no
+// instruction start at all
+static constexpr int64_t UNREACHED = -1;
+static constexpr int64_t NOT_AN_INSTRUCTION = -2;
+
+static bool hasWideForm(OpCode opcode) {
+  switch (opcode) {
+  case OpCode::CONST:
+  case OpCode::GET_GLOBAL:
+  case OpCode::SET_GLOBAL:
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+  case OpCode::SCOPE_EXIT:
+  case OpCode::GET_CELL:
+  case OpCode::SET_CELL:
+  case OpCode::LOAD_CELL:
+  case OpCode::MAKE_FUNCTION:
+  case OpCode::MAKE_ARRAY:
+  case OpCode::MAKE_OBJECT:
+  case OpCode::GET_PROP:
+  case OpCode::SET_PROP:
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::SUB_LOCAL_CONST:
+  case OpCode::JMP_IF_FALSE:
+  case OpCode::JMP:
+  case OpCode::JLT:
+  case OpCode::JGT:
+  case OpCode::JEQ:
+  case OpCode::JGE:
+  case OpCode::JLE:
+  case OpCode::JNE:
+  case OpCode::FOR_PREP:
+  case OpCode::FOR_LOOP:
+  case OpCode::FOR_EACH_PREP:
+  case OpCode::FOR_EACH_LOOP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+EvaVerifier::EvaVerifier(std::shared_ptr<Global> global) : global(global) {}
+
+size_t EvaVerifier::verify(CodeObject *co, size_t entryDepth) {
+  co_ = co;
+  auto &code = co->code;
+
+  require(!code.empty(), 0, "no code");
+
+  worklist_.clear();
+  depths_.assign(code.size(), NOT_AN_INSTRUCTION);
+  for (size_t offset = 0; offset < code.size();
+       offset += instructionSize(&code[offset])) {
+    auto wide = code[offset] == static_cast<uint8_t>(OpCode::WIDE);
+    require(!wide || offset + 1 < code.size(), offset, "truncated WIDE");
+    require(offset + instructionSize(&code[offset]) <= code.size(), offset,
+            "truncated instruction");
+    depths_[offset] = UNREACHED;
+  }
+
+  auto maxDepth = entryDepth;
+  flowTo(0, entryDepth);
+
+  while (!worklist_.empty()) {
+    auto offset = worklist_.back();
+    worklist_.pop_back();
+
+    auto depth = verifyInstruction(offset, depths_[offset]);
+    maxDepth = std::max(maxDepth, depth);
+  }
+
+  return maxDepth;
+}
+
+size_t EvaVerifier::verifyInstruction(size_t offset, size_t depth) {
+  auto &code = co_->code;
+  auto wide = code[offset] == static_cast<uint8_t>(OpCode::WIDE);
+  auto opcode = static_cast<OpCode>(code[offset + wide]);
+  auto operands = &code[offset + wide + 1];
+  auto next = offset + instructionSize(&code[offset]);
+
+  auto name = opcodeToString(static_cast<uint8_t>(opcode));
+  auto pops = [&](size_t count) {
+    require(depth >= count, offset, name + " underflows the stack");
+  };
+  auto index = [&](size_t limit, const std::string &what) {
+    auto value = readIndexOperand(operands, wide);
+    require(value < limit, offset,
+            name + " refers to " + what + " " + std::to_string(value) +
+                " of " + std::to_string(limit));
+    return value;
+  };
+
+  require(!wide || hasWideForm(opcode), offset, "no WIDE form of " + name);
+
+  auto after = depth;
+
+  switch (opcode) {
+  case OpCode::HALT:
+  case OpCode::RETURN:
+    require(depth == 1, offset,
+            name + " leaves " + std::to_string(depth) +
+                " values on the frame instead of its result");
+    return depth;
+
+  case OpCode::CONST:
+    index(co_->constants.size(), "constant");
+    after = depth + 1;
+    break;
+
+  case OpCode::ADD:
+  case OpCode::ADD_NUM:
+  case OpCode::ADD_STR:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::DIV:
+    pops(2);
+    after = depth - 1;
+    break;
+
+  case OpCode::COMPARE:
+  case OpCode::COMPARE_NUM_LT:
+  case OpCode::COMPARE_NUM_GT:
+  case OpCode::COMPARE_NUM_EQ:
+  case OpCode::COMPARE_NUM_GE:
+  case OpCode::COMPARE_NUM_LE:
+  case OpCode::COMPARE_NUM_NE:
+    require(operands[0] < 6, offset, "unknown COMPARE operator");
+    pops(2);
+    after = depth - 1;
+    break;
+
+  case OpCode::JMP:
+    flowTo(jumpTarget(&code[0], offset), depth);
+    return depth;
+
+  case OpCode::JMP_IF_FALSE:
+    pops(1);
+    after = depth - 1;
+    flowTo(jumpTarget(&code[0], offset), after);
+    break;
+
+  case OpCode::JLT:
+  case OpCode::JGT:
+  case OpCode::JEQ:
+  case OpCode::JGE:
+  case OpCode::JLE:
+  case OpCode::JNE:
+  case OpCode::JLT_NUM:
+  case OpCode::JGT_NUM:
+  case OpCode::JEQ_NUM:
+  case OpCode::JGE_NUM:
+  case OpCode::JLE_NUM:
+  case OpCode::JNE_NUM:
+    pops(2);
+    after = depth - 2;
+    flowTo(jumpTarget(&code[0], offset), after);
+    break;
+
+  case OpCode::FOR_PREP:
+  case OpCode::FOR_LOOP:
+  case OpCode::FOR_EACH_PREP:
+  case OpCode::FOR_EACH_LOOP:
+    // The three loop slots are frame locals
+    pops(3);
+    index(depth - 2, "loop slot");
+    flowTo(jumpTarget(&code[0], offset), depth);
+    break;
+
+  case OpCode::GET_GLOBAL:
+    index(global->globals.size(), "global");
+    after = depth + 1;
+    break;
+
+  case OpCode::SET_GLOBAL:
+    index(global->globals.size(), "global");
+    pops(1);
+    break;
+
+  case OpCode::POP:
+    pops(1);
+    after = depth - 1;
+    break;
+
+  case OpCode::GET_LOCAL:
+    index(depth, "local");
+    after = depth + 1;
+    break;
+
+  case OpCode::SET_LOCAL:
+    index(depth, "local");
+    pops(1);
+    break;
+
+  case OpCode::SCOPE_EXIT:
+  case OpCode::MAKE_FUNCTION: {
+    auto count = readIndexOperand(operands, wide);
+    pops(count + 1);
+    after = depth - count;
+    break;
+  }
+
+  case OpCode::MAKE_ARRAY: {
+    auto count = readIndexOperand(operands, wide);
+    pops(count);
+    after = depth - count + 1;
+    break;
+  }
+
+  case OpCode::MAKE_OBJECT: {
+    auto count = co_->shapes[index(co_->shapes.size(), "shape")]->names.size();
+    pops(count);
+    after = depth - count + 1;
+    break;
+  }
+
+  case OpCode::GET_PROP:
+    index(co_->propertyCaches.size(), "property cache");
+    pops(1);
+    break;
+
+  case OpCode::SET_PROP:
+    index(co_->propertyCaches.size(), "property cache");
+    pops(2);
+    after = depth - 1;
+    break;
+
+  case OpCode::GET_INDEX:
+  case OpCode::RESUME:
+    pops(2);
+    after = depth - 1;
+    break;
+
+  case OpCode::SET_INDEX:
+    pops(3);
+    after = depth - 2;
+    break;
+
+  case OpCode::LENGTH:
+  case OpCode::YIELD:
+    pops(1);
+    break;
+
+  case OpCode::CALL:
+  case OpCode::TAIL_CALL: {
+    auto argsCount = operands[0];
+    auto siteIndex = operands[1];
+    require(siteIndex == NO_CALL_SITE_CACHE ||
+                siteIndex < co_->callSiteCaches.size(),
+            offset, name + " refers to a missing call site");
+    pops(argsCount + 1);
+
+    // A tail call of a function returns from this frame, but one of a
+    // native goes on like a call, with the result in the callee slot
+    after = depth - argsCount;
+    break;
+  }
+
+  case OpCode::GET_CELL:
+  case OpCode::LOAD_CELL:
+    index(co_->cellNames.size(), "cell");
+    after = depth + 1;
+    break;
+
+  case OpCode::SET_CELL:
+    index(co_->cellNames.size(), "cell");
+    pops(1);
+    break;
+
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::SUB_LOCAL_CONST: {
+    index(depth, "local");
+    auto constIndex = readIndexOperand(operands + (wide ? 2 : 1), wide);
+    require(constIndex < co_->constants.size(), offset,
+            name + " refers to a missing constant");
+    after = depth + 1;
+    break;
+  }
+
+  default:
+    require(false, offset, "unknown opcode " + name);
+  }
+
+  require(next < code.size(), offset, "execution falls off the end");
+  flowTo(next, after);
+  return std::max(depth, after);
+}
+
+void EvaVerifier::flowTo(size_t target, size_t depth) {
+  require(target < depths_.size() && depths_[target] != NOT_AN_INSTRUCTION,
+          target, "jump target is no instruction");
+
+  if (depths_[target] == UNREACHED) {
+    depths_[target] = depth;
+    worklist_.push_back(target);
+    return;
+  }
+
+  require(depths_[target] == (int64_t)depth, target,
+          "stack depth " + std::to_string(depth) + " on one path and " +
+              std::to_string(depths_[target]) + " on another");
+}
+
+void EvaVerifier::require(bool condition, size_t offset,
+                          const std::string &message) {
+  if (!condition) {
+    DIE << "[EvaVerifier]: " << co_->name << " at " << offset << ": "
+        << message << ".";
+  }
+}
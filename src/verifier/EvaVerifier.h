@@ -0,0 +1,55 @@
+#ifndef __EvaVerifier_h
+#define __EvaVerifier_h
+
+#include "../vm/EvaValue.h"
+#include "../vm/Global.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Static checks of stack tier byte code, run before a CodeObject is first
+ * executed. Verified code only addresses existing constants, globals,
+ * cells, call sites, shapes and property caches, jumps to instruction
+ * boundaries, never reads below its frame or past its stack top, and
+ * returns with exactly its result left in the callee slot. The interpreter relies on that and
+ * runs without per-instruction checks.
+ */
+class EvaVerifier {
+public:
+  EvaVerifier(std::shared_ptr<Global> global);
+
+  /**
+   * Verifies `co`, whose frame holds `entryDepth` values on entry (the
+   * callee and its arguments, none for main), and returns the largest
+   * depth the frame reaches. Dies on invalid code.
+   */
+  size_t verify(CodeObject *co, size_t entryDepth);
+
+private:
+  std::shared_ptr<Global> global;
+
+  /**
+   * Checks the instruction at `offset` entered with `depth` values on
+   * the frame; returns the depth after it.
+   */
+  size_t verifyInstruction(size_t offset, size_t depth);
+
+  /**
+   * Records `depth` on entry of the instruction at `target`, which must
+   * agree with the depth of every other path reaching it.
+   */
+  void flowTo(size_t target, size_t depth);
+
+  void require(bool condition, size_t offset, const std::string &message);
+
+  CodeObject *co_;
+
+  // Stack depth on entry of each reached instruction, by offset
+  std::vector<int64_t> depths_;
+
+  std::vector<size_t> worklist_;
+};
+
+#endif // !__EvaVerifier_h
@@ -0,0 +1,325 @@
+#include "ArrayKernels.h"
+#include <cstddef>
+
+#ifdef EVA_SIMD
+
+#include <immintrin.h>
+
+#define EVA_TARGET_AVX2 __attribute__((target("avx2")))
+
+static bool hasAvx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+// AVX2: four lanes per vector, two vectors per iteration for reductions
+
+EVA_TARGET_AVX2 static double horizontalSum(__m256d v) {
+  auto pair =
+      _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+EVA_TARGET_AVX2 static double sumAvx2(const double *x, size_t count) {
+  auto acc0 = _mm256_setzero_pd();
+  auto acc1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+    acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(x + i + 4));
+  }
+  auto sum = horizontalSum(_mm256_add_pd(acc0, acc1));
+  for (; i < count; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+EVA_TARGET_AVX2 static double dotAvx2(const double *x, const double *y,
+                                      size_t count) {
+  auto acc0 = _mm256_setzero_pd();
+  auto acc1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    acc0 = _mm256_add_pd(
+        acc0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4),
+                                             _mm256_loadu_pd(y + i + 4)));
+  }
+  auto sum = horizontalSum(_mm256_add_pd(acc0, acc1));
+  for (; i < count; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+EVA_TARGET_AVX2 static double minAvx2(const double *x, size_t count) {
+  auto result = x[0];
+  size_t i = 0;
+  if (count >= 4) {
+    auto acc = _mm256_loadu_pd(x);
+    for (i = 4; i + 4 <= count; i += 4) {
+      acc = _mm256_min_pd(acc, _mm256_loadu_pd(x + i));
+    }
+    auto pair = _mm_min_pd(_mm256_castpd256_pd128(acc),
+                           _mm256_extractf128_pd(acc, 1));
+    result = _mm_cvtsd_f64(_mm_min_sd(pair, _mm_unpackhi_pd(pair, pair)));
+  }
+  for (; i < count; i++) {
+    result = x[i] < result ? x[i] : result;
+  }
+  return result;
+}
+
+EVA_TARGET_AVX2 static double maxAvx2(const double *x, size_t count) {
+  auto result = x[0];
+  size_t i = 0;
+  if (count >= 4) {
+    auto acc = _mm256_loadu_pd(x);
+    for (i = 4; i + 4 <= count; i += 4) {
+      acc = _mm256_max_pd(acc, _mm256_loadu_pd(x + i));
+    }
+    auto pair = _mm_max_pd(_mm256_castpd256_pd128(acc),
+                           _mm256_extractf128_pd(acc, 1));
+    result = _mm_cvtsd_f64(_mm_max_sd(pair, _mm_unpackhi_pd(pair, pair)));
+  }
+  for (; i < count; i++) {
+    result = x[i] > result ? x[i] : result;
+  }
+  return result;
+}
+
+EVA_TARGET_AVX2 static void addAvx2(const double *x, const double *y,
+                                    double *out, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(x + i),
+                                            _mm256_loadu_pd(y + i)));
+  }
+  for (; i < count; i++) {
+    out[i] = x[i] + y[i];
+  }
+}
+
+EVA_TARGET_AVX2 static void addScalarAvx2(const double *x, double k,
+                                          double *out, size_t count) {
+  auto vk = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(x + i), vk));
+  }
+  for (; i < count; i++) {
+    out[i] = x[i] + k;
+  }
+}
+
+EVA_TARGET_AVX2 static void scaleAvx2(const double *x, double k, double *out,
+                                      size_t count) {
+  auto vk = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), vk));
+  }
+  for (; i < count; i++) {
+    out[i] = x[i] * k;
+  }
+}
+
+// SSE2: two lanes per vector
+
+static double horizontalSum(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static double sumSse2(const double *x, size_t count) {
+  auto acc0 = _mm_setzero_pd();
+  auto acc1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    acc0 = _mm_add_pd(acc0, _mm_loadu_pd(x + i));
+    acc1 = _mm_add_pd(acc1, _mm_loadu_pd(x + i + 2));
+  }
+  auto sum = horizontalSum(_mm_add_pd(acc0, acc1));
+  for (; i < count; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+static double dotSse2(const double *x, const double *y, size_t count) {
+  auto acc0 = _mm_setzero_pd();
+  auto acc1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(x + i),
+                                       _mm_loadu_pd(y + i)));
+    acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(x + i + 2),
+                                       _mm_loadu_pd(y + i + 2)));
+  }
+  auto sum = horizontalSum(_mm_add_pd(acc0, acc1));
+  for (; i < count; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+static double minSse2(const double *x, size_t count) {
+  auto result = x[0];
+  size_t i = 0;
+  if (count >= 2) {
+    auto acc = _mm_loadu_pd(x);
+    for (i = 2; i + 2 <= count; i += 2) {
+      acc = _mm_min_pd(acc, _mm_loadu_pd(x + i));
+    }
+    result = _mm_cvtsd_f64(_mm_min_sd(acc, _mm_unpackhi_pd(acc, acc)));
+  }
+  for (; i < count; i++) {
+    result = x[i] < result ? x[i] : result;
+  }
+  return result;
+}
+
+static double maxSse2(const double *x, size_t count) {
+  auto result = x[0];
+  size_t i = 0;
+  if (count >= 2) {
+    auto acc = _mm_loadu_pd(x);
+    for (i = 2; i + 2 <= count; i += 2) {
+      acc = _mm_max_pd(acc, _mm_loadu_pd(x + i));
+    }
+    result = _mm_cvtsd_f64(_mm_max_sd(acc, _mm_unpackhi_pd(acc, acc)));
+  }
+  for (; i < count; i++) {
+    result = x[i] > result ? x[i] : result;
+  }
+  return result;
+}
+
+static void addSse2(const double *x, const double *y, double *out,
+                    size_t count) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i,
+                  _mm_add_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+  }
+  for (; i < count; i++) {
+    out[i] = x[i] + y[i];
+  }
+}
+
+static void addScalarSse2(const double *x, double k, double *out,
+                          size_t count) {
+  auto vk = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(x + i), vk));
+  }
+  for (; i < count; i++) {
+    out[i] = x[i] + k;
+  }
+}
+
+static void scaleSse2(const double *x, double k, double *out, size_t count) {
+  auto vk = _mm_set1_pd(k);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), vk));
+  }
+  for (; i < count; i++) {
+    out[i] = x[i] * k;
+  }
+}
+
+double sumDoubles(const double *x, size_t count) {
+  return hasAvx2() ? sumAvx2(x, count) : sumSse2(x, count);
+}
+
+double dotDoubles(const double *x, const double *y, size_t count) {
+  return hasAvx2() ? dotAvx2(x, y, count) : dotSse2(x, y, count);
+}
+
+double minDouble(const double *x, size_t count) {
+  return hasAvx2() ? minAvx2(x, count) : minSse2(x, count);
+}
+
+double maxDouble(const double *x, size_t count) {
+  return hasAvx2() ? maxAvx2(x, count) : maxSse2(x, count);
+}
+
+void addDoubles(const double *x, const double *y, double *out, size_t count) {
+  if (hasAvx2()) {
+    addAvx2(x, y, out, count);
+  } else {
+    addSse2(x, y, out, count);
+  }
+}
+
+void addScalar(const double *x, double k, double *out, size_t count) {
+  if (hasAvx2()) {
+    addScalarAvx2(x, k, out, count);
+  } else {
+    addScalarSse2(x, k, out, count);
+  }
+}
+
+void scaleDoubles(const double *x, double k, double *out, size_t count) {
+  if (hasAvx2()) {
+    scaleAvx2(x, k, out, count);
+  } else {
+    scaleSse2(x, k, out, count);
+  }
+}
+
+#else
+
+double sumDoubles(const double *x, size_t count) {
+  double sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+double dotDoubles(const double *x, const double *y, size_t count) {
+  double sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+double minDouble(const double *x, size_t count) {
+  auto result = x[0];
+  for (size_t i = 1; i < count; i++) {
+    result = x[i] < result ? x[i] : result;
+  }
+  return result;
+}
+
+double maxDouble(const double *x, size_t count) {
+  auto result = x[0];
+  for (size_t i = 1; i < count; i++) {
+    result = x[i] > result ? x[i] : result;
+  }
+  return result;
+}
+
+void addDoubles(const double *x, const double *y, double *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = x[i] + y[i];
+  }
+}
+
+void addScalar(const double *x, double k, double *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = x[i] + k;
+  }
+}
+
+void scaleDoubles(const double *x, double k, double *out, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = x[i] * k;
+  }
+}
+
+#endif // EVA_SIMD
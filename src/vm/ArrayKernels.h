@@ -0,0 +1,35 @@
+#ifndef __ArrayKernels_h
+#define __ArrayKernels_h
+
+#include <cstddef>
+
+/**
+ * Bulk kernels over the unboxed elements of numeric arrays, behind the
+ * array natives. EVA_SIMD builds vectorize them with AVX2 when the CPU
+ * has it and with SSE2, which every x86-64 CPU has, otherwise; the
+ * vectorized sums add in a different order than a plain loop.
+ */
+double sumDoubles(const double *x, size_t count);
+
+double dotDoubles(const double *x, const double *y, size_t count);
+
+double minDouble(const double *x, size_t count);
+
+double maxDouble(const double *x, size_t count);
+
+/**
+ * out[i] = x[i] + y[i]
+ */
+void addDoubles(const double *x, const double *y, double *out, size_t count);
+
+/**
+ * out[i] = x[i] + k
+ */
+void addScalar(const double *x, double k, double *out, size_t count);
+
+/**
+ * out[i] = x[i] * k
+ */
+void scaleDoubles(const double *x, double k, double *out, size_t count);
+
+#endif // !__ArrayKernels_h
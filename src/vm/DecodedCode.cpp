@@ -0,0 +1,100 @@
+#include "DecodedCode.h"
+#include "../bytecode/OpCode.h"
+#include <cstdint>
+#include <limits>
+
+static constexpr uint32_t NO_RECORD = std::numeric_limits<uint32_t>::max();
+
+std::unique_ptr<DecodedCode> decodeCode(CodeObject *co, Global &global,
+                                        void *const *handlers) {
+  auto decoded = std::make_unique<DecodedCode>();
+  auto &code = co->code;
+
+  // First pass numbers the instructions, so that jumps can then point at
+  // records that are already in place
+  decoded->records.assign(code.size(), NO_RECORD);
+  size_t count = 0;
+  for (size_t offset = 0; offset < code.size();
+       offset += instructionSize(&code[offset])) {
+    decoded->records[offset] = count++;
+  }
+  decoded->instructions.resize(count);
+
+  auto record = decoded->instructions.begin();
+  for (size_t offset = 0; offset < code.size();
+       offset += instructionSize(&code[offset]), ++record) {
+    auto wide = code[offset] == static_cast<uint8_t>(OpCode::WIDE);
+    auto opcode = code[offset + wide];
+    auto operands = &code[offset + wide + 1];
+
+    record->handler = handlers[opcode];
+    record->offset = offset;
+    record->operand = 0;
+    record->opcode = opcode;
+    record->wide = wide;
+    record->constant = nullptr;
+
+    if (isJumpOpcode(opcode)) {
+      auto target = jumpTarget(&code[0], offset);
+      record->target = decoded->at(target);
+      if (isForLoopOpcode(opcode)) {
+        record->operand = readIndexOperand(operands, wide);
+      }
+      continue;
+    }
+
+    switch (static_cast<OpCode>(opcode)) {
+    case OpCode::CONST:
+      record->constant = &co->constants[readIndexOperand(operands, wide)];
+      break;
+    case OpCode::GET_GLOBAL:
+    case OpCode::SET_GLOBAL:
+      record->global = &global.get(readIndexOperand(operands, wide));
+      break;
+    case OpCode::GET_LOCAL:
+    case OpCode::SET_LOCAL:
+    case OpCode::SCOPE_EXIT:
+    case OpCode::GET_CELL:
+    case OpCode::SET_CELL:
+    case OpCode::LOAD_CELL:
+    case OpCode::MAKE_FUNCTION:
+    case OpCode::MAKE_ARRAY:
+      record->operand = readIndexOperand(operands, wide);
+      break;
+    case OpCode::COMPARE:
+    case OpCode::COMPARE_NUM_LT:
+    case OpCode::COMPARE_NUM_GT:
+    case OpCode::COMPARE_NUM_EQ:
+    case OpCode::COMPARE_NUM_GE:
+    case OpCode::COMPARE_NUM_LE:
+    case OpCode::COMPARE_NUM_NE:
+      record->operand = operands[0];
+      break;
+    case OpCode::CALL:
+    case OpCode::TAIL_CALL:
+      record->operand = operands[0];
+      if (operands[1] != NO_CALL_SITE_CACHE) {
+        record->site = &co->callSiteCaches[operands[1]];
+      }
+      break;
+    case OpCode::MAKE_OBJECT:
+      record->shape = co->shapes[readIndexOperand(operands, wide)];
+      break;
+    case OpCode::GET_PROP:
+    case OpCode::SET_PROP:
+      record->property =
+          &co->propertyCaches[readIndexOperand(operands, wide)];
+      break;
+    case OpCode::ADD_LOCAL_CONST:
+    case OpCode::SUB_LOCAL_CONST:
+      record->operand = readIndexOperand(operands, wide);
+      record->constant =
+          &co->constants[readIndexOperand(operands + (wide ? 2 : 1), wide)];
+      break;
+    default:
+      break;
+    }
+  }
+
+  return decoded;
+}
@@ -0,0 +1,62 @@
+#ifndef __DecodedCode_h
+#define __DecodedCode_h
+
+#include "EvaValue.h"
+#include "Global.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Fixed-width record of one stack tier instruction, its operands resolved
+ * ahead of time: constants, globals, call sites, shapes and property
+ * caches become pointers, jumps
+ * point at their target record, and WIDE prefixes are folded away.
+ */
+struct Instruction {
+  // Handler label of `opcode` in EvaVm::eval (EVA_COMPUTED_GOTO builds)
+  void *handler;
+
+  union {
+    EvaValue *constant;
+    GlobalVar *global;
+    Instruction *target;
+    CallSiteCache *site;
+    Shape *shape;
+    PropertyCache *property;
+  };
+
+  // Start of the instruction in CodeObject::code
+  uint32_t offset;
+
+  // Local, cell or count operand, argument count of a CALL, or the
+  // COMPARE operator
+  uint16_t operand;
+
+  uint8_t opcode;
+
+  bool wide;
+};
+
+/**
+ * Pre-decoded form of a CodeObject, the one EvaVm::eval runs. The byte
+ * code stays canonical for the disassembler and the JIT; quickening is
+ * mirrored into both forms.
+ */
+struct DecodedCode {
+  std::vector<Instruction> instructions;
+
+  // Record index of the instruction starting at each bytecode offset
+  std::vector<uint32_t> records;
+
+  Instruction *at(size_t offset) { return &instructions[records[offset]]; }
+};
+
+/**
+ * Decodes `co`. `handlers` maps opcodes to the labels of eval(), and holds
+ * null entries in switch dispatch builds.
+ */
+std::unique_ptr<DecodedCode> decodeCode(CodeObject *co, Global &global,
+                                        void *const *handlers);
+
+#endif // !__DecodedCode_h
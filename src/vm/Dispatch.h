@@ -0,0 +1,33 @@
+#ifndef __Dispatch_h
+#define __Dispatch_h
+
+/**
+ * Instruction dispatch. With EVA_COMPUTED_GOTO (GCC/Clang labels-as-values)
+ * every handler ends in its own indirect jump through the dispatch table,
+ * otherwise the portable switch inside for (;;) is used.
+ *
+ * The including translation unit defines DISPATCH_OPCODE, the opcode enum
+ * its interpreter loop handles, and how to advance to the next
+ * instruction: DISPATCH_FETCH() yields its opcode and, with
+ * EVA_COMPUTED_GOTO, DISPATCH_TARGET() its handler address.
+ */
+#if defined(EVA_COMPUTED_GOTO) && !defined(__GNUC__)
+#undef EVA_COMPUTED_GOTO
+#endif
+
+#ifdef EVA_COMPUTED_GOTO
+#define DISPATCH_SWITCH DISPATCH();
+#define OP_CASE(name) op_##name
+#define OP_DEFAULT op_UNKNOWN
+#define DISPATCH() goto *DISPATCH_TARGET()
+#define DISPATCH_LABEL(name)                                                   \
+  dispatchTable[static_cast<uint8_t>(DISPATCH_OPCODE::name)] = &&op_##name
+#else
+#define DISPATCH_SWITCH                                                        \
+  switch (static_cast<DISPATCH_OPCODE>(DISPATCH_FETCH()))
+#define OP_CASE(name) case DISPATCH_OPCODE::name
+#define OP_DEFAULT default
+#define DISPATCH() break
+#endif
+
+#endif // !__Dispatch_h
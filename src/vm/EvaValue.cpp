@@ -1,6 +1,9 @@
 #include "EvaValue.h"
 #include "../Logger.h"
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include <new>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -8,6 +11,7 @@
 void *Traceable::operator new(size_t size) {
   void *object = ::operator new(size);
   ((Traceable *)object)->size = size;
+  ((Traceable *)object)->marked = false;
   Traceable::objects.push_back((Traceable *)object);
   Traceable::bytesAllocated += size;
   return object;
@@ -19,11 +23,51 @@ void Traceable::operator delete(void *object) {
   ::operator delete(object, sz);
 }
 
+void Traceable::destroy(Traceable *object) {
+  switch (((Object *)object)->type) {
+  case ObjectType::STRING:
+    delete (StringObject *)object;
+    break;
+  case ObjectType::CODE:
+    delete (CodeObject *)object;
+    break;
+  case ObjectType::NATIVE:
+    delete (NativeObject *)object;
+    break;
+  case ObjectType::FUNCTION:
+    delete (FunctionObject *)object;
+    break;
+  case ObjectType::CELL:
+    delete (CellObject *)object;
+    break;
+  case ObjectType::CELL_BLOCK:
+    delete (CellBlockObject *)object;
+    break;
+  case ObjectType::ARRAY:
+    delete (ArrayObject *)object;
+    break;
+  case ObjectType::MAP:
+    delete (MapObject *)object;
+    break;
+  case ObjectType::RECORD:
+    delete (RecordObject *)object;
+    break;
+  case ObjectType::WEAK_REF:
+    delete (WeakRefObject *)object;
+    break;
+  case ObjectType::COROUTINE:
+    delete (CoroutineObject *)object;
+    break;
+  }
+}
+
 void Traceable::cleanup() {
   for (auto object : objects) {
-    delete object;
+    destroy(object);
   }
   objects.clear();
+  StringObject::strings.clear();
+  Shape::root.clearTransitions();
 }
 
 void Traceable::printStats() {
@@ -41,15 +85,21 @@ std::list<Traceable *> Traceable::objects{};
 
 Object::Object(ObjectType type) : type(type) {}
 
-using NativeFn = std::function<void()>;
-
 NativeObject::NativeObject(NativeFn function, const std::string &name,
                            size_t arity)
     : Object(ObjectType::NATIVE), function(function), name(name), arity(arity) {
 }
 
-StringObject::StringObject(const std::string &str)
-    : Object(ObjectType::STRING), string(str) {}
+StringObject::StringObject(size_t length, size_t hash)
+    : Object(ObjectType::STRING), length(length), hash(hash), left(nullptr),
+      right(nullptr), depth(0), interned(this) {}
+
+StringObject::StringObject(StringObject *left, StringObject *right)
+    : Object(ObjectType::STRING), length(left->length + right->length),
+      hash(0), left(left), right(right),
+      depth(std::max(left->depth, right->depth) + 1), interned(nullptr) {}
+
+StringTable StringObject::strings{};
 
 CodeObject::CodeObject(const std::string &name, size_t arity)
     : Object(ObjectType::CODE), name(name), arity(arity) {}
@@ -82,12 +132,208 @@ int CodeObject::getCellIndex(const std::string &name) {
   return -1;
 }
 
-CellObject::CellObject(EvaValue value)
-    : Object(ObjectType::CELL), value(value) {}
+CellObject::CellObject(EvaValue value, CellBlockObject *block)
+    : Object(ObjectType::CELL), value(value), block(block) {}
+
+CellBlockObject::CellBlockObject(size_t count)
+    : Object(ObjectType::CELL_BLOCK), count(count) {
+  for (size_t i = 0; i < count; i++) {
+    // Embedded cells are no heap objects of their own
+    auto cell = ::new (&cells()[i]) CellObject(makeBoolean(false), this);
+    cell->marked = false;
+    cell->size = 0;
+  }
+}
 
 FunctionObject::FunctionObject(CodeObject *co)
     : Object(ObjectType::FUNCTION), co(co) {}
 
+ArrayObject::ArrayObject(std::vector<double> numbers)
+    : Object(ObjectType::ARRAY), isNumeric(true), numbers(std::move(numbers)) {
+}
+
+ArrayObject::ArrayObject(std::vector<EvaValue> values)
+    : Object(ObjectType::ARRAY), isNumeric(false), values(std::move(values)) {}
+
+EvaValue ArrayObject::get(size_t index) const {
+  if (!isNumeric) {
+    return values[index];
+  }
+
+  // Integral numbers come back as small integers, the way they were most
+  // likely stored; only -0 and a number outside 32 bits stay doubles
+  auto number = numbers[index];
+  if (number >= INT32_MIN && number <= INT32_MAX &&
+      number == static_cast<int32_t>(number) &&
+      !(number == 0 && __builtin_signbit(number))) {
+    return makeInteger(static_cast<int32_t>(number));
+  }
+  return makeNumber(number);
+}
+
+void ArrayObject::set(size_t index, const EvaValue &value) {
+  if (isNumeric && isNumber(value)) {
+    numbers[index] = asNumber(value);
+    return;
+  }
+
+  if (isNumeric) {
+    values.reserve(numbers.size());
+    for (size_t i = 0; i < numbers.size(); ++i) {
+      values.push_back(get(i));
+    }
+    numbers = {};
+    isNumeric = false;
+  }
+  values[index] = value;
+}
+
+RecordObject::RecordObject(Shape *shape, std::vector<EvaValue> slots)
+    : Object(ObjectType::RECORD), shape(shape), slots(std::move(slots)) {}
+
+CoroutineObject::CoroutineObject(FunctionObject *fn)
+    : Object(ObjectType::COROUTINE), fn(fn) {}
+
+/**
+ * Hash of a map key, never EMPTY or TOMBSTONE. Numbers hash by value, so
+ * an integer finds the entry of the equal double.
+ */
+static uint32_t keyHash(const EvaValue &key) {
+  uint64_t bits = 0;
+  if (isNumber(key)) {
+    auto number = asNumber(key);
+    if (number != number) {
+      DIE << "map: NaN is not a valid key.";
+    }
+    // -0 == 0
+    number = number == 0 ? 0 : number;
+    std::memcpy(&bits, &number, sizeof(bits));
+  } else if (isBoolean(key)) {
+    bits = asBoolean(key) ? 1 : 2;
+  } else if (isString(key)) {
+    bits = internedString(key)->hash;
+  } else if (isObject(key)) {
+    // Objects never move
+    bits = (uint64_t)(uintptr_t)asObject(key);
+  } else {
+    DIE << "map: " << evaValueToTypeString(key) << " is not a valid key.";
+  }
+
+  // Fold the high bits into the low ones the table is indexed by
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccd;
+  bits ^= bits >> 33;
+  auto hash = (uint32_t)bits;
+  return hash <= MapObject::TOMBSTONE ? hash + 2 : hash;
+}
+
+static bool sameKey(const EvaValue &a, const EvaValue &b) {
+  if (isNumber(a) && isNumber(b)) {
+    return asNumber(a) == asNumber(b);
+  }
+  if (isBoolean(a) && isBoolean(b)) {
+    return asBoolean(a) == asBoolean(b);
+  }
+  if (isString(a) && isString(b)) {
+    return internedString(a) == internedString(b);
+  }
+  return isObject(a) && isObject(b) && asObject(a) == asObject(b);
+}
+
+MapObject::MapObject(bool weakKeys)
+    : Object(ObjectType::MAP), count(0), used(0), weakKeys(weakKeys) {}
+
+WeakRefObject::WeakRefObject(const EvaValue &target)
+    : Object(ObjectType::WEAK_REF), target(target) {}
+
+MapObject::Entry *MapObject::probe(const EvaValue &key, uint32_t hash) {
+  // The table is never full, so the probe ends on an empty entry at worst;
+  // a new key reuses the first tombstone passed on the way
+  auto mask = entries.size() - 1;
+  Entry *tombstone = nullptr;
+  for (auto i = hash & mask;; i = (i + 1) & mask) {
+    auto &entry = entries[i];
+    if (entry.hash == EMPTY) {
+      return tombstone != nullptr ? tombstone : &entry;
+    }
+    if (entry.hash == TOMBSTONE) {
+      tombstone = tombstone != nullptr ? tombstone : &entry;
+    } else if (entry.hash == hash && sameKey(entry.key, key)) {
+      return &entry;
+    }
+  }
+}
+
+EvaValue *MapObject::find(const EvaValue &key) {
+  auto hash = keyHash(key);
+  if (count == 0) {
+    return nullptr;
+  }
+  auto entry = probe(key, hash);
+  return entry->hash == hash ? &entry->value : nullptr;
+}
+
+void MapObject::set(const EvaValue &key, const EvaValue &value) {
+  auto hash = keyHash(key);
+
+  // At most 3/4 of the entries are in use, tombstones included
+  if ((used + 1) * 4 > entries.size() * 3) {
+    size_t capacity = 8;
+    while (capacity < (count + 1) * 2) {
+      capacity *= 2;
+    }
+    rehash(capacity);
+  }
+
+  auto entry = probe(key, hash);
+  if (entry->hash != hash) {
+    used += entry->hash == EMPTY ? 1 : 0;
+    count++;
+    entry->hash = hash;
+    // String keys are kept interned, which keeps the probes cheap
+    entry->key = isString(key) ? makeObject((Object *)internedString(key))
+                               : key;
+  }
+  entry->value = value;
+}
+
+bool MapObject::remove(const EvaValue &key) {
+  auto hash = keyHash(key);
+  if (count == 0) {
+    return false;
+  }
+  auto entry = probe(key, hash);
+  if (entry->hash != hash) {
+    return false;
+  }
+  entry->hash = TOMBSTONE;
+  count--;
+  return true;
+}
+
+void MapObject::removeEntry(Entry &entry) {
+  entry = Entry{TOMBSTONE, makeBoolean(false), makeBoolean(false)};
+  count--;
+}
+
+void MapObject::rehash(size_t capacity) {
+  std::vector<Entry> old(capacity, Entry{EMPTY, {}, {}});
+  entries.swap(old);
+  used = count;
+
+  auto mask = capacity - 1;
+  for (auto &entry : old) {
+    if (!entry.isLive()) {
+      continue;
+    }
+    auto i = entry.hash & mask;
+    while (entries[i].hash != EMPTY) {
+      i = (i + 1) & mask;
+    }
+    entries[i] = entry;
+  }
+}
+
 std::string evaValueToTypeString(const EvaValue &evaValue) {
   if (isNumber(evaValue)) {
     return "NUMBER";
@@ -103,21 +349,41 @@ std::string evaValueToTypeString(const EvaValue &evaValue) {
     return "FUNCTION";
   } else if (isCell(evaValue)) {
     return "CELL";
+  } else if (isCellBlock(evaValue)) {
+    return "CELL_BLOCK";
+  } else if (isArray(evaValue)) {
+    return "ARRAY";
+  } else if (isMap(evaValue)) {
+    return "MAP";
+  } else if (isRecord(evaValue)) {
+    return "RECORD";
+  } else if (isCoroutine(evaValue)) {
+    return "COROUTINE";
+  } else if (isWeakRef(evaValue)) {
+    return "WEAK_REF";
   } else {
-    DIE << "evaValueToTypeString: unknown type " << (int)evaValue.type;
+    DIE << "evaValueToTypeString: unknown type";
   }
   return "";
 }
 
+void operandTypeError(const char *op, const char *expected,
+                      const EvaValue &op1, const EvaValue &op2) {
+  DIE << op << ": " << evaValueToTypeString(op1) << " and "
+      << evaValueToTypeString(op2) << " are not " << expected << ".";
+}
+
 std::string evaValueToConstantString(const EvaValue &evaValue) {
   std::stringstream ss;
 
-  if (isNumber(evaValue)) {
+  if (isInteger(evaValue)) {
+    ss << asInteger(evaValue);
+  } else if (isNumber(evaValue)) {
     ss << asNumber(evaValue);
   } else if (isBoolean(evaValue)) {
     ss << (asBoolean(evaValue) ? "true" : "false");
   } else if (isString(evaValue)) {
-    ss << asCppString(evaValue);
+    ss << asStringView(evaValue);
   } else if (isCode(evaValue)) {
     auto code = asCode(evaValue);
     ss << "code" << code << ": " << code->name << "/" << code->arity;
@@ -130,8 +396,43 @@ std::string evaValueToConstantString(const EvaValue &evaValue) {
   } else if (isCell(evaValue)) {
     auto cell = asCell(evaValue);
     ss << "cell: " << evaValueToConstantString(cell->value);
+  } else if (isCellBlock(evaValue)) {
+    ss << "cells: " << asCellBlock(evaValue)->count;
+  } else if (isArray(evaValue)) {
+    auto array = asArray(evaValue);
+    ss << "[";
+    for (size_t i = 0; i < array->size(); i++) {
+      ss << (i == 0 ? "" : ", ") << evaValueToConstantString(array->get(i));
+    }
+    ss << "]";
+  } else if (isMap(evaValue)) {
+    auto first = true;
+    ss << "{";
+    for (auto &entry : asMap(evaValue)->entries) {
+      if (!entry.isLive()) {
+        continue;
+      }
+      ss << (first ? "" : ", ") << evaValueToConstantString(entry.key) << ": "
+         << evaValueToConstantString(entry.value);
+      first = false;
+    }
+    ss << "}";
+  } else if (isRecord(evaValue)) {
+    auto record = asRecord(evaValue);
+    ss << "(object";
+    for (size_t i = 0; i < record->slots.size(); i++) {
+      ss << " (" << record->shape->names[i]->view() << " "
+         << evaValueToConstantString(record->slots[i]) << ")";
+    }
+    ss << ")";
+  } else if (isWeakRef(evaValue)) {
+    ss << "weak: " << evaValueToConstantString(asWeakRef(evaValue)->target);
+  } else if (isCoroutine(evaValue)) {
+    auto co = asCoroutine(evaValue);
+    ss << "coroutine: " << co->fn->co->name << " "
+       << coroutineStatusString(co->status);
   } else {
-    DIE << "evaValueToConstantString: unknown type " << (int)evaValue.type;
+    DIE << "evaValueToConstantString: unknown type";
   }
   return ss.str();
 }
@@ -141,100 +442,270 @@ std::ostream &operator<<(std::ostream &os, const EvaValue &evaValue) {
             << "): " << evaValueToConstantString(evaValue);
 }
 
-EvaValue makeNumber(double value) {
-  return {.type = EvaValueType::NUMBER, .number = value};
+EvaValue allocString(std::string_view value) {
+  auto hash = std::hash<std::string_view>{}(value);
+  auto string = StringObject::strings.find(value, hash);
+  if (string == nullptr) {
+    auto memory = Traceable::operator new(sizeof(StringObject) + value.size());
+    string = ::new (memory) StringObject(value.size(), hash);
+    std::memcpy(string->chars(), value.data(), value.size());
+    StringObject::strings.add(string);
+  }
+  return makeObject((Object *)string);
 }
 
-EvaValue makeBoolean(bool value) {
-  return {.type = EvaValueType::BOOLEAN, .boolean = value};
-}
+// Shorter results are copied right away: a rope node costs more than the
+// characters, and short strings are the ones compared and used as keys
+static constexpr size_t ROPE_MIN_LENGTH = 32;
 
-EvaValue makeObject(Object *value) {
-  return {.type = EvaValueType::OBJECT, .object = value};
-}
+// Deeper operands are flattened first, which bounds the flattening work
+// of a loop of appends to a copy of the string every ROPE_MAX_DEPTH steps
+static constexpr size_t ROPE_MAX_DEPTH = 128;
 
-EvaValue allocString(std::string value) {
-  return {.type = EvaValueType::OBJECT,
-          .object = (Object *)new StringObject(value)};
+EvaValue concatStrings(const EvaValue &op1, const EvaValue &op2) {
+  auto left = asString(op1);
+  auto right = asString(op2);
+  if (left->length == 0) {
+    return op2;
+  }
+  if (right->length == 0) {
+    return op1;
+  }
+
+  if (left->length + right->length < ROPE_MIN_LENGTH) {
+    auto v1 = asStringView(op1);
+    auto v2 = asStringView(op2);
+    char buffer[ROPE_MIN_LENGTH];
+    std::memcpy(buffer, v1.data(), v1.size());
+    std::memcpy(buffer + v1.size(), v2.data(), v2.size());
+    return allocString(std::string_view(buffer, v1.size() + v2.size()));
+  }
+
+  for (auto half : {left, right}) {
+    if (half->depth >= ROPE_MAX_DEPTH) {
+      flattenString(half);
+    }
+  }
+  return makeObject((Object *)new StringObject(left, right));
+}
+
+StringObject *flattenString(StringObject *rope) {
+  std::string result;
+  result.reserve(rope->length);
+
+  // Left to right over the flat strings under the rope, without recursion
+  std::vector<StringObject *> pending{rope->right, rope->left};
+  while (!pending.empty()) {
+    auto string = pending.back();
+    pending.pop_back();
+    if (string->isRope()) {
+      pending.push_back(string->right);
+      pending.push_back(string->left);
+    } else {
+      result += string->interned->view();
+    }
+  }
+
+  rope->interned = asString(allocString(result));
+  rope->left = nullptr;
+  rope->right = nullptr;
+  rope->depth = 0;
+  return rope->interned;
 }
 
 EvaValue allocCode(const std::string &name, size_t arity) {
-  return {.type = EvaValueType::OBJECT,
-          .object = (Object *)new CodeObject(name, arity)};
+  return makeObject((Object *)new CodeObject(name, arity));
 }
 
 EvaValue allocNative(NativeFn fn, const std::string &name, size_t arity) {
-  return {.type = EvaValueType::OBJECT,
-          .object = (Object *)new NativeObject(fn, name, arity)};
+  return makeObject((Object *)new NativeObject(fn, name, arity));
 }
 
 EvaValue allocFunction(CodeObject *co) {
-  return {.type = EvaValueType::OBJECT,
-          .object = (Object *)new FunctionObject(co)};
+  return makeObject((Object *)new FunctionObject(co));
 }
 
-EvaValue allocCell(EvaValue co) {
-  return {.type = EvaValueType::OBJECT, .object = (Object *)new CellObject(co)};
+EvaValue allocCellBlock(size_t count) {
+  auto memory = Traceable::operator new(sizeof(CellBlockObject) +
+                                        count * sizeof(CellObject));
+  return makeObject((Object *)::new (memory) CellBlockObject(count));
 }
 
-EvaValue cell(CellObject *cellObject) {
-  return makeObject((Object *)cellObject);
+EvaValue allocArray(const EvaValue *elements, size_t count) {
+  auto isNumeric = std::all_of(elements, elements + count, isNumber);
+
+  if (!isNumeric) {
+    std::vector<EvaValue> values(elements, elements + count);
+    return makeObject((Object *)new ArrayObject(std::move(values)));
+  }
+
+  std::vector<double> numbers(count);
+  for (size_t i = 0; i < count; i++) {
+    numbers[i] = asNumber(elements[i]);
+  }
+  return allocArray(std::move(numbers));
 }
 
-double asNumber(const EvaValue &evaValue) { return evaValue.number; }
+EvaValue allocArray(std::vector<double> numbers) {
+  return makeObject((Object *)new ArrayObject(std::move(numbers)));
+}
 
-bool asBoolean(const EvaValue &evaValue) { return evaValue.boolean; }
+EvaValue allocMap(bool weakKeys) {
+  return makeObject((Object *)new MapObject(weakKeys));
+}
 
-StringObject *asString(const EvaValue &evaValue) {
-  return (StringObject *)evaValue.object;
+EvaValue allocWeakRef(const EvaValue &target) {
+  return makeObject((Object *)new WeakRefObject(target));
 }
 
-std::string asCppString(const EvaValue &evaValue) {
-  return asString(evaValue)->string;
+EvaValue allocRecord(Shape *shape, const EvaValue *values) {
+  std::vector<EvaValue> slots(values, values + shape->names.size());
+  return makeObject((Object *)new RecordObject(shape, std::move(slots)));
 }
 
-Object *asObject(const EvaValue &evaValue) { return evaValue.object; }
+EvaValue allocCoroutine(FunctionObject *fn) {
+  return makeObject((Object *)new CoroutineObject(fn));
+}
 
-CodeObject *asCode(const EvaValue &evaValue) {
-  return (CodeObject *)evaValue.object;
+const char *coroutineStatusString(CoroutineStatus status) {
+  switch (status) {
+  case CoroutineStatus::SUSPENDED:
+    return "suspended";
+  case CoroutineStatus::RUNNING:
+    return "running";
+  case CoroutineStatus::NORMAL:
+    return "normal";
+  case CoroutineStatus::DEAD:
+    return "dead";
+  }
+  return "";
 }
 
-NativeObject *asNative(const EvaValue &evaValue) {
-  return (NativeObject *)evaValue.object;
+static RecordObject *recordOf(const EvaValue &value, const char *form) {
+  if (!isRecord(value)) {
+    DIE << form << ": " << evaValueToTypeString(value) << " is not a record.";
+  }
+  return asRecord(value);
 }
 
-FunctionObject *asFunction(const EvaValue &evaValue) {
-  return (FunctionObject *)evaValue.object;
+static void addCacheEntry(PropertyCache &cache, Shape *shape,
+                          Shape *transition, size_t slot) {
+  if (cache.count < PropertyCache::SIZE) {
+    cache.entries[cache.count++] = {shape, transition, (uint32_t)slot};
+  }
 }
-CellObject *asCell(const EvaValue &evaValue) {
-  return (CellObject *)evaValue.object;
+
+EvaValue getPropertyMiss(const EvaValue &record, PropertyCache &cache) {
+  auto object = recordOf(record, "prop");
+  auto slot = object->shape->slotOf(cache.name);
+  if (slot == -1) {
+    DIE << "prop: the record has no property " << cache.name->view() << ".";
+  }
+  addCacheEntry(cache, object->shape, nullptr, slot);
+  return object->slots[slot];
 }
 
-bool isNumber(const EvaValue &evaValue) {
-  return evaValue.type == EvaValueType::NUMBER;
+void setPropertyMiss(const EvaValue &record, PropertyCache &cache,
+                     const EvaValue &value) {
+  auto object = recordOf(record, "set-prop");
+  auto shape = object->shape;
+  auto slot = shape->slotOf(cache.name);
+
+  if (slot != -1) {
+    addCacheEntry(cache, shape, nullptr, slot);
+    object->slots[slot] = value;
+    return;
+  }
+
+  // Caching the transition lets records built alike keep sharing shapes
+  object->shape = shape->withProperty(cache.name);
+  addCacheEntry(cache, shape, object->shape, object->slots.size());
+  object->slots.push_back(value);
 }
-bool isBoolean(const EvaValue &evaValue) {
-  return evaValue.type == EvaValueType::BOOLEAN;
+
+static size_t elementIndex(const EvaValue &array, const EvaValue &index) {
+  if (!isArray(array)) {
+    DIE << "index: " << evaValueToTypeString(array)
+        << " is not an array or a map.";
+  }
+
+  auto size = asArray(array)->size();
+  auto position = isNumber(index) ? asNumber(index) : -1;
+  if (!(position >= 0 && position < size) || position != (size_t)position) {
+    DIE << "index: " << evaValueToConstantString(index)
+        << " is out of bounds of an array of " << size << ".";
+  }
+  return (size_t)position;
 }
-bool isObject(const EvaValue &evaValue) {
-  return evaValue.type == EvaValueType::OBJECT;
+
+EvaValue getElement(const EvaValue &array, const EvaValue &index) {
+  if (isMap(array)) {
+    auto value = asMap(array)->find(index);
+    if (value == nullptr) {
+      DIE << "index: " << evaValueToConstantString(index)
+          << " is not a key of the map.";
+    }
+    return *value;
+  }
+  return asArray(array)->get(elementIndex(array, index));
 }
-bool isObjectType(const EvaValue &evaValue, ObjectType objectType) {
-  return isObject(evaValue) && asObject(evaValue)->type == objectType;
+
+void setElement(const EvaValue &array, const EvaValue &index,
+                const EvaValue &value) {
+  if (isMap(array)) {
+    asMap(array)->set(index, value);
+    return;
+  }
+  asArray(array)->set(elementIndex(array, index), value);
 }
 
-bool isString(const EvaValue &evaValue) {
-  return isObjectType(evaValue, ObjectType::STRING);
+EvaValue lengthOf(const EvaValue &value) {
+  if (isArray(value)) {
+    return makeInteger(asArray(value)->size());
+  }
+  if (isMap(value)) {
+    return makeInteger(asMap(value)->count);
+  }
+  if (isString(value)) {
+    return makeInteger(asString(value)->length);
+  }
+  DIE << "len: " << evaValueToTypeString(value) << " has no length.";
+  return makeInteger(0);
 }
-bool isCode(const EvaValue &evaValue) {
-  return isObjectType(evaValue, ObjectType::CODE);
+
+static bool forContinues(const EvaValue *slots) {
+  auto counter = asNumber(slots[0]);
+  auto limit = asNumber(slots[1]);
+  return asNumber(slots[2]) > 0 ? counter < limit : counter > limit;
 }
-bool isNative(const EvaValue &evaValue) {
-  return isObjectType(evaValue, ObjectType::NATIVE);
+
+bool forPrep(EvaValue *slots) {
+  static const char *names[] = {"counter", "limit", "step"};
+  for (auto i = 0; i < 3; i++) {
+    if (!isNumber(slots[i])) {
+      DIE << "for: the " << names[i] << " "
+          << evaValueToConstantString(slots[i]) << " is not a number.";
+    }
+  }
+  if (asNumber(slots[2]) == 0) {
+    DIE << "for: the step is zero.";
+  }
+  return forContinues(slots);
 }
-bool isFunction(const EvaValue &evaValue) {
-  return isObjectType(evaValue, ObjectType::FUNCTION);
+
+bool forLoopNumbers(EvaValue *slots) {
+  if (!isNumber(slots[0])) {
+    DIE << "for: the counter " << evaValueToConstantString(slots[0])
+        << " is not a number.";
+  }
+  slots[0] = addNumbers(slots[0], slots[2]);
+  return forContinues(slots);
 }
-bool isCell(const EvaValue &evaValue) {
-  return isObjectType(evaValue, ObjectType::CELL);
+
+bool forEachPrep(EvaValue *slots) {
+  if (!isArray(slots[1])) {
+    DIE << "for: " << evaValueToTypeString(slots[1]) << " is not an array.";
+  }
+  slots[2] = makeInteger(-1);
+  return forEachLoop(slots);
 }
@@ -1,15 +1,23 @@
 #ifndef __EvaValue_h
 #define __EvaValue_h
 
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <list>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "Shape.h"
+#include "StringTable.h"
+
 enum class EvaValueType {
   NUMBER,
+  INTEGER,
   BOOLEAN,
   OBJECT,
 };
@@ -20,6 +28,12 @@ enum class ObjectType {
   NATIVE,
   FUNCTION,
   CELL,
+  CELL_BLOCK,
+  ARRAY,
+  MAP,
+  RECORD,
+  COROUTINE,
+  WEAK_REF,
 };
 
 struct Traceable {
@@ -31,6 +45,13 @@ struct Traceable {
 
   static void operator delete(void *object);
 
+  /**
+   * Deletes `object` as its concrete ObjectType: no destructor is
+   * virtual, so a delete through Traceable would skip the members, such
+   * as vectors, which own memory of their own.
+   */
+  static void destroy(Traceable *object);
+
   static void cleanup();
 
   static void printStats();
@@ -44,7 +65,14 @@ struct Object : public Traceable {
   ObjectType type;
 };
 
-using NativeFn = std::function<void()>;
+struct EvaValue;
+class EvaVm;
+
+/**
+ * Native functions receive their arguments as a span of the caller's
+ * stack and return the result, which the VM writes over the callee slot.
+ */
+using NativeFn = EvaValue (*)(EvaVm &vm, const EvaValue *args, size_t argc);
 
 struct NativeObject : public Object {
   NativeObject(NativeFn function, const std::string &name, size_t arity);
@@ -56,18 +84,85 @@ struct NativeObject : public Object {
   size_t arity;
 };
 
+#ifdef EVA_NAN_BOXING
+
+/**
+ * NaN-boxed value: a single 64-bit word. Any bit pattern that is not a
+ * quiet NaN with all of the QNAN bits set is a plain double. Booleans live
+ * in the low bits of a tagged quiet NaN, small integers (32 bits) in the
+ * low half of a quiet NaN tagged with bit 48, and object pointers (48 bits)
+ * are tagged with the sign bit on top of the quiet NaN.
+ */
+struct EvaValue {
+  uint64_t bits;
+};
+
+static_assert(sizeof(EvaValue) == 8, "NaN-boxed EvaValue must be 8 bytes");
+
+constexpr uint64_t NANBOX_SIGN_BIT = 0x8000000000000000;
+constexpr uint64_t NANBOX_QNAN = 0x7ffc000000000000;
+constexpr uint64_t NANBOX_OBJECT = NANBOX_SIGN_BIT | NANBOX_QNAN;
+constexpr uint64_t NANBOX_TAG_FALSE = 2;
+constexpr uint64_t NANBOX_TAG_TRUE = 3;
+constexpr uint64_t NANBOX_FALSE = NANBOX_QNAN | NANBOX_TAG_FALSE;
+constexpr uint64_t NANBOX_TRUE = NANBOX_QNAN | NANBOX_TAG_TRUE;
+constexpr uint64_t NANBOX_INTEGER = NANBOX_QNAN | 0x0001000000000000;
+
+#else
+
 struct EvaValue {
   EvaValueType type;
   union {
     double number;
+    int32_t integer;
     bool boolean;
     Object *object;
   };
 };
 
+#endif // EVA_NAN_BOXING
+
+/**
+ * A string is either flat, its characters following the header in the same
+ * allocation, or a rope: the lazy concatenation of two other strings,
+ * which ADD builds in constant time.
+ *
+ * Flat strings are interned through `strings`, so two equal flat strings
+ * are the same object and compare by pointer. A rope is flattened once,
+ * when its characters are first read or compared, into the interned flat
+ * string equal to it, which it forwards to from then on.
+ */
 struct StringObject : public Object {
-  StringObject(const std::string &str);
-  std::string string;
+  StringObject(size_t length, size_t hash);
+  StringObject(StringObject *left, StringObject *right);
+
+  size_t length;
+
+  // Hash of `string`, computed once for interning and map keys
+  size_t hash;
+
+  // Halves of a rope, both null once it is flattened
+  StringObject *left;
+
+  StringObject *right;
+
+  // Depth of the rope tree, 0 for flat strings
+  size_t depth;
+
+  // The flat string equal to this one: itself if this one is flat, null
+  // for a rope not flattened yet
+  StringObject *interned;
+
+  bool isRope() const { return left != nullptr; }
+
+  // Characters of a flat string
+  char *chars() { return reinterpret_cast<char *>(this + 1); }
+
+  std::string_view view() const {
+    return {reinterpret_cast<const char *>(this + 1), length};
+  }
+
+  static StringTable strings;
 };
 
 struct LocalVar {
@@ -75,6 +170,27 @@ struct LocalVar {
   size_t scopeLevel;
 };
 
+struct FunctionObject;
+struct JitCode;
+struct DecodedCode;
+struct Instruction;
+
+/**
+ * Inline cache of a CALL site whose callee is a global. The global keeps
+ * track of the sites caching its value and clears them when rebound.
+ */
+struct CallSiteCache {
+  size_t globalIndex;
+
+  NativeObject *native = nullptr;
+
+  FunctionObject *function = nullptr;
+
+  Instruction *entry = nullptr;
+};
+
+constexpr uint8_t NO_CALL_SITE_CACHE = 0xFF;
+
 struct CodeObject : public Object {
   CodeObject(const std::string &name, size_t arity);
 
@@ -84,18 +200,45 @@ struct CodeObject : public Object {
 
   std::vector<EvaValue> constants;
 
+  // Indices of the pooled literals in constants, so that the compiler
+  // reuses a constant without scanning for it
+  std::unordered_map<int32_t, size_t> integerConstants;
+  std::unordered_map<bool, size_t> booleanConstants;
+  std::unordered_map<Object *, size_t> stringConstants;
+
   std::vector<uint8_t> code;
 
+  std::vector<CallSiteCache> callSiteCaches;
+
+  // Shapes of the object literals, for MAKE_OBJECT
+  std::vector<Shape *> shapes;
+
+  // Inline caches of the GET_PROP / SET_PROP sites
+  std::vector<PropertyCache> propertyCaches;
+
   size_t scopeLevel = 0;
 
   std::vector<LocalVar> locals;
 
   std::vector<std::string> cellNames;
 
-  size_t nonCellFnParams = 0;
-
   size_t freeCount = 0;
 
+  size_t frameSize = 0;
+
+  // Largest frame depth of the stack tier code, found by the verifier
+  size_t maxStackDepth = 0;
+
+  // Pre-decoded form run by the stack interpreter, built on first call
+  // and owned by the VM
+  DecodedCode *decoded = nullptr;
+
+  // Calls and loop back-edges counted towards JIT_HOTNESS_THRESHOLD
+  uint32_t hotness = 0;
+
+  // Machine code installed by the JIT's background thread
+  std::atomic<JitCode *> jitCode{nullptr};
+
   void addLocal(const std::string &name);
 
   void addConst(const EvaValue &value);
@@ -105,9 +248,27 @@ struct CodeObject : public Object {
   int getCellIndex(const std::string &name);
 };
 
+struct CellBlockObject;
+
 struct CellObject : public Object {
-  CellObject(EvaValue value);
+  CellObject(EvaValue value, CellBlockObject *block);
   EvaValue value;
+
+  // Activation block the cell is embedded in, kept alive by the cell
+  CellBlockObject *block;
+};
+
+/**
+ * The own cells of one function activation, allocated in a single block
+ * on entry; the cells follow the header in the same allocation. Closures
+ * capture pointers into the block, which keeps it alive.
+ */
+struct CellBlockObject : public Object {
+  CellBlockObject(size_t count);
+
+  size_t count;
+
+  CellObject *cells() { return reinterpret_cast<CellObject *>(this + 1); }
 };
 
 struct FunctionObject : public Object {
@@ -117,13 +278,190 @@ struct FunctionObject : public Object {
   std::vector<CellObject *> cells;
 };
 
-EvaValue makeNumber(double value);
+/**
+ * Array of values. While every element is a number, the elements are kept
+ * unboxed and contiguous in `numbers`, which the bulk natives work on
+ * directly; storing anything else moves them to `values` for good. The
+ * doubles don't remember integer tags, get() restores them.
+ */
+struct ArrayObject : public Object {
+  ArrayObject(std::vector<double> numbers);
+  ArrayObject(std::vector<EvaValue> values);
+
+  bool isNumeric;
+
+  std::vector<double> numbers;
+
+  std::vector<EvaValue> values;
+
+  size_t size() const { return isNumeric ? numbers.size() : values.size(); }
+
+  EvaValue get(size_t index) const;
+
+  void set(size_t index, const EvaValue &value);
+};
+
+/**
+ * Hash map keyed by numbers, booleans, strings, which compare by value,
+ * and other objects, which compare by identity. The entries live in a
+ * single open addressing table with linear probing, so a lookup usually
+ * stays within one cache line; each entry keeps the hash of its key to
+ * skip key comparisons, and a deleted entry leaves a tombstone behind
+ * until the next rehash. The capacity is a power of two.
+ */
+struct MapObject : public Object {
+  MapObject(bool weakKeys = false);
+
+  struct Entry {
+    // EMPTY, TOMBSTONE, or the hash of the key
+    uint32_t hash;
+
+    EvaValue key;
+
+    EvaValue value;
+
+    bool isLive() const { return hash > TOMBSTONE; }
+  };
+
+  static constexpr uint32_t EMPTY = 0;
+  static constexpr uint32_t TOMBSTONE = 1;
+
+  std::vector<Entry> entries;
+
+  // Live entries, and live entries plus tombstones
+  size_t count;
+
+  size_t used;
+
+  // Ephemeron table: an entry keyed by an object other than a string
+  // keeps neither its key nor its value alive, and goes with its key,
+  // see EvaCollector::mark
+  bool weakKeys;
+
+  /**
+   * Value of the key, or nullptr.
+   */
+  EvaValue *find(const EvaValue &key);
+
+  void set(const EvaValue &key, const EvaValue &value);
+
+  /**
+   * Removes the key, returns whether it was there.
+   */
+  bool remove(const EvaValue &key);
+
+  /**
+   * Removes a live entry found by iterating over `entries`.
+   */
+  void removeEntry(Entry &entry);
+
+private:
+  Entry *probe(const EvaValue &key, uint32_t hash);
+
+  void rehash(size_t capacity);
+};
+
+/**
+ * Record of fixed properties, `(object (name value) ...)`. Its shape names
+ * the properties and `slots` holds their values in the same order; adding
+ * a property moves the record to the next shape down the tree.
+ */
+struct RecordObject : public Object {
+  RecordObject(Shape *shape, std::vector<EvaValue> slots);
+
+  Shape *shape;
+
+  std::vector<EvaValue> slots;
+};
+
+/**
+ * Return address, pc for the stack tier and ra for the register tier.
+ */
+struct Frame {
+  Instruction *pc;
+  uint8_t *ra;
+  EvaValue *bp;
+  FunctionObject *fn;
+  CellBlockObject *env;
+};
+
+/**
+ * Reference that doesn't keep its target alive: it reads as false once
+ * the collector has freed the target. Numbers, booleans and strings are
+ * values rather than identities, and are never cleared.
+ */
+struct WeakRefObject : public Object {
+  WeakRefObject(const EvaValue &target);
+
+  EvaValue target;
+};
+
+enum class CoroutineStatus {
+  SUSPENDED,
+  RUNNING,
+  // Running, but waiting on a coroutine it resumed
+  NORMAL,
+  DEAD,
+};
+
+/**
+ * Coroutine over a function of at most one parameter, which receives the
+ * value of the first resume. A running coroutine lives on the VM stacks,
+ * on top of its resumer. Yielding moves its slice of the value stack and
+ * its frames into the object, so a suspended coroutine holds just its own
+ * activations; the next resume copies them back on top of whoever
+ * resumes it then.
+ */
+struct CoroutineObject : public Object {
+  CoroutineObject(FunctionObject *fn);
+
+  FunctionObject *fn;
+
+  CoroutineStatus status = CoroutineStatus::SUSPENDED;
+
+  // Resumed before: false until the first resume calls fn
+  bool started = false;
 
-EvaValue makeBoolean(bool value);
+  // While suspended: the value stack from base on, the frames of the
+  // outer activations and the registers of the innermost one. Their bp
+  // are still those of the last run, relative to base. Empty otherwise.
+  std::vector<EvaValue> stack;
 
-EvaValue makeObject(Object *value);
+  std::vector<Frame> frames;
 
-EvaValue allocString(std::string s);
+  Frame state{};
+
+  // Slot of the pending yield, from base, which takes the resume value
+  size_t yieldSlot = 0;
+
+  // Bottom of its value stack slice
+  EvaValue *base = nullptr;
+
+  // While running: the frame saving its resumer, the resumer's slot for
+  // the yielded or returned value, and the coroutine the resumer runs in
+  Frame *entryFrame = nullptr;
+
+  EvaValue *result = nullptr;
+
+  CoroutineObject *resumer = nullptr;
+};
+
+/**
+ * The interned string `s`, allocated if it is not interned yet.
+ */
+EvaValue allocString(std::string_view s);
+
+/**
+ * The two strings joined; a rope unless the result is short. Allocates
+ * without collecting, callers collect once the result is rooted.
+ */
+EvaValue concatStrings(const EvaValue &op1, const EvaValue &op2);
+
+/**
+ * Flattens a rope into the interned string equal to it, which the rope
+ * forwards to instead of its halves from then on, and returns that.
+ */
+StringObject *flattenString(StringObject *rope);
 
 EvaValue allocCode(const std::string &name, size_t arity);
 
@@ -131,9 +469,68 @@ EvaValue allocNative(NativeFn fn, const std::string &name, size_t arity);
 
 EvaValue allocFunction(CodeObject *co);
 
-EvaValue allocCell(EvaValue co);
+EvaValue allocCellBlock(size_t count);
+
+/**
+ * Array of the `count` values at `elements`, unboxed if all are numbers.
+ */
+EvaValue allocArray(const EvaValue *elements, size_t count);
+
+EvaValue allocArray(std::vector<double> numbers);
+
+EvaValue allocMap(bool weakKeys = false);
+
+EvaValue allocWeakRef(const EvaValue &target);
+
+/**
+ * Record of `shape` whose slots are the values at `values`.
+ */
+EvaValue allocRecord(Shape *shape, const EvaValue *values);
 
-EvaValue cell(CellObject *cellObject);
+EvaValue allocCoroutine(FunctionObject *fn);
+
+/**
+ * Name of a coroutine status, as the status native returns it.
+ */
+const char *coroutineStatusString(CoroutineStatus status);
+
+/**
+ * Inline cache misses of getProperty / setProperty: look the property up
+ * in the shape of the record and add the shape to the cache.
+ */
+EvaValue getPropertyMiss(const EvaValue &record, PropertyCache &cache);
+
+void setPropertyMiss(const EvaValue &record, PropertyCache &cache,
+                     const EvaValue &value);
+
+/**
+ * Element access of the index forms on arrays and maps; dies on an index
+ * out of bounds, a key missing from a map, or any other container.
+ */
+EvaValue getElement(const EvaValue &array, const EvaValue &index);
+
+void setElement(const EvaValue &array, const EvaValue &index,
+                const EvaValue &value);
+
+/**
+ * Length of an array, a map or a string.
+ */
+EvaValue lengthOf(const EvaValue &value);
+
+/**
+ * Loop entries of FOR_PREP / FOR_EACH_PREP on their three slots at
+ * `slots`: whether the body runs at all. They die on a counter, limit or
+ * step that is no number, a zero step, or a loop over no array.
+ */
+bool forPrep(EvaValue *slots);
+
+bool forEachPrep(EvaValue *slots);
+
+/**
+ * Slow path of forLoop: a double, or a counter set to anything by the
+ * body.
+ */
+bool forLoopNumbers(EvaValue *slots);
 
 std::string evaValueToTypeString(const EvaValue &evaValue);
 
@@ -141,24 +538,366 @@ std::string evaValueToConstantString(const EvaValue &evaValue);
 
 std::ostream &operator<<(std::ostream &os, const EvaValue &evaValue);
 
-double asNumber(const EvaValue &evaValue);
-bool asBoolean(const EvaValue &evaValue);
-StringObject *asString(const EvaValue &evaValue);
-std::string asCppString(const EvaValue &evaValue);
-Object *asObject(const EvaValue &evaValue);
-CodeObject *asCode(const EvaValue &evaValue);
-NativeObject *asNative(const EvaValue &evaValue);
-FunctionObject *asFunction(const EvaValue &evaValue);
-CellObject *asCell(const EvaValue &evaValue);
-
-bool isNumber(const EvaValue &evaValue);
-bool isBoolean(const EvaValue &evaValue);
-bool isObject(const EvaValue &evaValue);
-bool isObjectType(const EvaValue &evaValue, ObjectType objectType);
-bool isString(const EvaValue &evaValue);
-bool isCode(const EvaValue &evaValue);
-bool isNative(const EvaValue &evaValue);
-bool isFunction(const EvaValue &evaValue);
-bool isCell(const EvaValue &evaValue);
+/**
+ * Value constructors, testers and accessors are inlined: they sit on
+ * the hot path of every instruction executed by the VM.
+ */
+
+#ifdef EVA_NAN_BOXING
+
+inline EvaValue makeNumber(double value) {
+  EvaValue evaValue;
+  std::memcpy(&evaValue.bits, &value, sizeof(double));
+  return evaValue;
+}
+
+inline EvaValue makeInteger(int32_t value) {
+  return {NANBOX_INTEGER | (uint32_t)value};
+}
+
+inline EvaValue makeBoolean(bool value) {
+  return {value ? NANBOX_TRUE : NANBOX_FALSE};
+}
+
+inline EvaValue makeObject(Object *value) {
+  return {NANBOX_OBJECT | (uint64_t)(uintptr_t)value};
+}
+
+inline int32_t asInteger(const EvaValue &evaValue) {
+  return (int32_t)(uint32_t)evaValue.bits;
+}
+
+inline bool isInteger(const EvaValue &evaValue) {
+  return (evaValue.bits >> 32) == (NANBOX_INTEGER >> 32);
+}
+
+inline double asNumber(const EvaValue &evaValue) {
+  if (isInteger(evaValue)) {
+    return asInteger(evaValue);
+  }
+  double number;
+  std::memcpy(&number, &evaValue.bits, sizeof(double));
+  return number;
+}
+
+inline bool asBoolean(const EvaValue &evaValue) {
+  return evaValue.bits == NANBOX_TRUE;
+}
+
+inline Object *asObject(const EvaValue &evaValue) {
+  return (Object *)(uintptr_t)(evaValue.bits & ~NANBOX_OBJECT);
+}
+
+inline bool isNumber(const EvaValue &evaValue) {
+  return (evaValue.bits & NANBOX_QNAN) != NANBOX_QNAN || isInteger(evaValue);
+}
+
+inline bool isBoolean(const EvaValue &evaValue) {
+  return (evaValue.bits | 1) == NANBOX_TRUE;
+}
+
+inline bool isObject(const EvaValue &evaValue) {
+  return (evaValue.bits & NANBOX_OBJECT) == NANBOX_OBJECT;
+}
+
+#else
+
+inline EvaValue makeNumber(double value) {
+  return {.type = EvaValueType::NUMBER, .number = value};
+}
+
+inline EvaValue makeInteger(int32_t value) {
+  return {.type = EvaValueType::INTEGER, .integer = value};
+}
+
+inline EvaValue makeBoolean(bool value) {
+  return {.type = EvaValueType::BOOLEAN, .boolean = value};
+}
+
+inline EvaValue makeObject(Object *value) {
+  return {.type = EvaValueType::OBJECT, .object = value};
+}
+
+inline int32_t asInteger(const EvaValue &evaValue) { return evaValue.integer; }
+
+inline bool isInteger(const EvaValue &evaValue) {
+  return evaValue.type == EvaValueType::INTEGER;
+}
+
+inline double asNumber(const EvaValue &evaValue) {
+  if (isInteger(evaValue)) {
+    return evaValue.integer;
+  }
+  return evaValue.number;
+}
+
+inline bool asBoolean(const EvaValue &evaValue) { return evaValue.boolean; }
+
+inline Object *asObject(const EvaValue &evaValue) { return evaValue.object; }
+
+inline bool isNumber(const EvaValue &evaValue) {
+  return evaValue.type == EvaValueType::NUMBER || isInteger(evaValue);
+}
+
+inline bool isBoolean(const EvaValue &evaValue) {
+  return evaValue.type == EvaValueType::BOOLEAN;
+}
+
+inline bool isObject(const EvaValue &evaValue) {
+  return evaValue.type == EvaValueType::OBJECT;
+}
+
+#endif // EVA_NAN_BOXING
+
+/**
+ * Arithmetic on numbers. Two integers stay integers as long as the exact
+ * result fits in 32 bits; otherwise, or with a double operand, the
+ * operation is done on doubles.
+ */
+inline EvaValue addNumbers(const EvaValue &op1, const EvaValue &op2) {
+  int32_t result;
+  if (isInteger(op1) && isInteger(op2) &&
+      !__builtin_add_overflow(asInteger(op1), asInteger(op2), &result)) {
+    return makeInteger(result);
+  }
+  return makeNumber(asNumber(op1) + asNumber(op2));
+}
+
+inline EvaValue subNumbers(const EvaValue &op1, const EvaValue &op2) {
+  int32_t result;
+  if (isInteger(op1) && isInteger(op2) &&
+      !__builtin_sub_overflow(asInteger(op1), asInteger(op2), &result)) {
+    return makeInteger(result);
+  }
+  return makeNumber(asNumber(op1) - asNumber(op2));
+}
+
+inline EvaValue mulNumbers(const EvaValue &op1, const EvaValue &op2) {
+  int32_t result;
+  if (isInteger(op1) && isInteger(op2) &&
+      !__builtin_mul_overflow(asInteger(op1), asInteger(op2), &result)) {
+    return makeInteger(result);
+  }
+  return makeNumber(asNumber(op1) * asNumber(op2));
+}
+
+/**
+ * Integer division only when it is exact: (/ 6 3) is 2, (/ 7 2) is 3.5.
+ */
+inline EvaValue divNumbers(const EvaValue &op1, const EvaValue &op2) {
+  if (isInteger(op1) && isInteger(op2)) {
+    int64_t dividend = asInteger(op1);
+    int64_t divisor = asInteger(op2);
+    if (divisor != 0 && dividend % divisor == 0 &&
+        dividend / divisor <= INT32_MAX) {
+      return makeInteger((int32_t)(dividend / divisor));
+    }
+  }
+  return makeNumber(asNumber(op1) / asNumber(op2));
+}
+
+/**
+ * Dies on operands that the arithmetic operator `op` doesn't apply to;
+ * `expected` names the ones it does.
+ */
+void operandTypeError(const char *op, const char *expected,
+                      const EvaValue &op1, const EvaValue &op2);
+
+/**
+ * Operand check of the arithmetic operators but +, which apply to numbers
+ * only.
+ */
+inline void requireNumbers(const char *op, const EvaValue &op1,
+                           const EvaValue &op2) {
+  if (!isNumber(op1) || !isNumber(op2)) {
+    operandTypeError(op, "two numbers", op1, op2);
+  }
+}
+
+/**
+ * Loop step of FOR_LOOP on the counter, limit and step at `slots`: adds
+ * the step to the counter and tells whether the body runs again. The
+ * limit is excluded, a negative step counts down to it.
+ */
+inline bool forLoop(EvaValue *slots) {
+  auto &counter = slots[0];
+  auto limit = slots[1];
+  auto step = slots[2];
+
+  if (isInteger(counter) && isInteger(limit) && isInteger(step)) {
+    int32_t next;
+    // Past INT32_MAX is past any integer limit too
+    if (__builtin_add_overflow(asInteger(counter), asInteger(step), &next)) {
+      return false;
+    }
+    counter = makeInteger(next);
+    return asInteger(step) > 0 ? next < asInteger(limit)
+                               : next > asInteger(limit);
+  }
+  return forLoopNumbers(slots);
+}
+
+inline EvaValue cell(CellObject *cellObject) {
+  return makeObject((Object *)cellObject);
+}
+
+inline StringObject *asString(const EvaValue &evaValue) {
+  return (StringObject *)asObject(evaValue);
+}
+
+/**
+ * The interned flat string equal to a string: equal strings give one
+ * pointer.
+ */
+inline StringObject *internedString(const EvaValue &evaValue) {
+  auto string = asString(evaValue);
+  return string->interned != nullptr ? string->interned
+                                     : flattenString(string);
+}
+
+inline std::string_view asStringView(const EvaValue &evaValue) {
+  return internedString(evaValue)->view();
+}
+
+inline CodeObject *asCode(const EvaValue &evaValue) {
+  return (CodeObject *)asObject(evaValue);
+}
+
+inline NativeObject *asNative(const EvaValue &evaValue) {
+  return (NativeObject *)asObject(evaValue);
+}
+
+inline FunctionObject *asFunction(const EvaValue &evaValue) {
+  return (FunctionObject *)asObject(evaValue);
+}
+
+inline CellObject *asCell(const EvaValue &evaValue) {
+  return (CellObject *)asObject(evaValue);
+}
+
+inline CellBlockObject *asCellBlock(const EvaValue &evaValue) {
+  return (CellBlockObject *)asObject(evaValue);
+}
+
+inline ArrayObject *asArray(const EvaValue &evaValue) {
+  return (ArrayObject *)asObject(evaValue);
+}
+
+inline MapObject *asMap(const EvaValue &evaValue) {
+  return (MapObject *)asObject(evaValue);
+}
+
+inline RecordObject *asRecord(const EvaValue &evaValue) {
+  return (RecordObject *)asObject(evaValue);
+}
+
+inline WeakRefObject *asWeakRef(const EvaValue &evaValue) {
+  return (WeakRefObject *)asObject(evaValue);
+}
+
+inline CoroutineObject *asCoroutine(const EvaValue &evaValue) {
+  return (CoroutineObject *)asObject(evaValue);
+}
+
+inline bool isObjectType(const EvaValue &evaValue, ObjectType objectType) {
+  return isObject(evaValue) && asObject(evaValue)->type == objectType;
+}
+
+inline bool isString(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::STRING);
+}
+
+inline bool isCode(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::CODE);
+}
+
+inline bool isNative(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::NATIVE);
+}
+
+inline bool isFunction(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::FUNCTION);
+}
+
+inline bool isCell(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::CELL);
+}
+
+inline bool isCellBlock(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::CELL_BLOCK);
+}
+
+inline bool isArray(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::ARRAY);
+}
+
+inline bool isMap(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::MAP);
+}
+
+inline bool isRecord(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::RECORD);
+}
+
+inline bool isCoroutine(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::COROUTINE);
+}
+
+inline bool isWeakRef(const EvaValue &evaValue) {
+  return isObjectType(evaValue, ObjectType::WEAK_REF);
+}
+
+/**
+ * Loop step of FOR_EACH_LOOP on the element, array and position at
+ * `slots`: loads the next element, if any.
+ */
+inline bool forEachLoop(EvaValue *slots) {
+  auto array = asArray(slots[1]);
+  auto position = (size_t)(asInteger(slots[2]) + 1);
+  if (position >= array->size()) {
+    return false;
+  }
+  slots[0] = array->get(position);
+  slots[2] = makeInteger(position);
+  return true;
+}
+
+/**
+ * Property access of GET_PROP / SET_PROP: a hit in the inline cache of
+ * the site is a shape compare and an indexed slot access. Reading a
+ * missing property dies, storing one adds it.
+ */
+inline EvaValue getProperty(const EvaValue &record, PropertyCache &cache) {
+  if (isRecord(record)) {
+    auto object = asRecord(record);
+    for (size_t i = 0; i < cache.count; i++) {
+      if (cache.entries[i].shape == object->shape) {
+        return object->slots[cache.entries[i].slot];
+      }
+    }
+  }
+  return getPropertyMiss(record, cache);
+}
+
+inline void setProperty(const EvaValue &record, PropertyCache &cache,
+                        const EvaValue &value) {
+  if (isRecord(record)) {
+    auto object = asRecord(record);
+    for (size_t i = 0; i < cache.count; i++) {
+      auto &entry = cache.entries[i];
+      if (entry.shape != object->shape) {
+        continue;
+      }
+      if (entry.transition != nullptr) {
+        object->shape = entry.transition;
+        object->slots.push_back(value);
+      } else {
+        object->slots[entry.slot] = value;
+      }
+      return;
+    }
+  }
+  setPropertyMiss(record, cache, value);
+}
 
 #endif // !__EvaValue_h
@@ -2,75 +2,347 @@
 #include "../Logger.h"
 #include "../bytecode/OpCode.h"
 #include "../compiler/EvaCompiler.h"
+#include "../compiler/EvaRegisterCompiler.h"
 #include "../parser/EvaParser.h"
+#include "ArrayKernels.h"
+#include "DecodedCode.h"
+#include "Dispatch.h"
 #include "EvaValue.h"
 #include "Global.h"
+#include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iomanip>
 #include <ios>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 using syntax::EvaParser;
 
-uint8_t EvaVm::readByte() { return *ip++; }
+void EvaVm::binaryOp(const char *name,
+                     EvaValue (*op)(const EvaValue &, const EvaValue &)) {
+  auto op2 = pop();
+  auto op1 = pop();
+  requireNumbers(name, op1, op2);
+  push(op(op1, op2));
+}
 
-uint16_t EvaVm::readShort() {
-  ip += 2;
-  return (((uint16_t)ip[-2]) << 8) | ip[-1];
+void EvaVm::allocCells() {
+  auto count = fn->co->cellNames.size() - fn->co->freeCount;
+  if (count == 0) {
+    env = nullptr;
+    return;
+  }
+
+  maybeGC();
+  env = asCellBlock(allocCellBlock(count));
 }
 
-uint8_t *EvaVm::toAddress(size_t index) { return &fn->co->code[index]; }
+void EvaVm::scopeExit(size_t count) {
+  *(sp - 1 - count) = peek(0);
 
-EvaValue &EvaVm::getConst() { return fn->co->constants[readByte()]; }
+  popN(count);
+}
 
-void EvaVm::binaryOp(double (*op)(double, double)) {
-  auto op2 = asNumber(pop());
-  auto op1 = asNumber(pop());
-  push(makeNumber(op(op1, op2)));
+void EvaVm::makeFunction(size_t cellsCount) {
+  auto co = asCode(pop());
+  maybeGC();
+  auto fnValue = allocFunction(co);
+  auto fn = asFunction(fnValue);
+
+  fn->cells.resize(cellsCount);
+  for (auto i = cellsCount; i > 0; i--) {
+    fn->cells[i - 1] = asCell(pop());
+  }
+  push(fnValue);
 }
 
-EvaVm::EvaVm()
-    : global(std::make_unique<Global>()),
-      compiler(std::make_unique<EvaCompiler>(global)),
-      collector(std::make_unique<EvaCollector>()) {
-  setGlobalVariables();
+void EvaVm::makeArray(size_t count) {
+  maybeGC();
+  auto array = allocArray(sp - count, count);
+  popN(count);
+  push(array);
 }
 
-EvaVm::~EvaVm() { Traceable::cleanup(); }
+void EvaVm::getIndex() {
+  auto index = pop();
+  auto array = pop();
+  push(getElement(array, index));
+}
+
+void EvaVm::setIndex() {
+  auto value = pop();
+  auto index = pop();
+  auto array = pop();
+  setElement(array, index, value);
+  push(value);
+}
+
+void EvaVm::makeRecord(Shape *shape) {
+  auto count = shape->names.size();
+  maybeGC();
+  auto record = allocRecord(shape, sp - count);
+  popN(count);
+  push(record);
+}
+
+void EvaVm::getProp(PropertyCache &cache) {
+  *(sp - 1) = getProperty(peek(0), cache);
+}
+
+void EvaVm::setProp(PropertyCache &cache) {
+  auto value = pop();
+  setProperty(peek(0), cache, value);
+  *(sp - 1) = value;
+}
 
-void EvaVm::push(const EvaValue &value) {
-  if ((size_t)(sp - stack.begin()) == STACK_LIMIT) {
-    DIE << "push(): Stack overflow.\n";
+void EvaVm::jumpTo(Instruction *target) {
+  auto backEdge = target < pc;
+  pc = target;
+
+  if (backEdge) {
+    jitSafepoint(true);
+  }
+}
+
+Instruction *EvaVm::decode(CodeObject *co) {
+  // Main runs on an empty frame, functions start with the callee and
+  // their arguments
+  auto isMain = co == compiler->getMainFunction()->co;
+  co->maxStackDepth = verifier->verify(co, isMain ? 0 : co->arity + 1);
+
+  decodedCodes_.push_back(decodeCode(co, *global, handlers_));
+  co->decoded = decodedCodes_.back().get();
+  return &co->decoded->instructions[0];
+}
+
+void EvaVm::quicken(Instruction *instruction, OpCode op) {
+  instruction->opcode = static_cast<uint8_t>(op);
+  instruction->handler = handlers_[instruction->opcode];
+
+  // The compact form keeps WIDE instructions generic
+  if (!instruction->wide) {
+    fn->co->code[instruction->offset] = instruction->opcode;
+  }
+}
+
+void EvaVm::cacheCallSite(CallSiteCache &site, const EvaValue &fnValue) {
+  auto &globalVar = global->get(site.globalIndex);
+
+  // The global may have been rebound while the arguments were evaluated,
+  // in which case the callee slot holds a value the site can't cache
+  if (!isObject(globalVar.value) ||
+      asObject(globalVar.value) != asObject(fnValue)) {
+    return;
   }
-  *sp = value;
-  sp++;
-};
 
-EvaValue EvaVm::peek(size_t offset) {
-  if (stack.size() == 0) {
-    DIE << "peek(): empty stack\n";
+  if (isNative(fnValue)) {
+    site.native = asNative(fnValue);
+  } else {
+    site.function = asFunction(fnValue);
+    site.entry = entryOf(site.function->co);
   }
 
-  return *(sp - 1 - offset);
+  globalVar.callSites.push_back(&site);
 }
 
-EvaValue EvaVm::pop() {
-  if (sp == stack.begin()) {
-    DIE << "pop(): empty stack.\n";
+void EvaVm::callNative(NativeObject *native, EvaValue *callee,
+                       size_t argsCount) {
+  if (argsCount != native->arity) {
+    DIE << "Native " << native->name << " expects " << native->arity
+        << " arguments, got " << argsCount << ".";
+  }
+  *callee = native->function(*this, callee + 1, argsCount);
+}
+
+void EvaVm::callFunction(FunctionObject *callee, Instruction *entry,
+                         size_t argsCount) {
+  pushFrame();
+
+  fn = callee;
+  bp = sp - argsCount - 1;
+  allocCells();
+  pc = entry;
+}
+
+void EvaVm::tailCallFunction(FunctionObject *callee, Instruction *entry,
+                             size_t argsCount) {
+  // The callee and its arguments slide down over the current frame, which
+  // the callee then returns from directly
+  std::copy(sp - argsCount - 1, sp, bp);
+  sp = bp + argsCount + 1;
+
+  fn = callee;
+  allocCells();
+  pc = entry;
+}
+
+void EvaVm::resumeCoroutine(const EvaValue &coValue, EvaValue *result,
+                            const EvaValue &value) {
+  if (!isCoroutine(coValue)) {
+    DIE << "resume: " << evaValueToTypeString(coValue)
+        << " is not a coroutine.";
+  }
+  auto co = asCoroutine(coValue);
+  if (co->status != CoroutineStatus::SUSPENDED) {
+    DIE << "resume: the coroutine is " << coroutineStatusString(co->status)
+        << ".";
+  }
+
+  pushFrame();
+  co->entryFrame = frame;
+  co->result = result;
+  co->resumer = coroutine_;
+  if (coroutine_ != nullptr) {
+    coroutine_->status = CoroutineStatus::NORMAL;
+  }
+  co->status = CoroutineStatus::RUNNING;
+  coroutine_ = co;
+
+  // The coroutine stacks up on top of the resumer
+  auto base = sp;
+
+  if (!co->started) {
+    co->started = true;
+    co->base = base;
+
+    fn = co->fn;
+    bp = base;
+    push(makeObject((Object *)fn));
+    if (fn->co->arity == 1) {
+      push(value);
+    }
+
+    if (mode == EvalMode::REGISTER) {
+      sp = bp + fn->co->frameSize;
+      if (sp > stack.end()) {
+        DIE << "RESUME: Stack overflow.\n";
+      }
+      std::fill(bp + fn->co->arity + 1, sp, makeBoolean(false));
+      allocCells();
+      ip = &fn->co->code[0];
+    } else {
+      allocCells();
+      pc = entryOf(fn->co);
+    }
+    return;
+  }
+
+  // The saved frames point into the slice where it last ran
+  auto offset = base - co->base;
+  co->base = base;
+
+  sp = std::copy(co->stack.begin(), co->stack.end(), base);
+  for (auto &saved : co->frames) {
+    *frame++ = Frame{saved.pc, saved.ra, saved.bp + offset, saved.fn,
+                     saved.env};
+  }
+
+  pc = co->state.pc;
+  ip = co->state.ra;
+  bp = co->state.bp + offset;
+  fn = co->state.fn;
+  env = co->state.env;
+  base[co->yieldSlot] = value;
+
+  co->stack.clear();
+  co->frames.clear();
+  co->state = {};
+}
+
+void EvaVm::yieldCoroutine(EvaValue *slot, const EvaValue &value) {
+  auto co = coroutine_;
+  if (co == nullptr) {
+    DIE << "yield: not inside of a coroutine.";
+  }
+
+  co->stack.assign(co->base, sp);
+  co->frames.assign(co->entryFrame, frame);
+  co->state = Frame{pc, ip, bp, fn, env};
+  co->yieldSlot = slot - co->base;
+  co->status = CoroutineStatus::SUSPENDED;
+
+  leaveCoroutine(value);
+}
+
+void EvaVm::finishCoroutine(const EvaValue &value) {
+  coroutine_->status = CoroutineStatus::DEAD;
+  leaveCoroutine(value);
+}
+
+void EvaVm::leaveCoroutine(const EvaValue &value) {
+  auto co = coroutine_;
+
+  // The result slot is below the slice, which `value` may be in
+  *co->result = value;
+
+  sp = co->base;
+  frame = co->entryFrame;
+  popFrame();
+
+  coroutine_ = co->resumer;
+  if (coroutine_ != nullptr) {
+    coroutine_->status = CoroutineStatus::RUNNING;
+  }
+  co->entryFrame = nullptr;
+  co->result = nullptr;
+  co->resumer = nullptr;
+}
+
+void EvaVm::add(const EvaValue &op1, const EvaValue &op2) {
+  if (isNumber(op1) && isNumber(op2)) {
+    push(addNumbers(op1, op2));
   }
-  --sp;
-  return *sp;
-};
 
-void EvaVm::popN(size_t count) {
-  if (stack.size() == 0) {
-    DIE << "popN(): empty stack.\n";
+  else if (isString(op1) && isString(op2)) {
+    // Collected once the result, which may hold both operands, is rooted
+    push(concatStrings(op1, op2));
+    maybeGC();
   }
 
-  sp -= count;
+  else {
+    operandTypeError("+", "two numbers or two strings", op1, op2);
+  }
+}
+
+static std::unique_ptr<EvaCompiler>
+createCompiler(EvalMode mode, std::shared_ptr<Global> global) {
+  if (mode == EvalMode::REGISTER) {
+    return std::make_unique<EvaRegisterCompiler>(global);
+  }
+  return std::make_unique<EvaCompiler>(global);
+}
+
+EvaVm::EvaVm(EvalMode mode, size_t stackSize, EvalOptions options)
+    : mode(mode), options(options), global(std::make_unique<Global>()),
+      compiler(createCompiler(mode, global)),
+      collector(std::make_unique<EvaCollector>()),
+      verifier(std::make_unique<EvaVerifier>(global)), stack(stackSize),
+      frames(stackSize), evalLoop_(selectEvalLoop(options)) {
+  setGlobalVariables();
+  setJitEnabled(mode == EvalMode::STACK && !options.checked &&
+                !options.tracing && !options.profiling);
+}
+
+EvaVm::~EvaVm() {
+  // The JIT thread may still be reading code objects
+  setJitEnabled(false);
+  Traceable::cleanup();
+}
+
+void EvaVm::setJitEnabled(bool enabled) {
+#ifdef EVA_JIT
+  if (!enabled) {
+    jit.reset();
+  } else if (jit == nullptr && mode == EvalMode::STACK) {
+    jit = std::make_unique<EvaJit>(this);
+  }
+#endif
 }
 
 std::set<Traceable *> EvaVm::getGCRoots() {
@@ -82,6 +354,12 @@ std::set<Traceable *> EvaVm::getGCRoots() {
   auto globalRoots = getGlobalGCRoots();
   roots.insert(globalRoots.begin(), globalRoots.end());
 
+  auto cellRoots = getCellGCRoots();
+  roots.insert(cellRoots.begin(), cellRoots.end());
+
+  auto coroutineRoots = getCoroutineGCRoots();
+  roots.insert(coroutineRoots.begin(), coroutineRoots.end());
+
   return roots;
 }
 
@@ -90,7 +368,7 @@ std::set<Traceable *> EvaVm::getStackGCRoots() {
   auto stackEntry = sp;
   while (stackEntry-- != stack.begin()) {
     if (isObject(*stackEntry)) {
-      roots.insert((Traceable *)stackEntry->object);
+      roots.insert((Traceable *)asObject(*stackEntry));
     }
   }
 
@@ -106,10 +384,38 @@ std::set<Traceable *> EvaVm::getGlobalGCRoots() {
 
   for (const auto &global : global->globals) {
     if (isObject(global.value)) {
-      roots.insert((Traceable *)global.value.object);
+      roots.insert((Traceable *)asObject(global.value));
+    }
+  }
+
+  return roots;
+}
+
+std::set<Traceable *> EvaVm::getCellGCRoots() {
+  std::set<Traceable *> roots;
+
+  for (auto entry = frames.begin(); entry != frame; entry++) {
+    if (entry->env != nullptr) {
+      roots.insert((Traceable *)entry->env);
     }
   }
 
+  if (env != nullptr) {
+    roots.insert((Traceable *)env);
+  }
+
+  return roots;
+}
+
+std::set<Traceable *> EvaVm::getCoroutineGCRoots() {
+  std::set<Traceable *> roots;
+
+  // The running ones, whose activations are on the VM stacks; suspended
+  // ones are traced from wherever they are referenced
+  for (auto co = coroutine_; co != nullptr; co = co->resumer) {
+    roots.insert((Traceable *)co);
+  }
+
   return roots;
 }
 
@@ -124,15 +430,20 @@ void EvaVm::maybeGC() {
     return;
   }
 
-  /*std::cout << "---------- BEFORE GC STATS ----------\n";*/
-  /*Traceable::printStats();*/
+  if (options.profiling) {
+    std::cout << "---------- BEFORE GC STATS ----------\n";
+    Traceable::printStats();
+  }
   collector->gc(roots);
-  /*std::cout << "---------- AFTER GC STATS ----------\n";*/
-  /*Traceable::printStats();*/
+  if (options.profiling) {
+    std::cout << "---------- AFTER GC STATS ----------\n";
+    Traceable::printStats();
+  }
 }
 
 EvaValue EvaVm::exec(const std::string &program) {
-  auto ast = EvaParser().parse("(begin" + program + ")");
+  // Apart, so that a comment on the first or last line ends before them
+  auto ast = EvaParser().parse("(begin " + program + "\n)");
 
   compiler->compile(ast);
 
@@ -142,232 +453,853 @@ EvaValue EvaVm::exec(const std::string &program) {
 
   bp = sp;
 
+  frame = frames.begin();
+
   ip = &fn->co->code[0];
 
+  allocCells();
+
   compiler->disassembleBytecode();
 
+  if (mode == EvalMode::REGISTER) {
+    sp = bp + fn->co->frameSize;
+    std::fill(bp, sp, makeBoolean(false));
+    return evalRegister();
+  }
+
   return eval();
 }
 
-EvaValue EvaVm::eval() {
+EvalOptions EvalOptions::fromEnvironment() {
+  auto enabled = [](const char *name) {
+    auto value = std::getenv(name);
+    return value != nullptr && std::strcmp(value, "0") != 0;
+  };
+
+  EvalOptions options;
+  options.checked = enabled("EVA_CHECKED");
+  options.tracing = enabled("EVA_TRACE");
+  options.profiling = enabled("EVA_PROFILE");
+  return options;
+}
+
+EvaVm::EvalLoop EvaVm::selectEvalLoop(const EvalOptions &options) {
+  static const EvalLoop loops[] = {
+      &EvaVm::evalLoop<EvalPolicy<false, false, false>>,
+      &EvaVm::evalLoop<EvalPolicy<true, false, false>>,
+      &EvaVm::evalLoop<EvalPolicy<false, true, false>>,
+      &EvaVm::evalLoop<EvalPolicy<true, true, false>>,
+      &EvaVm::evalLoop<EvalPolicy<false, false, true>>,
+      &EvaVm::evalLoop<EvalPolicy<true, false, true>>,
+      &EvaVm::evalLoop<EvalPolicy<false, true, true>>,
+      &EvaVm::evalLoop<EvalPolicy<true, true, true>>,
+  };
+  return loops[options.checked | options.tracing << 1 | options.profiling << 2];
+}
+
+EvaValue EvaVm::eval() { return (this->*evalLoop_)(); }
+
+void EvaVm::checkInstruction(Instruction *instruction) {
+  auto opcode = static_cast<OpCode>(instruction->opcode);
+
+  if (sp < bp || sp > bp + fn->co->maxStackDepth) {
+    DIE << "Stack out of bounds before " << opcodeToString(instruction->opcode)
+        << " at " << instruction->offset << " in " << fn->co->name << ".";
+  }
+
+  switch (opcode) {
+  case OpCode::GET_LOCAL:
+  case OpCode::SET_LOCAL:
+  case OpCode::ADD_LOCAL_CONST:
+  case OpCode::SUB_LOCAL_CONST:
+    if (bp + instruction->operand >= sp) {
+      DIE << opcodeToString(instruction->opcode)
+          << ": invalid variable index: " << instruction->operand;
+    }
+    break;
+  case OpCode::FOR_PREP:
+  case OpCode::FOR_LOOP:
+  case OpCode::FOR_EACH_PREP:
+  case OpCode::FOR_EACH_LOOP:
+    if (bp + instruction->operand + 2 >= sp) {
+      DIE << opcodeToString(instruction->opcode)
+          << ": invalid loop slot: " << instruction->operand;
+    }
+    break;
+  case OpCode::GET_CELL:
+  case OpCode::SET_CELL:
+  case OpCode::LOAD_CELL: {
+    auto freeCount = fn->co->freeCount;
+    auto isValid = instruction->operand < freeCount
+                       ? instruction->operand < fn->cells.size()
+                       : env != nullptr &&
+                             instruction->operand - freeCount < env->count;
+    if (!isValid) {
+      DIE << opcodeToString(instruction->opcode)
+          << ": invalid cell index: " << instruction->operand;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void EvaVm::traceInstruction(Instruction *instruction) {
+  std::ios_base::fmtflags f(std::cout.flags());
+  auto fill = std::cout.fill('0');
+
+  dumpStack();
+  std::cout << fn->co->name << " " << std::setw(4) << std::hex
+            << std::uppercase << instruction->offset << " "
+            << opcodeToString(instruction->opcode) << "\n";
+
+  std::cout.fill(fill);
+  std::cout.flags(f);
+}
+
+void EvaVm::printProfile() {
+  std::vector<std::pair<uint64_t, size_t>> counts;
+  for (size_t opcode = 0; opcode < opcodeCounts_.size(); opcode++) {
+    if (opcodeCounts_[opcode] != 0) {
+      counts.emplace_back(opcodeCounts_[opcode], opcode);
+    }
+  }
+  std::sort(counts.rbegin(), counts.rend());
+
+  std::cout << "---------- OPCODE PROFILE ----------\n";
+  for (const auto &[count, opcode] : counts) {
+    std::cout << std::left << std::setw(20) << opcodeToString(opcode)
+              << std::right << std::dec << count << "\n";
+  }
+}
+
+#define DISPATCH_OPCODE OpCode
+#define DISPATCH_FETCH()                                                       \
+  (instruction = pc++, beforeInstruction<Policy>(instruction),                 \
+   instruction->opcode)
+#define DISPATCH_TARGET()                                                      \
+  (instruction = pc++, beforeInstruction<Policy>(instruction),                 \
+   instruction->handler)
+
+template <typename Policy> EvaValue EvaVm::evalLoop() {
+#ifdef EVA_COMPUTED_GOTO
+  static void *dispatchTable[256];
+  static bool dispatchTableReady = false;
+
+  if (!dispatchTableReady) {
+    for (auto &label : dispatchTable) {
+      label = &&op_UNKNOWN;
+    }
+    DISPATCH_LABEL(HALT);
+    DISPATCH_LABEL(CONST);
+    DISPATCH_LABEL(ADD);
+    DISPATCH_LABEL(SUB);
+    DISPATCH_LABEL(MUL);
+    DISPATCH_LABEL(DIV);
+    DISPATCH_LABEL(COMPARE);
+    DISPATCH_LABEL(JMP_IF_FALSE);
+    DISPATCH_LABEL(JMP);
+    DISPATCH_LABEL(GET_GLOBAL);
+    DISPATCH_LABEL(SET_GLOBAL);
+    DISPATCH_LABEL(POP);
+    DISPATCH_LABEL(GET_LOCAL);
+    DISPATCH_LABEL(SET_LOCAL);
+    DISPATCH_LABEL(SCOPE_EXIT);
+    DISPATCH_LABEL(CALL);
+    DISPATCH_LABEL(RETURN);
+    DISPATCH_LABEL(GET_CELL);
+    DISPATCH_LABEL(SET_CELL);
+    DISPATCH_LABEL(LOAD_CELL);
+    DISPATCH_LABEL(MAKE_FUNCTION);
+    DISPATCH_LABEL(JLT);
+    DISPATCH_LABEL(JGT);
+    DISPATCH_LABEL(JEQ);
+    DISPATCH_LABEL(JGE);
+    DISPATCH_LABEL(JLE);
+    DISPATCH_LABEL(JNE);
+    DISPATCH_LABEL(ADD_LOCAL_CONST);
+    DISPATCH_LABEL(SUB_LOCAL_CONST);
+    DISPATCH_LABEL(ADD_NUM);
+    DISPATCH_LABEL(ADD_STR);
+    DISPATCH_LABEL(COMPARE_NUM_LT);
+    DISPATCH_LABEL(COMPARE_NUM_GT);
+    DISPATCH_LABEL(COMPARE_NUM_EQ);
+    DISPATCH_LABEL(COMPARE_NUM_GE);
+    DISPATCH_LABEL(COMPARE_NUM_LE);
+    DISPATCH_LABEL(COMPARE_NUM_NE);
+    DISPATCH_LABEL(JLT_NUM);
+    DISPATCH_LABEL(JGT_NUM);
+    DISPATCH_LABEL(JEQ_NUM);
+    DISPATCH_LABEL(JGE_NUM);
+    DISPATCH_LABEL(JLE_NUM);
+    DISPATCH_LABEL(JNE_NUM);
+    DISPATCH_LABEL(TAIL_CALL);
+    DISPATCH_LABEL(MAKE_ARRAY);
+    DISPATCH_LABEL(GET_INDEX);
+    DISPATCH_LABEL(SET_INDEX);
+    DISPATCH_LABEL(LENGTH);
+    DISPATCH_LABEL(MAKE_OBJECT);
+    DISPATCH_LABEL(GET_PROP);
+    DISPATCH_LABEL(SET_PROP);
+    DISPATCH_LABEL(FOR_PREP);
+    DISPATCH_LABEL(FOR_LOOP);
+    DISPATCH_LABEL(FOR_EACH_PREP);
+    DISPATCH_LABEL(FOR_EACH_LOOP);
+    DISPATCH_LABEL(RESUME);
+    DISPATCH_LABEL(YIELD);
+    dispatchTableReady = true;
+  }
+  handlers_ = dispatchTable;
+#else
+  static void *const dispatchTable[256] = {};
+  handlers_ = dispatchTable;
+#endif
+
+  // Instruction being executed; pc already points past it
+  Instruction *instruction;
+  pc = entryOf(fn->co);
+
   for (;;) {
-    /*dumpStack();*/
-    auto opcode = readByte();
-    switch (static_cast<OpCode>(opcode)) {
-    case OpCode::HALT:
+    DISPATCH_SWITCH {
+    OP_CASE(HALT):
+      if constexpr (Policy::profiling) {
+        printProfile();
+      }
       return pop();
 
-    case OpCode::CONST:
-      push(getConst());
-      break;
+    OP_CASE(CONST):
+      push(*instruction->constant);
+      DISPATCH();
 
-    case OpCode::ADD: {
+    OP_CASE(ADD): {
       auto op2 = pop();
       auto op1 = pop();
 
       if (isNumber(op1) && isNumber(op2)) {
-        auto v1 = asNumber(op1);
-        auto v2 = asNumber(op2);
-        push(makeNumber(v1 + v2));
+        quicken(instruction, OpCode::ADD_NUM);
+      } else if (isString(op1) && isString(op2)) {
+        quicken(instruction, OpCode::ADD_STR);
       }
+      add(op1, op2);
+      DISPATCH();
+    }
+
+    OP_CASE(ADD_NUM): {
+      auto op2 = peek(0);
+      auto op1 = peek(1);
 
-      else if (isString(op1) && isString(op2)) {
-        auto v1 = asCppString(op1);
-        auto v2 = asCppString(op2);
-        maybeGC();
-        push(allocString(v1 + v2));
+      if (!isNumber(op1) || !isNumber(op2)) {
+        deoptimize(instruction, OpCode::ADD);
+        DISPATCH();
       }
+      popN(2);
+      push(addNumbers(op1, op2));
+      DISPATCH();
+    }
+
+    OP_CASE(ADD_STR): {
+      auto op2 = peek(0);
+      auto op1 = peek(1);
 
-      break;
+      if (!isString(op1) || !isString(op2)) {
+        deoptimize(instruction, OpCode::ADD);
+        DISPATCH();
+      }
+      popN(2);
+      push(concatStrings(op1, op2));
+      maybeGC();
+      DISPATCH();
     }
 
-    case OpCode::SUB:
-      binaryOp([](auto a, auto b) { return a - b; });
-      break;
+    OP_CASE(SUB):
+      binaryOp("-", subNumbers);
+      DISPATCH();
 
-    case OpCode::MUL:
-      binaryOp([](auto a, auto b) { return a * b; });
-      break;
+    OP_CASE(MUL):
+      binaryOp("*", mulNumbers);
+      DISPATCH();
 
-    case OpCode::DIV:
-      binaryOp([](auto a, auto b) { return a / b; });
-      break;
+    OP_CASE(DIV):
+      binaryOp("/", divNumbers);
+      DISPATCH();
 
-    case OpCode::COMPARE: {
-      auto op = readByte();
+    OP_CASE(COMPARE): {
+      auto op = instruction->operand;
       auto op2 = pop();
       auto op1 = pop();
 
       if (isNumber(op1) && isNumber(op2)) {
-        auto v1 = asNumber(op1);
-        auto v2 = asNumber(op2);
-        compareValues(op, v1, v2);
+        auto numberOp = static_cast<uint8_t>(OpCode::COMPARE_NUM_LT) + op;
+        quicken(instruction, static_cast<OpCode>(numberOp));
+        push(makeBoolean(compareNumbers(
+            [op](auto a, auto b) { return compareValues(op, a, b); }, op1,
+            op2)));
       } else if (isString(op1) && isString(op2)) {
-        auto v1 = asCppString(op1);
-        auto v2 = asCppString(op2);
-        compareValues(op, v1, v2);
+        push(makeBoolean(compareStrings(op, op1, op2)));
+      } else {
+        push(makeBoolean(compareOthers(op, op1, op2)));
       }
-      break;
+      DISPATCH();
     }
-    case OpCode::JMP_IF_FALSE: {
-      auto cond = asBoolean(pop());
-      auto address = readShort();
-
-      if (!cond) {
-        ip = toAddress(address);
+    OP_CASE(JMP_IF_FALSE): {
+      if (!asBoolean(pop())) {
+        pc = instruction->target;
       }
 
-      break;
+      DISPATCH();
     }
 
-    case OpCode::JMP: {
-      ip = toAddress(readShort());
-      break;
-    }
+    OP_CASE(JMP):
+      jumpTo(instruction->target);
+      DISPATCH();
 
-    case OpCode::GET_GLOBAL: {
-      auto globalIndex = readByte();
-      push(global->get(globalIndex).value);
-      break;
-    }
+    OP_CASE(GET_GLOBAL):
+      push(instruction->global->value);
+      DISPATCH();
 
-    case OpCode::SET_GLOBAL: {
-      auto globalIndex = readByte();
-      auto value = pop();
-      global->set(globalIndex, value);
-      break;
-    }
+    OP_CASE(SET_GLOBAL):
+      global->set(*instruction->global, peek(0));
+      DISPATCH();
 
-    case OpCode::POP: {
+    OP_CASE(POP): {
       pop();
-      break;
+      DISPATCH();
     }
 
-    case OpCode::GET_LOCAL: {
-      auto localIndex = readByte();
-      if (localIndex < 0 || localIndex >= stack.size()) {
-        DIE << "OP_GET_LOCAL: invalid variable index: " << (int)localIndex;
+    OP_CASE(GET_LOCAL):
+      push(bp[instruction->operand]);
+      DISPATCH();
+
+    OP_CASE(SET_LOCAL):
+      bp[instruction->operand] = peek(0);
+      DISPATCH();
+
+    OP_CASE(SCOPE_EXIT):
+      scopeExit(instruction->operand);
+      DISPATCH();
+
+    OP_CASE(CALL):
+    OP_CASE(TAIL_CALL): {
+      auto isTailCall =
+          instruction->opcode == static_cast<uint8_t>(OpCode::TAIL_CALL);
+      auto argsCount = instruction->operand;
+
+      if (instruction->site != nullptr) {
+        auto &site = *instruction->site;
+
+        // Monomorphic hit: the global still holds the cached callee, so
+        // the type dispatch on the callee slot is skipped
+        if (site.function != nullptr) {
+          if (isTailCall) {
+            tailCallFunction(site.function, site.entry, argsCount);
+          } else {
+            callFunction(site.function, site.entry, argsCount);
+          }
+          jitSafepoint(true);
+          DISPATCH();
+        }
+
+        if (site.native != nullptr) {
+          callNative(site.native, sp - argsCount - 1, argsCount);
+          sp -= argsCount;
+          jitSafepoint(false);
+          DISPATCH();
+        }
+
+        cacheCallSite(site, peek(argsCount));
+      }
+
+      auto fnValue = peek(argsCount);
+
+      if (isNative(fnValue)) {
+        callNative(asNative(fnValue), sp - argsCount - 1, argsCount);
+        sp -= argsCount;
+        jitSafepoint(false);
+        DISPATCH();
+      }
+
+      auto callee = asFunction(fnValue);
+      if (isTailCall) {
+        tailCallFunction(callee, entryOf(callee->co), argsCount);
+      } else {
+        callFunction(callee, entryOf(callee->co), argsCount);
       }
-      push(bp[localIndex]);
-      break;
+      jitSafepoint(true);
+
+      DISPATCH();
     }
 
-    case OpCode::SET_LOCAL: {
-      auto localIndex = readByte();
-      auto value = peek(0);
-      if (localIndex < 0 || localIndex >= stack.size()) {
-        DIE << "OP_SET_LOCAL: invalid variable index: " << (int)localIndex;
+    OP_CASE(RETURN): {
+      if (returnsFromCoroutine()) {
+        finishCoroutine(peek(0));
+      } else {
+        popFrame();
       }
-      bp[localIndex] = value;
-      break;
+      jitSafepoint(false);
+
+      DISPATCH();
     }
 
-    case OpCode::SCOPE_EXIT: {
-      auto count = readByte();
+    OP_CASE(GET_CELL):
+      push(cellAt(instruction->operand)->value);
+      DISPATCH();
 
-      *(sp - 1 - count) = peek(0);
+    OP_CASE(SET_CELL):
+      setCell(instruction->operand, peek(0));
+      DISPATCH();
 
-      popN(count);
-      break;
-    }
+    OP_CASE(LOAD_CELL):
+      push(cell(cellAt(instruction->operand)));
+      DISPATCH();
 
-    case OpCode::CALL: {
-      auto argsCount = readByte();
-      auto fnValue = peek(argsCount);
+    OP_CASE(MAKE_FUNCTION):
+      makeFunction(instruction->operand);
+      DISPATCH();
 
-      if (isNative(fnValue)) {
-        asNative(fnValue)->function();
-        auto result = pop();
+    OP_CASE(MAKE_ARRAY):
+      makeArray(instruction->operand);
+      DISPATCH();
 
-        popN(argsCount + 1);
+    OP_CASE(GET_INDEX):
+      getIndex();
+      DISPATCH();
 
-        push(result);
+    OP_CASE(SET_INDEX):
+      setIndex();
+      DISPATCH();
 
-        break;
-      }
+    OP_CASE(LENGTH):
+      push(lengthOf(pop()));
+      DISPATCH();
 
-      auto callee = asFunction(fnValue);
+    OP_CASE(MAKE_OBJECT):
+      makeRecord(instruction->shape);
+      DISPATCH();
 
-      callStack.push(Frame{ip, bp, fn});
+    OP_CASE(GET_PROP):
+      getProp(*instruction->property);
+      DISPATCH();
 
-      fn = callee;
-      fn->cells.resize(fn->co->freeCount);
-      bp = sp - argsCount - 1;
-      ip = &callee->co->code[0];
+    OP_CASE(SET_PROP):
+      setProp(*instruction->property);
+      DISPATCH();
 
-      break;
-    }
+    OP_CASE(FOR_PREP):
+      if (!forPrep(bp + instruction->operand)) {
+        pc = instruction->target;
+      }
+      DISPATCH();
 
-    case OpCode::RETURN: {
-      auto callerFrame = callStack.top();
-      ip = callerFrame.ra;
-      bp = callerFrame.bp;
-      fn = callerFrame.fn;
-      callStack.pop();
+    OP_CASE(FOR_LOOP):
+      if (forLoop(bp + instruction->operand)) {
+        jumpTo(instruction->target);
+      }
+      DISPATCH();
 
-      break;
-    }
+    OP_CASE(FOR_EACH_PREP):
+      if (!forEachPrep(bp + instruction->operand)) {
+        pc = instruction->target;
+      }
+      DISPATCH();
 
-    case OpCode::GET_CELL: {
-      auto cellIndex = readByte();
-      push(fn->cells[cellIndex]->value);
-      break;
+    OP_CASE(FOR_EACH_LOOP):
+      if (forEachLoop(bp + instruction->operand)) {
+        jumpTo(instruction->target);
+      }
+      DISPATCH();
+
+    // The coroutine slot takes the result of the resume
+    OP_CASE(RESUME): {
+      auto value = pop();
+      resumeCoroutine(peek(0), sp - 1, value);
+      jitSafepoint(false);
+      DISPATCH();
     }
 
-    case OpCode::SET_CELL: {
-      auto cellIndex = readByte();
-      auto value = peek(0);
-      if (fn->cells.size() <= cellIndex) {
-        maybeGC();
-        fn->cells.push_back(asCell(allocCell(value)));
+    OP_CASE(YIELD):
+      yieldCoroutine(sp - 1, peek(0));
+      jitSafepoint(false);
+      DISPATCH();
+
+    OP_CASE(JLT):
+      jumpUnless(
+          instruction, [](const auto &a, const auto &b) { return a >= b; },
+          OpCode::JLT_NUM);
+      DISPATCH();
+
+    OP_CASE(JGT):
+      jumpUnless(
+          instruction, [](const auto &a, const auto &b) { return a <= b; },
+          OpCode::JGT_NUM);
+      DISPATCH();
+
+    OP_CASE(JEQ):
+      jumpUnless(instruction, std::not_equal_to<>(), OpCode::JEQ_NUM);
+      DISPATCH();
+
+    OP_CASE(JGE):
+      jumpUnless(
+          instruction, [](const auto &a, const auto &b) { return a < b; },
+          OpCode::JGE_NUM);
+      DISPATCH();
+
+    OP_CASE(JLE):
+      jumpUnless(
+          instruction, [](const auto &a, const auto &b) { return a > b; },
+          OpCode::JLE_NUM);
+      DISPATCH();
+
+    OP_CASE(JNE):
+      jumpUnless(instruction, std::equal_to<>(), OpCode::JNE_NUM);
+      DISPATCH();
+
+    OP_CASE(COMPARE_NUM_LT):
+      numberCompare(instruction, [](auto a, auto b) { return a < b; });
+      DISPATCH();
+
+    OP_CASE(COMPARE_NUM_GT):
+      numberCompare(instruction, [](auto a, auto b) { return a > b; });
+      DISPATCH();
+
+    OP_CASE(COMPARE_NUM_EQ):
+      numberCompare(instruction, [](auto a, auto b) { return a == b; });
+      DISPATCH();
+
+    OP_CASE(COMPARE_NUM_GE):
+      numberCompare(instruction, [](auto a, auto b) { return a >= b; });
+      DISPATCH();
+
+    OP_CASE(COMPARE_NUM_LE):
+      numberCompare(instruction, [](auto a, auto b) { return a <= b; });
+      DISPATCH();
+
+    OP_CASE(COMPARE_NUM_NE):
+      numberCompare(instruction, [](auto a, auto b) { return a != b; });
+      DISPATCH();
+
+    OP_CASE(JLT_NUM):
+      numberJumpUnless(
+          instruction, [](auto a, auto b) { return a >= b; }, OpCode::JLT);
+      DISPATCH();
+
+    OP_CASE(JGT_NUM):
+      numberJumpUnless(
+          instruction, [](auto a, auto b) { return a <= b; }, OpCode::JGT);
+      DISPATCH();
+
+    OP_CASE(JEQ_NUM):
+      numberJumpUnless(
+          instruction, [](auto a, auto b) { return a != b; }, OpCode::JEQ);
+      DISPATCH();
+
+    OP_CASE(JGE_NUM):
+      numberJumpUnless(
+          instruction, [](auto a, auto b) { return a < b; }, OpCode::JGE);
+      DISPATCH();
+
+    OP_CASE(JLE_NUM):
+      numberJumpUnless(
+          instruction, [](auto a, auto b) { return a > b; }, OpCode::JLE);
+      DISPATCH();
+
+    OP_CASE(JNE_NUM):
+      numberJumpUnless(
+          instruction, [](auto a, auto b) { return a == b; }, OpCode::JNE);
+      DISPATCH();
+
+    OP_CASE(ADD_LOCAL_CONST): {
+      auto &op1 = bp[instruction->operand];
+      auto &op2 = *instruction->constant;
+
+      if (isNumber(op1)) {
+        push(addNumbers(op1, op2));
       } else {
-        fn->cells[cellIndex]->value = value;
+        add(op1, op2);
       }
-      break;
+      DISPATCH();
     }
 
-    case OpCode::LOAD_CELL: {
-      auto cellIndex = readByte();
-      push(cell(fn->cells[cellIndex]));
-      break;
+    OP_CASE(SUB_LOCAL_CONST): {
+      auto &op1 = bp[instruction->operand];
+      auto &op2 = *instruction->constant;
+      requireNumbers("-", op1, op2);
+      push(subNumbers(op1, op2));
+      DISPATCH();
     }
 
-    case OpCode::MAKE_FUNCTION: {
-      auto co = asCode(pop());
-      auto cellsCount = readByte();
-      maybeGC();
-      auto fnValue = allocFunction(co);
-      auto fn = asFunction(fnValue);
-
-      for (auto i = 0; i < cellsCount; i++) {
-        fn->cells.push_back(asCell(pop()));
-      }
-      push(fnValue);
-      break;
+    OP_DEFAULT:
+      DIE << "Unknown opcode: " << std::hex << std::setw(2) << std::uppercase
+          << std::setfill('0') << (int)instruction->opcode;
     }
+  }
+}
 
-    default:
-      DIE << "Unknown opcode: " << std::hex << std::setw(2) << std::uppercase
-          << std::setfill('0') << (int)opcode;
+/**
+ * Elements of the array argument `value` of the native `name` as doubles:
+ * the unboxed storage of a numeric array, or else its numbers copied into
+ * `scratch`.
+ */
+static const std::vector<double> &numbersOf(const EvaValue &value,
+                                            const char *name,
+                                            std::vector<double> &scratch) {
+  if (!isArray(value)) {
+    DIE << name << ": " << evaValueToTypeString(value) << " is not an array.";
+  }
+
+  auto array = asArray(value);
+  if (array->isNumeric) {
+    return array->numbers;
+  }
+
+  scratch.clear();
+  for (const auto &element : array->values) {
+    if (!isNumber(element)) {
+      DIE << name << ": " << evaValueToConstantString(element)
+          << " is not a number.";
     }
+    scratch.push_back(asNumber(element));
+  }
+  return scratch;
+}
+
+static void requireSameLength(const char *name, const std::vector<double> &x,
+                              const std::vector<double> &y) {
+  if (x.size() != y.size()) {
+    DIE << name << ": arrays of " << x.size() << " and " << y.size()
+        << " elements.";
+  }
+}
+
+static MapObject *mapOf(const EvaValue &value, const char *name) {
+  if (!isMap(value)) {
+    DIE << name << ": " << evaValueToTypeString(value) << " is not a map.";
+  }
+  return asMap(value);
+}
+
+static void requireNonEmpty(const char *name, const std::vector<double> &x) {
+  if (x.empty()) {
+    DIE << name << ": empty array.";
   }
 }
 
 void EvaVm::setGlobalVariables() {
   global->addNativeFunction(
       "native-square",
-      [&]() {
-        auto x = asNumber(peek(0));
-        push(makeNumber(x * x));
+      [](EvaVm &, const EvaValue *args, size_t) {
+        return mulNumbers(args[0], args[0]);
       },
       1);
 
   global->addNativeFunction(
       "print",
-      [&]() {
-        auto x = peek(0);
+      [](EvaVm &, const EvaValue *args, size_t) {
+        auto x = args[0];
         log(x);
-        push(x);
+        return x;
+      },
+      1);
+
+  // Bulk natives over arrays of numbers, see ArrayKernels.h
+
+  global->addNativeFunction(
+      "sum",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        std::vector<double> scratch;
+        auto &x = numbersOf(args[0], "sum", scratch);
+        return makeNumber(sumDoubles(x.data(), x.size()));
+      },
+      1);
+
+  global->addNativeFunction(
+      "dot",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        std::vector<double> xScratch, yScratch;
+        auto &x = numbersOf(args[0], "dot", xScratch);
+        auto &y = numbersOf(args[1], "dot", yScratch);
+        requireSameLength("dot", x, y);
+        return makeNumber(dotDoubles(x.data(), y.data(), x.size()));
+      },
+      2);
+
+  global->addNativeFunction(
+      "min",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        std::vector<double> scratch;
+        auto &x = numbersOf(args[0], "min", scratch);
+        requireNonEmpty("min", x);
+        return makeNumber(minDouble(x.data(), x.size()));
+      },
+      1);
+
+  global->addNativeFunction(
+      "max",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        std::vector<double> scratch;
+        auto &x = numbersOf(args[0], "max", scratch);
+        requireNonEmpty("max", x);
+        return makeNumber(maxDouble(x.data(), x.size()));
+      },
+      1);
+
+  // (map-add array array) adds element-wise, (map-add array number) adds
+  // the number to every element
+  global->addNativeFunction(
+      "map-add",
+      [](EvaVm &vm, const EvaValue *args, size_t) {
+        std::vector<double> xScratch, yScratch;
+        auto &x = numbersOf(args[0], "map-add", xScratch);
+        std::vector<double> result(x.size());
+
+        if (isNumber(args[1])) {
+          addScalar(x.data(), asNumber(args[1]), result.data(), x.size());
+        } else {
+          auto &y = numbersOf(args[1], "map-add", yScratch);
+          requireSameLength("map-add", x, y);
+          addDoubles(x.data(), y.data(), result.data(), x.size());
+        }
+
+        vm.maybeGC();
+        return allocArray(std::move(result));
+      },
+      2);
+
+  global->addNativeFunction(
+      "scale",
+      [](EvaVm &vm, const EvaValue *args, size_t) {
+        std::vector<double> scratch;
+        auto &x = numbersOf(args[0], "scale", scratch);
+        if (!isNumber(args[1])) {
+          DIE << "scale: " << evaValueToConstantString(args[1])
+              << " is not a number.";
+        }
+        std::vector<double> result(x.size());
+        scaleDoubles(x.data(), asNumber(args[1]), result.data(), x.size());
+
+        vm.maybeGC();
+        return allocArray(std::move(result));
+      },
+      2);
+
+  // Maps, see MapObject; the index forms get and set their entries and
+  // (len map) counts them
+
+  global->addNativeFunction(
+      "make-map",
+      [](EvaVm &vm, const EvaValue *, size_t) {
+        vm.maybeGC();
+        return allocMap();
+      },
+      0);
+
+  global->addNativeFunction(
+      "has",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        return makeBoolean(mapOf(args[0], "has")->find(args[1]) != nullptr);
+      },
+      2);
+
+  global->addNativeFunction(
+      "delete",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        return makeBoolean(mapOf(args[0], "delete")->remove(args[1]));
+      },
+      2);
+
+  // (keys map) and (values map) list the entries in the same order, for
+  // iterating over the map with the index forms. Both collect before
+  // copying the entries, which are no roots in the copy: a collection
+  // afterwards could drop them from a weak map and free them
+
+  global->addNativeFunction(
+      "keys",
+      [](EvaVm &vm, const EvaValue *args, size_t) {
+        vm.maybeGC();
+        std::vector<EvaValue> keys;
+        for (auto &entry : mapOf(args[0], "keys")->entries) {
+          if (entry.isLive()) {
+            keys.push_back(entry.key);
+          }
+        }
+        return allocArray(keys.data(), keys.size());
+      },
+      1);
+
+  global->addNativeFunction(
+      "values",
+      [](EvaVm &vm, const EvaValue *args, size_t) {
+        vm.maybeGC();
+        std::vector<EvaValue> values;
+        for (auto &entry : mapOf(args[0], "values")->entries) {
+          if (entry.isLive()) {
+            values.push_back(entry.value);
+          }
+        }
+        return allocArray(values.data(), values.size());
+      },
+      1);
+
+  // Caches that the collector may shrink: a weak map is a map whose
+  // object keys don't keep their entries alive, see MapObject::weakKeys,
+  // and (deref ref) is the target of a weak reference, or false once it
+  // has been collected
+
+  global->addNativeFunction(
+      "make-weak-map",
+      [](EvaVm &vm, const EvaValue *, size_t) {
+        vm.maybeGC();
+        return allocMap(true);
+      },
+      0);
+
+  global->addNativeFunction(
+      "weak-ref",
+      [](EvaVm &vm, const EvaValue *args, size_t) {
+        vm.maybeGC();
+        return allocWeakRef(args[0]);
+      },
+      1);
+
+  global->addNativeFunction(
+      "deref",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        if (!isWeakRef(args[0])) {
+          DIE << "deref: " << evaValueToTypeString(args[0])
+              << " is not a weak reference.";
+        }
+        return asWeakRef(args[0])->target;
+      },
+      1);
+
+  // Coroutines, see CoroutineObject; (resume co value) and (yield value)
+  // are special forms
+
+  global->addNativeFunction(
+      "coroutine",
+      [](EvaVm &vm, const EvaValue *args, size_t) {
+        if (!isFunction(args[0])) {
+          DIE << "coroutine: " << evaValueToTypeString(args[0])
+              << " is not a function.";
+        }
+        auto fn = asFunction(args[0]);
+        if (fn->co->arity > 1) {
+          DIE << "coroutine: " << fn->co->name << " takes " << fn->co->arity
+              << " parameters, a coroutine takes at most 1.";
+        }
+        vm.maybeGC();
+        return allocCoroutine(fn);
+      },
+      1);
+
+  global->addNativeFunction(
+      "status",
+      [](EvaVm &, const EvaValue *args, size_t) {
+        if (!isCoroutine(args[0])) {
+          DIE << "status: " << evaValueToTypeString(args[0])
+              << " is not a coroutine.";
+        }
+        return allocString(coroutineStatusString(asCoroutine(args[0])->status));
       },
       1);
 
@@ -1,33 +1,353 @@
 #ifndef __EvaVM_h
 #define __EvaVM_h
 
+#include "../bytecode/OpCode.h"
+#include "../bytecode/RegisterOpCode.h"
 #include "../compiler/EvaCompiler.h"
 #include "../gc/EvaCollector.h"
+#include "../jit/EvaJit.h"
+#include "../verifier/EvaVerifier.h"
+#include "DecodedCode.h"
 #include "EvaValue.h"
 #include "Global.h"
+#include "StackRegion.h"
 #include <array>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <type_traits>
 
-constexpr size_t STACK_LIMIT = 512;
+/**
+ * Default capacity of the value stack, in values. The region is reserved
+ * up front but only committed as the stack grows into it.
+ */
+constexpr size_t DEFAULT_STACK_SIZE = 1 << 20;
 constexpr size_t GC_TRESHOLD = 417;
 
-struct Frame {
-  uint8_t *ra;
-  EvaValue *bp;
-  FunctionObject *fn;
+/**
+ * Instruction set executed by a VM instance: the stack machine, or the
+ * register machine whose operands address frame slots relative to bp.
+ */
+enum class EvalMode {
+  STACK,
+  REGISTER,
+};
+
+/**
+ * Instrumentation of the stack tier interpreter, fixed when the VM is
+ * created. All off is the lean production loop; any of them keeps the
+ * JIT off, so that every instruction goes through the interpreter.
+ */
+struct EvalOptions {
+  // Re-validates stack depth and local / cell operands before each
+  // instruction, on top of what the verifier proved
+  bool checked = false;
+
+  // Dumps each instruction with the value stack it runs on
+  bool tracing = false;
+
+  // Counts executed instructions per opcode, and prints GC stats
+  bool profiling = false;
+
+  /**
+   * Options from the EVA_CHECKED, EVA_TRACE and EVA_PROFILE environment
+   * variables.
+   */
+  static EvalOptions fromEnvironment();
+};
+
+/**
+ * Compile-time form of EvalOptions: eval() is instantiated once per
+ * policy, so disabled instrumentation costs nothing.
+ */
+template <bool Checked, bool Tracing, bool Profiling> struct EvalPolicy {
+  static constexpr bool checked = Checked;
+  static constexpr bool tracing = Tracing;
+  static constexpr bool profiling = Profiling;
 };
 
 class EvaVm {
+  friend class EvaJit;
+
   uint8_t readByte();
   uint16_t readShort();
   uint8_t *toAddress(size_t index);
   EvaValue &getConst();
+  EvaValue &readRK();
+
+  void binaryOp(const char *name,
+                EvaValue (*op)(const EvaValue &, const EvaValue &));
+
+  void add(const EvaValue &op1, const EvaValue &op2);
+
+  /**
+   * Cell `cellIndex` of the running activation: the captured free cells
+   * of fn come first, followed by the own cells in env.
+   */
+  CellObject *cellAt(size_t cellIndex);
+
+  void setCell(size_t cellIndex, const EvaValue &value);
+
+  /**
+   * Allocates the own cells of a fresh activation of fn into env.
+   */
+  void allocCells();
+
+  void scopeExit(size_t count);
+
+  void makeFunction(size_t cellsCount);
+
+  void makeArray(size_t count);
+
+  void getIndex();
+
+  void setIndex();
+
+  void makeRecord(Shape *shape);
+
+  void getProp(PropertyCache &cache);
+
+  void setProp(PropertyCache &cache);
+
+  using EvalLoop = EvaValue (EvaVm::*)();
+
+  /**
+   * The interpreter loop of the stack tier, instrumented per `Policy`.
+   */
+  template <typename Policy> EvaValue evalLoop();
+
+  static EvalLoop selectEvalLoop(const EvalOptions &options);
+
+  template <typename Policy> void beforeInstruction(Instruction *instruction);
+
+  void checkInstruction(Instruction *instruction);
+
+  void traceInstruction(Instruction *instruction);
+
+  void printProfile();
+
+  /**
+   * Unconditional jump; backward jumps are loop back-edges for the JIT.
+   */
+  void jumpTo(Instruction *target);
+
+  /**
+   * First instruction of the decoded form of `co`, verifying and decoding
+   * it on first use.
+   */
+  Instruction *entryOf(CodeObject *co);
 
-  void binaryOp(double (*op)(double, double));
+  Instruction *decode(CodeObject *co);
 
-  template <typename T> void compareValues(uint8_t &op, T v1, T v2) {
+  void cacheCallSite(CallSiteCache &site, const EvaValue &fnValue);
+
+  /**
+   * Calls `native` on the `argsCount` values after `callee`, and replaces
+   * the callee slot with the result.
+   */
+  void callNative(NativeObject *native, EvaValue *callee, size_t argsCount);
+
+  void callFunction(FunctionObject *callee, Instruction *entry,
+                    size_t argsCount);
+
+  void tailCallFunction(FunctionObject *callee, Instruction *entry,
+                        size_t argsCount);
+
+  void pushFrame();
+
+  void popFrame();
+
+  /**
+   * Runs `co` on top of the current activation until it yields or
+   * returns, which writes the value to `result`: calls its function on
+   * the first resume, moves its saved activations back onto the stacks
+   * on the next ones, where the pending yield gets `value`.
+   */
+  void resumeCoroutine(const EvaValue &co, EvaValue *result,
+                       const EvaValue &value);
+
+  /**
+   * Suspends the running coroutine at a yield whose resume value goes to
+   * `slot`, saving its activations, and returns `value` to its resumer.
+   */
+  void yieldCoroutine(EvaValue *slot, const EvaValue &value);
+
+  /**
+   * Whether a RETURN from the current frame ends the running coroutine,
+   * rather than returning to a caller inside of it.
+   */
+  bool returnsFromCoroutine();
+
+  /**
+   * RETURN out of a coroutine: it is dead, and `value` goes to the
+   * resumer.
+   */
+  void finishCoroutine(const EvaValue &value);
+
+  /**
+   * Back to the resumer of the running coroutine, with `value` as the
+   * result of its resume.
+   */
+  void leaveCoroutine(const EvaValue &value);
+
+  /**
+   * Interpreter points where compiled code may be entered: function
+   * entries, returns and loop back-edges. `countHotness` marks the ones
+   * that count towards tiering up the current CodeObject.
+   */
+  void jitSafepoint(bool countHotness);
+
+  /**
+   * Rewrites the opcode of `instruction` in place (type quickening), in
+   * the decoded form and, for the JIT, in the byte code.
+   */
+  void quicken(Instruction *instruction, OpCode op);
+
+  /**
+   * Undoes a quickening whose type guess failed: restores the generic
+   * opcode and rewinds pc so that it re-executes the instruction.
+   */
+  void deoptimize(Instruction *instruction, OpCode genericOp);
+
+  /**
+   * Fused compare-and-branch: pops both operands and jumps to the target
+   * unless `compare` holds. Operands of different types never compare,
+   * so they always take the jump. A numeric pair quickens the
+   * instruction to `numberOp`.
+   */
+  template <typename Compare>
+  void jumpUnless(Instruction *instruction, Compare compare,
+                  OpCode numberOp) {
+    auto op2 = pop();
+    auto op1 = pop();
+
+    if (isNumber(op1) && isNumber(op2)) {
+      quicken(instruction, numberOp);
+    }
+
+    if (!compareOperands(compare, op1, op2)) {
+      pc = instruction->target;
+    }
+  }
+
+  /**
+   * Quickened jumpUnless for numeric operands; falls back to `genericOp`.
+   */
+  template <typename Compare>
+  void numberJumpUnless(Instruction *instruction, Compare compare,
+                        OpCode genericOp) {
+    auto op2 = peek(0);
+    auto op1 = peek(1);
+
+    if (!isNumber(op1) || !isNumber(op2)) {
+      return deoptimize(instruction, genericOp);
+    }
+    popN(2);
+
+    if (!compareNumbers(compare, op1, op2)) {
+      pc = instruction->target;
+    }
+  }
+
+  /**
+   * Quickened COMPARE for numeric operands; falls back to COMPARE.
+   */
+  template <typename Compare>
+  void numberCompare(Instruction *instruction, Compare compare) {
+    auto op2 = peek(0);
+    auto op1 = peek(1);
+
+    if (!isNumber(op1) || !isNumber(op2)) {
+      return deoptimize(instruction, OpCode::COMPARE);
+    }
+    popN(2);
+    push(makeBoolean(compareNumbers(compare, op1, op2)));
+  }
+
+  /**
+   * Register form of jumpUnless: both operands are RK operands.
+   */
+  template <typename Compare> void registerJumpUnless(Compare compare) {
+    auto &op1 = readRK();
+    auto &op2 = readRK();
+    auto address = readShort();
+
+    if (!compareOperands(compare, op1, op2)) {
+      ip = toAddress(address);
+    }
+  }
+
+  /**
+   * Compares two numbers natively as integers when both are, as doubles
+   * otherwise.
+   */
+  template <typename Compare>
+  static bool compareNumbers(Compare compare, const EvaValue &op1,
+                             const EvaValue &op2) {
+    if (isInteger(op1) && isInteger(op2)) {
+      return compare(asInteger(op1), asInteger(op2));
+    }
+    return compare(asNumber(op1), asNumber(op2));
+  }
+
+  template <typename Compare>
+  static bool compareOperands(Compare compare, const EvaValue &op1,
+                              const EvaValue &op2) {
+    if (isNumber(op1) && isNumber(op2)) {
+      return compareNumbers(compare, op1, op2);
+    } else if (isString(op1) && isString(op2)) {
+      // Interned: equal strings are the same object
+      if constexpr (std::is_same_v<Compare, std::equal_to<>> ||
+                    std::is_same_v<Compare, std::not_equal_to<>>) {
+        return compare(internedString(op1), internedString(op2));
+      }
+      return compare(asStringView(op1), asStringView(op2));
+    }
+    if constexpr (std::is_same_v<Compare, std::equal_to<>>) {
+      return sameOther(op1, op2);
+    } else if constexpr (std::is_same_v<Compare, std::not_equal_to<>>) {
+      return !sameOther(op1, op2);
+    }
+    return false;
+  }
+
+  /**
+   * Operands that are not two numbers or two strings are only equal to
+   * themselves, the same boolean or object, and are never ordered.
+   */
+  static bool sameOther(const EvaValue &op1, const EvaValue &op2) {
+    if (isBoolean(op1) && isBoolean(op2)) {
+      return asBoolean(op1) == asBoolean(op2);
+    }
+    return isObject(op1) && isObject(op2) && asObject(op1) == asObject(op2);
+  }
+
+  /**
+   * COMPARE of operands that are not two numbers or two strings.
+   */
+  static bool compareOthers(uint8_t op, const EvaValue &op1,
+                            const EvaValue &op2) {
+    if (op == 2 || op == 5) {
+      return (op == 2) == sameOther(op1, op2);
+    }
+    return false;
+  }
+
+  /**
+   * COMPARE of two strings: == and != compare the interned objects, the
+   * orderings the characters in place.
+   */
+  static bool compareStrings(uint8_t op, const EvaValue &op1,
+                             const EvaValue &op2) {
+    if (op == 2 || op == 5) {
+      return compareValues(op, internedString(op1), internedString(op2));
+    }
+    return compareValues(op, asStringView(op1), asStringView(op2));
+  }
+
+  template <typename T>
+  static bool compareValues(uint8_t op, const T &v1, const T &v2) {
     bool res;
     switch (op) {
     case 0:
@@ -49,11 +369,12 @@ class EvaVm {
       res = v1 != v2;
       break;
     }
-    push(makeBoolean(res));
+    return res;
   }
 
 public:
-  EvaVm();
+  EvaVm(EvalMode mode = EvalMode::STACK,
+        size_t stackSize = DEFAULT_STACK_SIZE, EvalOptions options = {});
 
   ~EvaVm();
 
@@ -73,33 +394,186 @@ public:
 
   std::set<Traceable *> getGlobalGCRoots();
 
+  std::set<Traceable *> getCellGCRoots();
+
+  std::set<Traceable *> getCoroutineGCRoots();
+
   void maybeGC();
 
   EvaValue exec(const std::string &program);
 
+  /**
+   * Runs the stack tier with the interpreter loop selected by `options`.
+   */
   EvaValue eval();
 
+  EvaValue evalRegister();
+
   void setGlobalVariables();
 
+  /**
+   * Turns the baseline JIT of the stack tier on or off (on by default in
+   * EVA_JIT builds).
+   */
+  void setJitEnabled(bool enabled);
+
+  EvalMode mode;
+
+  EvalOptions options;
+
   std::shared_ptr<Global> global;
 
   std::unique_ptr<EvaCompiler> compiler;
 
   std::unique_ptr<EvaCollector> collector;
 
+  std::unique_ptr<EvaVerifier> verifier;
+
+#ifdef EVA_JIT
+  std::unique_ptr<EvaJit> jit;
+#endif
+
+  // Next byte of the register tier, and where compiled code exits to
   uint8_t *ip;
 
+  // Next instruction of the stack tier, in the decoded form of fn->co
+  Instruction *pc;
+
   EvaValue *sp;
 
   EvaValue *bp;
 
-  std::array<EvaValue, STACK_LIMIT> stack;
+  StackRegion<EvaValue> stack;
+
+  /**
+   * Call frames, contiguous; `frame` points one past the innermost one.
+   * Every frame holds at least its callee on the value stack, so the
+   * frame region never needs more entries than the value stack.
+   */
+  StackRegion<Frame> frames;
 
-  std::stack<Frame> callStack;
+  Frame *frame;
 
   FunctionObject *fn;
 
+  // Own cells of the running activation, null when its code has none
+  CellBlockObject *env = nullptr;
+
   void dumpStack();
+
+private:
+  std::vector<std::unique_ptr<DecodedCode>> decodedCodes_;
+
+  EvalLoop evalLoop_;
+
+  // Handler labels of the selected loop, for decoding and quickening
+  void *const *handlers_ = nullptr;
+
+  std::array<uint64_t, 256> opcodeCounts_{};
+
+  // Innermost running coroutine, null on the main activations
+  CoroutineObject *coroutine_ = nullptr;
 };
 
+// Overflow and underflow of the whole stack run into its guard pages, see
+// StackRegion; underflow of a frame is caught by the checked interpreter
+inline void EvaVm::push(const EvaValue &value) { *sp++ = value; }
+
+inline EvaValue EvaVm::peek(size_t offset) { return *(sp - 1 - offset); }
+
+inline EvaValue EvaVm::pop() { return *--sp; }
+
+inline void EvaVm::popN(size_t count) { sp -= count; }
+
+template <typename Policy>
+inline void EvaVm::beforeInstruction(Instruction *instruction) {
+  if constexpr (Policy::checked) {
+    checkInstruction(instruction);
+  }
+  if constexpr (Policy::tracing) {
+    traceInstruction(instruction);
+  }
+  if constexpr (Policy::profiling) {
+    ++opcodeCounts_[instruction->opcode];
+  }
+}
+
+inline uint8_t EvaVm::readByte() { return *ip++; }
+
+inline uint16_t EvaVm::readShort() {
+  ip += 2;
+  return (((uint16_t)ip[-2]) << 8) | ip[-1];
+}
+
+inline uint8_t *EvaVm::toAddress(size_t index) { return &fn->co->code[index]; }
+
+inline void EvaVm::deoptimize(Instruction *instruction, OpCode genericOp) {
+  quicken(instruction, genericOp);
+  pc = instruction;
+}
+
+inline Instruction *EvaVm::entryOf(CodeObject *co) {
+  if (co->decoded == nullptr) {
+    return decode(co);
+  }
+  return &co->decoded->instructions[0];
+}
+
+inline void EvaVm::pushFrame() { *frame++ = Frame{pc, ip, bp, fn, env}; }
+
+inline void EvaVm::popFrame() {
+  --frame;
+  pc = frame->pc;
+  ip = frame->ra;
+  bp = frame->bp;
+  fn = frame->fn;
+  env = frame->env;
+}
+
+inline bool EvaVm::returnsFromCoroutine() {
+  return coroutine_ != nullptr && frame == coroutine_->entryFrame;
+}
+
+inline CellObject *EvaVm::cellAt(size_t cellIndex) {
+  auto freeCount = fn->co->freeCount;
+  if (cellIndex < freeCount) {
+    return fn->cells[cellIndex];
+  }
+  return &env->cells()[cellIndex - freeCount];
+}
+
+inline void EvaVm::setCell(size_t cellIndex, const EvaValue &value) {
+  cellAt(cellIndex)->value = value;
+}
+
+inline void EvaVm::jitSafepoint(bool countHotness) {
+#ifdef EVA_JIT
+  if (jit == nullptr) {
+    return;
+  }
+
+  if (countHotness) {
+    jit->countHotness(fn->co);
+  }
+
+  // Compiled code works on byte code offsets
+  if (auto code = fn->co->jitCode.load(std::memory_order_acquire)) {
+    auto bytecode = &fn->co->code[0];
+    ip = bytecode + pc->offset;
+    jit->run(code);
+    pc = fn->co->decoded->at(ip - bytecode);
+  }
+#endif
+}
+
+inline EvaValue &EvaVm::getConst() { return fn->co->constants[readByte()]; }
+
+inline EvaValue &EvaVm::readRK() {
+  auto operand = readByte();
+  if (operand & REGISTER_CONST_BIT) {
+    return fn->co->constants[operand & ~REGISTER_CONST_BIT];
+  }
+  return bp[operand];
+}
+
 #endif // !__EvaVM_h
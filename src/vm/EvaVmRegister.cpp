@@ -0,0 +1,430 @@
+#include "../Logger.h"
+#include "../bytecode/RegisterOpCode.h"
+#include "Dispatch.h"
+#include "EvaValue.h"
+#include "EvaVm.h"
+#include "Global.h"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ios>
+#include <string>
+
+/**
+ * Interpreter loop of the register tier. Each frame owns the slots
+ * bp[0, frameSize): the callee, its arguments, locals and temporaries.
+ * sp is kept at the top of the current frame, so the stack GC roots and
+ * native functions see the same value stack as in the stack tier.
+ */
+
+#define DISPATCH_OPCODE RegisterOpCode
+#define DISPATCH_FETCH() (opcode = readByte())
+#define DISPATCH_TARGET() dispatchTable[DISPATCH_FETCH()]
+
+EvaValue EvaVm::evalRegister() {
+#ifdef EVA_COMPUTED_GOTO
+  static void *dispatchTable[256];
+  static bool dispatchTableReady = false;
+
+  if (!dispatchTableReady) {
+    for (auto &label : dispatchTable) {
+      label = &&op_UNKNOWN;
+    }
+    DISPATCH_LABEL(HALT);
+    DISPATCH_LABEL(LOADK);
+    DISPATCH_LABEL(MOVE);
+    DISPATCH_LABEL(ADD);
+    DISPATCH_LABEL(SUB);
+    DISPATCH_LABEL(MUL);
+    DISPATCH_LABEL(DIV);
+    DISPATCH_LABEL(COMPARE);
+    DISPATCH_LABEL(JMP_IF_FALSE);
+    DISPATCH_LABEL(JMP);
+    DISPATCH_LABEL(GET_GLOBAL);
+    DISPATCH_LABEL(SET_GLOBAL);
+    DISPATCH_LABEL(CALL);
+    DISPATCH_LABEL(RETURN);
+    DISPATCH_LABEL(GET_CELL);
+    DISPATCH_LABEL(SET_CELL);
+    DISPATCH_LABEL(LOAD_CELL);
+    DISPATCH_LABEL(MAKE_FUNCTION);
+    DISPATCH_LABEL(JLT);
+    DISPATCH_LABEL(JGT);
+    DISPATCH_LABEL(JEQ);
+    DISPATCH_LABEL(JGE);
+    DISPATCH_LABEL(JLE);
+    DISPATCH_LABEL(JNE);
+    DISPATCH_LABEL(TAIL_CALL);
+    DISPATCH_LABEL(MAKE_ARRAY);
+    DISPATCH_LABEL(GET_INDEX);
+    DISPATCH_LABEL(SET_INDEX);
+    DISPATCH_LABEL(LENGTH);
+    DISPATCH_LABEL(MAKE_OBJECT);
+    DISPATCH_LABEL(GET_PROP);
+    DISPATCH_LABEL(SET_PROP);
+    DISPATCH_LABEL(FOR_PREP);
+    DISPATCH_LABEL(FOR_LOOP);
+    DISPATCH_LABEL(FOR_EACH_PREP);
+    DISPATCH_LABEL(FOR_EACH_LOOP);
+    DISPATCH_LABEL(RESUME);
+    DISPATCH_LABEL(YIELD);
+    dispatchTableReady = true;
+  }
+#endif
+
+  uint8_t opcode;
+
+  for (;;) {
+    DISPATCH_SWITCH {
+    OP_CASE(HALT):
+      return bp[readByte()];
+
+    OP_CASE(LOADK): {
+      auto &reg = bp[readByte()];
+      reg = getConst();
+      DISPATCH();
+    }
+
+    OP_CASE(MOVE): {
+      auto &reg = bp[readByte()];
+      reg = bp[readByte()];
+      DISPATCH();
+    }
+
+    OP_CASE(ADD): {
+      auto &reg = bp[readByte()];
+      auto &op1 = readRK();
+      auto &op2 = readRK();
+
+      if (isNumber(op1) && isNumber(op2)) {
+        reg = addNumbers(op1, op2);
+      } else if (isString(op1) && isString(op2)) {
+        reg = concatStrings(op1, op2);
+        maybeGC();
+      } else {
+        operandTypeError("+", "two numbers or two strings", op1, op2);
+      }
+      DISPATCH();
+    }
+
+    OP_CASE(SUB): {
+      auto &reg = bp[readByte()];
+      auto &op1 = readRK();
+      auto &op2 = readRK();
+      requireNumbers("-", op1, op2);
+      reg = subNumbers(op1, op2);
+      DISPATCH();
+    }
+
+    OP_CASE(MUL): {
+      auto &reg = bp[readByte()];
+      auto &op1 = readRK();
+      auto &op2 = readRK();
+      requireNumbers("*", op1, op2);
+      reg = mulNumbers(op1, op2);
+      DISPATCH();
+    }
+
+    OP_CASE(DIV): {
+      auto &reg = bp[readByte()];
+      auto &op1 = readRK();
+      auto &op2 = readRK();
+      requireNumbers("/", op1, op2);
+      reg = divNumbers(op1, op2);
+      DISPATCH();
+    }
+
+    OP_CASE(COMPARE): {
+      auto &reg = bp[readByte()];
+      auto &op1 = readRK();
+      auto &op2 = readRK();
+      auto op = readByte();
+
+      bool res;
+      if (isNumber(op1) && isNumber(op2)) {
+        res = compareNumbers(
+            [op](auto a, auto b) { return compareValues(op, a, b); }, op1,
+            op2);
+      } else if (isString(op1) && isString(op2)) {
+        res = compareStrings(op, op1, op2);
+      } else {
+        res = compareOthers(op, op1, op2);
+      }
+      reg = makeBoolean(res);
+      DISPATCH();
+    }
+
+    OP_CASE(JMP_IF_FALSE): {
+      auto cond = asBoolean(readRK());
+      auto address = readShort();
+
+      if (!cond) {
+        ip = toAddress(address);
+      }
+      DISPATCH();
+    }
+
+    OP_CASE(JMP): {
+      ip = toAddress(readShort());
+      DISPATCH();
+    }
+
+    OP_CASE(GET_GLOBAL): {
+      auto &reg = bp[readByte()];
+      reg = global->get(readByte()).value;
+      DISPATCH();
+    }
+
+    OP_CASE(SET_GLOBAL): {
+      auto &reg = bp[readByte()];
+      global->set(readByte(), reg);
+      DISPATCH();
+    }
+
+    OP_CASE(CALL): {
+      auto base = readByte();
+      auto argsCount = readByte();
+      auto fnValue = bp[base];
+
+      if (isNative(fnValue)) {
+        callNative(asNative(fnValue), bp + base, argsCount);
+        DISPATCH();
+      }
+
+      auto callee = asFunction(fnValue);
+
+      pushFrame();
+
+      fn = callee;
+      bp = bp + base;
+      sp = bp + fn->co->frameSize;
+
+      if (sp > stack.end()) {
+        DIE << "CALL: Stack overflow.\n";
+      }
+
+      // Slots past the arguments may hold stale values of a finished
+      // frame, which must not be seen as GC roots
+      std::fill(bp + argsCount + 1, sp, makeBoolean(false));
+      allocCells();
+
+      ip = &fn->co->code[0];
+      DISPATCH();
+    }
+
+    OP_CASE(TAIL_CALL): {
+      auto base = readByte();
+      auto argsCount = readByte();
+      auto fnValue = bp[base];
+
+      if (isNative(fnValue)) {
+        callNative(asNative(fnValue), bp + base, argsCount);
+        DISPATCH();
+      }
+
+      // The callee and its arguments move down over the current frame,
+      // which the callee then returns from directly
+      std::copy(bp + base, bp + base + argsCount + 1, bp);
+
+      fn = asFunction(fnValue);
+      sp = bp + fn->co->frameSize;
+
+      if (sp > stack.end()) {
+        DIE << "TAIL_CALL: Stack overflow.\n";
+      }
+
+      std::fill(bp + argsCount + 1, sp, makeBoolean(false));
+      allocCells();
+
+      ip = &fn->co->code[0];
+      DISPATCH();
+    }
+
+    OP_CASE(RETURN): {
+      bp[0] = bp[readByte()];
+
+      if (returnsFromCoroutine()) {
+        finishCoroutine(bp[0]);
+        DISPATCH();
+      }
+
+      popFrame();
+
+      sp = bp + fn->co->frameSize;
+      DISPATCH();
+    }
+
+    OP_CASE(GET_CELL): {
+      auto &reg = bp[readByte()];
+      reg = cellAt(readByte())->value;
+      DISPATCH();
+    }
+
+    OP_CASE(SET_CELL): {
+      auto &reg = bp[readByte()];
+      setCell(readByte(), reg);
+      DISPATCH();
+    }
+
+    OP_CASE(LOAD_CELL): {
+      auto &reg = bp[readByte()];
+      reg = cell(cellAt(readByte()));
+      DISPATCH();
+    }
+
+    OP_CASE(MAKE_ARRAY): {
+      auto &reg = bp[readByte()];
+      auto base = readByte();
+      auto count = readByte();
+
+      maybeGC();
+      reg = allocArray(bp + base, count);
+      DISPATCH();
+    }
+
+    OP_CASE(GET_INDEX): {
+      auto &reg = bp[readByte()];
+      auto &array = readRK();
+      auto &index = readRK();
+      reg = getElement(array, index);
+      DISPATCH();
+    }
+
+    OP_CASE(SET_INDEX): {
+      auto &array = readRK();
+      auto &index = readRK();
+      setElement(array, index, bp[readByte()]);
+      DISPATCH();
+    }
+
+    OP_CASE(LENGTH): {
+      auto &reg = bp[readByte()];
+      reg = lengthOf(readRK());
+      DISPATCH();
+    }
+
+    OP_CASE(MAKE_OBJECT): {
+      auto &reg = bp[readByte()];
+      auto shape = fn->co->shapes[readByte()];
+      auto base = readByte();
+
+      maybeGC();
+      reg = allocRecord(shape, bp + base);
+      DISPATCH();
+    }
+
+    OP_CASE(GET_PROP): {
+      auto &reg = bp[readByte()];
+      auto &record = readRK();
+      reg = getProperty(record, fn->co->propertyCaches[readByte()]);
+      DISPATCH();
+    }
+
+    OP_CASE(SET_PROP): {
+      auto &record = readRK();
+      auto &cache = fn->co->propertyCaches[readByte()];
+      setProperty(record, cache, bp[readByte()]);
+      DISPATCH();
+    }
+
+    OP_CASE(FOR_PREP): {
+      auto slots = bp + readByte();
+      auto address = readShort();
+
+      if (!forPrep(slots)) {
+        ip = toAddress(address);
+      }
+      DISPATCH();
+    }
+
+    OP_CASE(FOR_LOOP): {
+      auto slots = bp + readByte();
+      auto address = readShort();
+
+      if (forLoop(slots)) {
+        ip = toAddress(address);
+      }
+      DISPATCH();
+    }
+
+    OP_CASE(FOR_EACH_PREP): {
+      auto slots = bp + readByte();
+      auto address = readShort();
+
+      if (!forEachPrep(slots)) {
+        ip = toAddress(address);
+      }
+      DISPATCH();
+    }
+
+    OP_CASE(FOR_EACH_LOOP): {
+      auto slots = bp + readByte();
+      auto address = readShort();
+
+      if (forEachLoop(slots)) {
+        ip = toAddress(address);
+      }
+      DISPATCH();
+    }
+
+    OP_CASE(RESUME): {
+      auto &reg = bp[readByte()];
+      auto co = readRK();
+      auto value = readRK();
+      resumeCoroutine(co, &reg, value);
+      DISPATCH();
+    }
+
+    OP_CASE(YIELD): {
+      auto &reg = bp[readByte()];
+      yieldCoroutine(&reg, readRK());
+      DISPATCH();
+    }
+
+    OP_CASE(MAKE_FUNCTION): {
+      auto &reg = bp[readByte()];
+      auto co = asCode(getConst());
+      auto base = readByte();
+      auto cellsCount = readByte();
+
+      maybeGC();
+      auto closure = asFunction(allocFunction(co));
+
+      closure->cells.resize(cellsCount);
+      for (auto i = 0; i < cellsCount; i++) {
+        closure->cells[i] = asCell(bp[base + i]);
+      }
+      reg = makeObject((Object *)closure);
+      DISPATCH();
+    }
+
+    OP_CASE(JLT):
+      registerJumpUnless([](const auto &a, const auto &b) { return a >= b; });
+      DISPATCH();
+
+    OP_CASE(JGT):
+      registerJumpUnless([](const auto &a, const auto &b) { return a <= b; });
+      DISPATCH();
+
+    OP_CASE(JEQ):
+      registerJumpUnless(std::not_equal_to<>());
+      DISPATCH();
+
+    OP_CASE(JGE):
+      registerJumpUnless([](const auto &a, const auto &b) { return a < b; });
+      DISPATCH();
+
+    OP_CASE(JLE):
+      registerJumpUnless([](const auto &a, const auto &b) { return a > b; });
+      DISPATCH();
+
+    OP_CASE(JNE):
+      registerJumpUnless(std::equal_to<>());
+      DISPATCH();
+
+    OP_DEFAULT:
+      DIE << "Unknown register opcode: " << std::hex << std::setw(2)
+          << std::uppercase << std::setfill('0') << (int)opcode;
+    }
+  }
+}
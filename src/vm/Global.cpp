@@ -1,5 +1,6 @@
 #include "Global.h"
 #include "../Logger.h"
+#include "../bytecode/OpCode.h"
 #include "EvaValue.h"
 
 void Global::define(const std::string &name) {
@@ -9,7 +10,7 @@ void Global::define(const std::string &name) {
     return;
   }
 
-  globals.push_back({name, makeNumber(0)});
+  globals.push_back({name, makeInteger(0)});
 }
 
 GlobalVar &Global::get(size_t index) { return globals[index]; }
@@ -18,11 +19,30 @@ void Global::set(size_t index, const EvaValue &value) {
   if (index >= globals.size()) {
     DIE << "Global " << index << " doesn't exist.";
   }
-  globals[index].value = value;
+  set(globals[index], value);
 }
 
-void Global::addNativeFunction(const std::string &name,
-                               std::function<void()> fn, size_t arity) {
+void Global::set(GlobalVar &globalVar, const EvaValue &value) {
+  globalVar.value = value;
+
+  for (auto site : globalVar.callSites) {
+    site->native = nullptr;
+    site->function = nullptr;
+    site->entry = nullptr;
+  }
+  globalVar.callSites.clear();
+}
+
+void Global::addNativeFunction(const std::string &name, NativeFn fn,
+                               size_t arity) {
+  if (fn == nullptr) {
+    DIE << "Native " << name << " has no function.";
+  }
+  if (arity > NARROW_INDEX_LIMIT) {
+    DIE << "Native " << name << " takes " << arity
+        << " arguments, a call passes at most " << NARROW_INDEX_LIMIT << ".";
+  }
+
   if (exists(name)) {
     return;
   }
@@ -30,12 +50,12 @@ void Global::addNativeFunction(const std::string &name,
   globals.push_back({name, allocNative(fn, name, arity)});
 }
 
-void Global::addConst(const std::string &name, double value) {
+void Global::addConst(const std::string &name, int32_t value) {
   if (exists(name)) {
     return;
   }
 
-  globals.push_back({name, makeNumber(value)});
+  globals.push_back({name, makeInteger(value)});
 }
 
 int Global::getGlobalIndex(const std::string &name) {
@@ -2,10 +2,14 @@
 #define __Global_h
 
 #include "EvaValue.h"
+#include <deque>
 
 struct GlobalVar {
   std::string name;
   EvaValue value;
+
+  // Call sites which cached the current value, invalidated on rebinding
+  std::vector<CallSiteCache *> callSites;
 };
 
 struct Global {
@@ -15,16 +19,23 @@ struct Global {
 
   void set(size_t index, const EvaValue &value);
 
-  void addNativeFunction(const std::string &name, std::function<void()> fn,
-                         size_t arity);
+  void set(GlobalVar &globalVar, const EvaValue &value);
+
+  /**
+   * Registers a native global. The arity is checked here, once, against
+   * what a CALL can pass; calls then only compare the argument count.
+   */
+  void addNativeFunction(const std::string &name, NativeFn fn, size_t arity);
 
-  void addConst(const std::string &name, double value);
+  void addConst(const std::string &name, int32_t value);
 
   int getGlobalIndex(const std::string &name);
 
   bool exists(const std::string &name);
 
-  std::vector<GlobalVar> globals;
+  // A deque, so that decoded code can keep pointers to the slots while
+  // new globals get defined
+  std::deque<GlobalVar> globals;
 };
 
 #endif // !__Global_h
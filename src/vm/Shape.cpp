@@ -0,0 +1,26 @@
+#include "Shape.h"
+#include <algorithm>
+
+Shape::Shape(Shape *parent, StringObject *name) : parent(parent) {
+  if (parent != nullptr) {
+    names = parent->names;
+    names.push_back(name);
+  }
+}
+
+int Shape::slotOf(StringObject *name) const {
+  auto it = std::find(names.begin(), names.end(), name);
+  return it == names.end() ? -1 : (int)(it - names.begin());
+}
+
+Shape *Shape::withProperty(StringObject *name) {
+  auto &child = transitions_[name];
+  if (child == nullptr) {
+    child = std::make_unique<Shape>(this, name);
+  }
+  return child.get();
+}
+
+void Shape::clearTransitions() { transitions_.clear(); }
+
+Shape Shape::root{nullptr, nullptr};
@@ -0,0 +1,78 @@
+#ifndef __Shape_h
+#define __Shape_h
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+struct StringObject;
+
+/**
+ * Hidden class of a record: the names of its properties, in slot order.
+ * Shapes form a tree rooted at the empty shape, each one reached from its
+ * parent by adding one property, so records built the same way share one
+ * shape and a shape pointer compare stands for the whole layout.
+ *
+ * Property names are interned strings held by the compiler's constants.
+ * The tree lives as long as the code referring to it and is not
+ * collected; Traceable::cleanup drops it.
+ */
+struct Shape {
+  Shape(Shape *parent, StringObject *name);
+
+  Shape *parent;
+
+  // Property names, by slot
+  std::vector<StringObject *> names;
+
+  /**
+   * Slot of the property `name`, or -1.
+   */
+  int slotOf(StringObject *name) const;
+
+  /**
+   * The shape with `name` added after the properties of this one.
+   */
+  Shape *withProperty(StringObject *name);
+
+  /**
+   * Drops the shapes reached from this one.
+   */
+  void clearTransitions();
+
+  static Shape root;
+
+private:
+  std::map<StringObject *, std::unique_ptr<Shape>> transitions_;
+};
+
+/**
+ * Inline cache of a GET_PROP / SET_PROP site: the shapes seen there with
+ * the slot of the property in each. A store that adds the property also
+ * records the shape it transitions to. One entry is the monomorphic case;
+ * once all entries are taken the site is megamorphic and looks the
+ * property up on every miss.
+ */
+struct PropertyCache {
+  struct Entry {
+    Shape *shape;
+
+    // Shape after a store that adds the property, else null
+    Shape *transition;
+
+    uint32_t slot;
+  };
+
+  static constexpr size_t SIZE = 4;
+
+  StringObject *name;
+
+  std::array<Entry, SIZE> entries;
+
+  uint8_t count = 0;
+};
+
+#endif // !__Shape_h
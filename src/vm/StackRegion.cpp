@@ -0,0 +1,129 @@
+#include "StackRegion.h"
+#include "../Logger.h"
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Guard pages of all live regions, read by the SIGSEGV handler: the page
+ * below a region catches underflow, the one above it overflow. A slot
+ * whose low page is 0 is free.
+ */
+constexpr size_t MAX_GUARDS = 64;
+
+struct GuardSlot {
+  std::atomic<uintptr_t> low;
+  std::atomic<uintptr_t> high;
+};
+
+static GuardSlot guardSlots[MAX_GUARDS];
+
+// Handler installed before ours, which gets every fault that isn't a guard
+static struct sigaction previousAction;
+
+static size_t pageSize() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+static bool inPage(uintptr_t address, uintptr_t page) {
+  return page != 0 && address >= page && address < page + pageSize();
+}
+
+static void fatal(const char *message, size_t length) {
+  write(STDERR_FILENO, message, length);
+  _exit(EXIT_FAILURE);
+}
+
+static void onSegmentationFault(int signal, siginfo_t *info, void *context) {
+  auto address = reinterpret_cast<uintptr_t>(info->si_addr);
+
+  for (auto &slot : guardSlots) {
+    if (inPage(address, slot.low.load(std::memory_order_relaxed))) {
+      static const char message[] = "\nFatal error: Stack underflow.\n";
+      fatal(message, sizeof(message) - 1);
+    }
+    if (inPage(address, slot.high.load(std::memory_order_relaxed))) {
+      static const char message[] = "\nFatal error: Stack overflow.\n";
+      fatal(message, sizeof(message) - 1);
+    }
+  }
+
+  // Not ours: chain to the previous handler
+  if (previousAction.sa_flags & SA_SIGINFO) {
+    previousAction.sa_sigaction(signal, info, context);
+    return;
+  }
+  if (previousAction.sa_handler != SIG_DFL &&
+      previousAction.sa_handler != SIG_IGN) {
+    previousAction.sa_handler(signal);
+    return;
+  }
+
+  // Or fall back to the default action, the access faults again
+  std::signal(signal, SIG_DFL);
+}
+
+static void installFaultHandler() {
+  static bool installed = false;
+  if (installed) {
+    return;
+  }
+
+  struct sigaction action = {};
+  action.sa_sigaction = onSegmentationFault;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previousAction);
+  installed = true;
+}
+
+void *reserveGuardedRegion(size_t bytes, size_t &usableBytes) {
+  auto page = pageSize();
+  usableBytes = (bytes + page - 1) / page * page;
+
+  auto mapping = mmap(nullptr, usableBytes + 2 * page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) {
+    DIE << "StackRegion: cannot reserve " << bytes << " bytes.";
+  }
+
+  auto low = static_cast<uint8_t *>(mapping);
+  auto region = low + page;
+  auto high = region + usableBytes;
+  if (mprotect(low, page, PROT_NONE) != 0 ||
+      mprotect(high, page, PROT_NONE) != 0) {
+    DIE << "StackRegion: cannot protect the guard pages.";
+  }
+
+  installFaultHandler();
+
+  for (auto &slot : guardSlots) {
+    uintptr_t expected = 0;
+    if (slot.low.compare_exchange_strong(expected,
+                                         reinterpret_cast<uintptr_t>(low))) {
+      slot.high.store(reinterpret_cast<uintptr_t>(high));
+      return region;
+    }
+  }
+
+  DIE << "StackRegion: more than " << MAX_GUARDS
+      << " guarded regions are live.";
+  return nullptr;
+}
+
+void releaseGuardedRegion(void *region, size_t usableBytes) {
+  auto low = reinterpret_cast<uintptr_t>(region) - pageSize();
+
+  for (auto &slot : guardSlots) {
+    if (slot.low.load() == low) {
+      slot.high.store(0);
+      slot.low.store(0);
+      break;
+    }
+  }
+
+  munmap(reinterpret_cast<void *>(low), usableBytes + 2 * pageSize());
+}
@@ -0,0 +1,58 @@
+#ifndef __StackRegion_h
+#define __StackRegion_h
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Reserves `bytes` of memory between two inaccessible guard pages, and
+ * arms the guards so that touching the one below reports a stack
+ * underflow, the one above a stack overflow, and exits. Pages are only
+ * committed by the OS once touched, so a large reservation costs nothing
+ * until the stack actually grows into it. Other faults go on to the
+ * SIGSEGV handler installed before.
+ */
+void *reserveGuardedRegion(size_t bytes, size_t &usableBytes);
+
+void releaseGuardedRegion(void *region, size_t usableBytes);
+
+/**
+ * Contiguous stack of T living in a guarded region. Running past end(),
+ * or below begin(), faults on a guard page instead of needing a bounds
+ * check per push or pop.
+ */
+template <typename T> class StackRegion {
+public:
+  explicit StackRegion(size_t capacity) {
+    size_t usableBytes;
+    auto region = reserveGuardedRegion(capacity * sizeof(T), usableBytes);
+    begin_ = static_cast<T *>(region);
+    capacity_ = usableBytes / sizeof(T);
+    usableBytes_ = usableBytes;
+  }
+
+  ~StackRegion() { releaseGuardedRegion(begin_, usableBytes_); }
+
+  StackRegion(const StackRegion &) = delete;
+
+  StackRegion &operator=(const StackRegion &) = delete;
+
+  T *begin() const { return begin_; }
+
+  T *end() const { return begin_ + capacity_; }
+
+  T *data() const { return begin_; }
+
+  size_t size() const { return capacity_; }
+
+  T &operator[](size_t index) const { return begin_[index]; }
+
+private:
+  T *begin_;
+
+  size_t capacity_;
+
+  size_t usableBytes_;
+};
+
+#endif // !__StackRegion_h
@@ -0,0 +1,68 @@
+#include "StringTable.h"
+#include "EvaValue.h"
+
+StringObject *StringTable::find(std::string_view string, size_t hash) const {
+  if (count_ == 0) {
+    return nullptr;
+  }
+
+  auto mask = slots_.size() - 1;
+  for (auto i = hash & mask; slots_[i] != nullptr; i = (i + 1) & mask) {
+    if (slots_[i]->hash == hash && slots_[i]->view() == string) {
+      return slots_[i];
+    }
+  }
+  return nullptr;
+}
+
+void StringTable::add(StringObject *string) {
+  // At most half of the slots are in use
+  if ((count_ + 1) * 2 > slots_.size()) {
+    rehash(slots_.empty() ? 64 : slots_.size() * 2);
+  }
+
+  auto mask = slots_.size() - 1;
+  auto i = string->hash & mask;
+  while (slots_[i] != nullptr) {
+    i = (i + 1) & mask;
+  }
+  slots_[i] = string;
+  count_++;
+}
+
+void StringTable::remove(StringObject *string) {
+  auto mask = slots_.size() - 1;
+  auto i = string->hash & mask;
+  while (slots_[i] != string) {
+    i = (i + 1) & mask;
+  }
+
+  // Move back every following entry of the run whose home slot is at or
+  // before the hole, so that no probe stops early
+  for (auto j = (i + 1) & mask; slots_[j] != nullptr; j = (j + 1) & mask) {
+    auto home = slots_[j]->hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      slots_[i] = slots_[j];
+      i = j;
+    }
+  }
+  slots_[i] = nullptr;
+  count_--;
+}
+
+void StringTable::clear() {
+  slots_.clear();
+  count_ = 0;
+}
+
+void StringTable::rehash(size_t capacity) {
+  std::vector<StringObject *> old(capacity, nullptr);
+  slots_.swap(old);
+  count_ = 0;
+
+  for (auto string : old) {
+    if (string != nullptr) {
+      add(string);
+    }
+  }
+}
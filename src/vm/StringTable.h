@@ -0,0 +1,38 @@
+#ifndef __StringTable_h
+#define __StringTable_h
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+struct StringObject;
+
+/**
+ * Weak set of the live strings, which interns them: allocString returns
+ * the equal string already in the table if there is one, and the collector
+ * removes the strings it frees without the table keeping any alive. Open
+ * addressing with linear probing over the cached hashes; a removal shifts
+ * the entries after it back instead of leaving a tombstone.
+ */
+class StringTable {
+public:
+  /**
+   * The interned string equal to `string`, or nullptr.
+   */
+  StringObject *find(std::string_view string, size_t hash) const;
+
+  void add(StringObject *string);
+
+  void remove(StringObject *string);
+
+  void clear();
+
+private:
+  void rehash(size_t capacity);
+
+  std::vector<StringObject *> slots_;
+
+  size_t count_ = 0;
+};
+
+#endif // !__StringTable_h
@@ -0,0 +1,80 @@
+#include "../src/Logger.h"
+#include "../src/vm/EvaVm.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/**
+ * Regression test runner: evaluates a program and compares its result,
+ * as printed by evaValueToConstantString, with an expected file.
+ *
+ *   EvaTestRunner <program.eva> <program.expected> stack|register|jit|checked
+ *
+ * The disassembly and prints of the program are silenced. A program
+ * expected to fail dies as usual, ctest matches the error message.
+ */
+
+static std::string readFile(const char *path) {
+  std::ifstream file(path);
+  if (!file) {
+    DIE << "EvaTestRunner: cannot read " << path << ".";
+  }
+  std::stringstream ss;
+  ss << file.rdbuf();
+  return ss.str();
+}
+
+static std::string trim(const std::string &text) {
+  auto begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  auto end = text.find_last_not_of(" \t\r\n");
+  return text.substr(begin, end - begin + 1);
+}
+
+static std::string run(const std::string &program, const char *mode) {
+  EvalOptions options;
+  options.checked = std::strcmp(mode, "checked") == 0;
+
+  auto evalMode = std::strcmp(mode, "register") == 0 ? EvalMode::REGISTER
+                                                     : EvalMode::STACK;
+  if (evalMode == EvalMode::STACK && std::strcmp(mode, "stack") != 0 &&
+      std::strcmp(mode, "jit") != 0 && !options.checked) {
+    DIE << "EvaTestRunner: unknown mode " << mode << ".";
+  }
+
+  EvaVm vm(evalMode, DEFAULT_STACK_SIZE, options);
+  // The stack mode is the plain interpreter, the JIT has its own
+  vm.setJitEnabled(std::strcmp(mode, "jit") == 0);
+
+  // The result is printed before the VM frees the objects it may point to
+  return evaValueToConstantString(vm.exec(program));
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " <program.eva> <program.expected> "
+                 "stack|register|jit|checked\n";
+    return EXIT_FAILURE;
+  }
+
+  auto program = readFile(argv[1]);
+  auto expected = trim(readFile(argv[2]));
+
+  std::stringstream silenced;
+  auto out = std::cout.rdbuf(silenced.rdbuf());
+  auto actual = run(program, argv[3]);
+  std::cout.rdbuf(out);
+
+  if (actual != expected) {
+    std::cerr << argv[1] << " (" << argv[3] << "):\n"
+              << "  expected: " << expected << "\n"
+              << "  actual:   " << actual << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}